@@ -0,0 +1,321 @@
+/* benchmark for the accept models with skewed keep-alive traffic: a server is started
+ * with the given accept model, and a burst of keep-alive connections is opened to it.
+ * a few of them are hot and send their next request as soon as they have a response,
+ * while the others only send one every 50ms. every request costs the server some cpu
+ * time, so a thread that ends up with more connections (and hot ones) than the
+ * others answers them later.
+ *
+ * at the end, it prints how many connections and requests each thread had, and the
+ * latency percentiles of hot and idle requests.
+ *
+ * usage: bench-accept-skew <reuseport|shared> [threads] [connections] [hot percent]
+ *                          [seconds] [work us]
+ */
+
+#include "h2ow.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define PORT 8089
+#define CLIENT_THREADS 4
+#define MAX_THREADS 256
+#define IDLE_INTERVAL_NS (50 * 1000 * 1000ULL)
+#define MAX_SAMPLES (1 << 22)
+
+static h2ow_context context;
+static uint64_t handled[MAX_THREADS];
+static int work_us = 50;
+
+static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+typedef struct conn_s {
+	int fd;
+	int hot;
+	int inflight;
+	uint64_t sent_at;
+	uint64_t next_send;
+	size_t len;
+	char buf[1024];
+} conn;
+
+typedef struct client_s {
+	pthread_t thread;
+	conn* conns;
+	int num_conns;
+	uint64_t* samples[2]; // idle, hot
+	size_t num_samples[2];
+} client;
+
+static volatile int stop_clients;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_handler(h2o_req_t* req, h2ow_run_context* rctx) {
+	for (int i = 0; i < context.settings.thread_count; i++) {
+		if (context.run_contexts[i] == rctx)
+			__sync_fetch_and_add(&handled[i], 1);
+	}
+
+	// pretend to do some work
+	uint64_t until = now_ns() + work_us * 1000ULL;
+	while (now_ns() < until) {
+	}
+
+	req->res.status = 200;
+	req->res.reason = "OK";
+	h2o_send_inline(req, H2O_STRLIT("ok"));
+}
+
+static void* run_server(void* arg) {
+	(void)arg;
+	if (h2ow_run(&context) < 0)
+		fprintf(stderr, "error running server\n");
+	return NULL;
+}
+
+static int connect_server(void) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(PORT) };
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+// returns 1 once c->buf has a whole response
+static int have_response(conn* c) {
+	c->buf[c->len] = '\0';
+	char* end = strstr(c->buf, "\r\n\r\n");
+	if (end == NULL)
+		return 0;
+
+	size_t body_len = 0;
+	for (char* line = strstr(c->buf, "\r\n"); line != NULL && line < end;
+	     line = strstr(line + 2, "\r\n"))
+	{
+		if (strncasecmp(line + 2, "content-length:", 15) == 0)
+			body_len = strtoul(line + 17, NULL, 10);
+	}
+
+	return c->len >= (size_t)(end + 4 - c->buf) + body_len;
+}
+
+static void* run_client(void* arg) {
+	client* cl = arg;
+	struct pollfd* pfds = malloc(cl->num_conns * sizeof(*pfds));
+	conn** polled = malloc(cl->num_conns * sizeof(*polled));
+
+	while (!stop_clients) {
+		uint64_t now = now_ns();
+		int num_polled = 0;
+
+		for (int i = 0; i < cl->num_conns; i++) {
+			conn* c = &cl->conns[i];
+
+			if (!c->inflight && now >= c->next_send) {
+				if (write(c->fd, request, sizeof(request) - 1) < 0) {
+					perror("write");
+					exit(1);
+				}
+				c->inflight = 1;
+				c->sent_at = now;
+				c->len = 0;
+			}
+
+			if (c->inflight) {
+				pfds[num_polled] = (struct pollfd){ .fd = c->fd, .events = POLLIN };
+				polled[num_polled++] = c;
+			}
+		}
+
+		if (poll(pfds, num_polled, 1) < 0 && errno != EINTR) {
+			perror("poll");
+			exit(1);
+		}
+
+		for (int i = 0; i < num_polled; i++) {
+			conn* c = polled[i];
+			if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+			if (n <= 0) {
+				fprintf(stderr, "server closed a connection\n");
+				exit(1);
+			}
+			c->len += n;
+
+			if (!have_response(c))
+				continue;
+
+			uint64_t done = now_ns();
+			if (cl->num_samples[c->hot] < MAX_SAMPLES)
+				cl->samples[c->hot][cl->num_samples[c->hot]++] = done - c->sent_at;
+
+			c->inflight = 0;
+			c->next_send = c->hot ? done : done + IDLE_INTERVAL_NS;
+		}
+	}
+
+	free(pfds);
+	free(polled);
+	return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void print_latencies(const char* name, client* clients, int hot) {
+	size_t total = 0;
+	for (int i = 0; i < CLIENT_THREADS; i++) {
+		total += clients[i].num_samples[hot];
+	}
+	if (total == 0) {
+		printf("%s: no requests\n", name);
+		return;
+	}
+
+	uint64_t* all = malloc(total * sizeof(*all));
+	size_t n = 0;
+	for (int i = 0; i < CLIENT_THREADS; i++) {
+		memcpy(all + n, clients[i].samples[hot],
+		       clients[i].num_samples[hot] * sizeof(*all));
+		n += clients[i].num_samples[hot];
+	}
+	qsort(all, total, sizeof(*all), compare_u64);
+
+	printf("%s: %zu requests, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+	       name, total, all[total / 2] / 1e3, all[total * 99 / 100] / 1e3,
+	       all[total * 999 / 1000] / 1e3, all[total - 1] / 1e3);
+	free(all);
+}
+
+int main(int argc, char** argv) {
+	int shared = argc > 1 && strcmp(argv[1], "shared") == 0;
+	if (argc < 2 || (!shared && strcmp(argv[1], "reuseport") != 0)) {
+		fprintf(stderr, "usage: %s <reuseport|shared> [threads] [connections] "
+		                "[hot percent] [seconds] [work us]\n",
+		        argv[0]);
+		return 1;
+	}
+
+	int model = shared ? H2OW_ACCEPT_SHARED : H2OW_ACCEPT_REUSEPORT;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	int num_conns = argc > 3 ? atoi(argv[3]) : 256;
+	int hot_percent = argc > 4 ? atoi(argv[4]) : 10;
+	int seconds = argc > 5 ? atoi(argv[5]) : 5;
+	work_us = argc > 6 ? atoi(argv[6]) : 50;
+
+	if (threads < 1 || threads > MAX_THREADS || num_conns < 1) {
+		fprintf(stderr, "invalid number of threads or connections\n");
+		return 1;
+	}
+
+	h2ow_set_defaults(&context);
+	h2ow_setopt(&context, H2OW_DEFAULT_HOST, "127.0.0.1", PORT);
+	h2ow_setopt(&context, H2OW_THREAD_COUNT, threads);
+	h2ow_setopt(&context, H2OW_ACCEPT_MODEL, model);
+	h2ow_setopt(&context, H2OW_DEBUG_LEVEL, H2OW_DEBUG_ERR);
+	h2ow_register_handler(&context, H2OW_METHOD_GET, "/", H2OW_FIXED_PATH, bench_handler);
+
+	pthread_t server;
+	pthread_create(&server, NULL, run_server, NULL);
+
+	// wait for the server to listen
+	int probe;
+	for (int i = 0; (probe = connect_server()) < 0; i++) {
+		if (i == 1000) {
+			fprintf(stderr, "server didn't start\n");
+			return 1;
+		}
+		usleep(10000);
+	}
+	close(probe);
+
+	// open all connections at once, spreading the hot ones evenly over them
+	client clients[CLIENT_THREADS];
+	memset(clients, 0, sizeof(clients));
+	conn* conns = calloc(num_conns, sizeof(*conns));
+	int hot_every = hot_percent > 0 ? 100 / hot_percent : num_conns + 1;
+
+	for (int i = 0; i < num_conns; i++) {
+		conns[i].fd = connect_server();
+		if (conns[i].fd < 0) {
+			perror("connect");
+			return 1;
+		}
+		conns[i].hot = i % hot_every == 0;
+	}
+
+	// let the server see all of them before counting
+	usleep(200000);
+	printf("%s, %d threads, %d connections (%d%% hot), %d us per request\n", argv[1],
+	       threads, num_conns, hot_percent, work_us);
+	for (int i = 0; i < threads; i++) {
+		printf("thread %d: %d connections\n", i,
+		       *(volatile int*)&context.run_contexts[i]->num_connections);
+	}
+
+	for (int i = 0; i < CLIENT_THREADS; i++) {
+		client* cl = &clients[i];
+		int first = num_conns * i / CLIENT_THREADS;
+		cl->conns = conns + first;
+		cl->num_conns = num_conns * (i + 1) / CLIENT_THREADS - first;
+		cl->samples[0] = malloc(MAX_SAMPLES * sizeof(uint64_t));
+		cl->samples[1] = malloc(MAX_SAMPLES * sizeof(uint64_t));
+		pthread_create(&cl->thread, NULL, run_client, cl);
+	}
+
+	sleep(seconds);
+	stop_clients = 1;
+	for (int i = 0; i < CLIENT_THREADS; i++) {
+		pthread_join(clients[i].thread, NULL);
+	}
+
+	for (int i = 0; i < threads; i++) {
+		printf("thread %d: %lu requests\n", i, (unsigned long)handled[i]);
+	}
+	print_latencies("hot", clients, 1);
+	print_latencies("idle", clients, 0);
+
+	for (int i = 0; i < num_conns; i++) {
+		close(conns[i].fd);
+	}
+	kill(getpid(), SIGINT);
+	pthread_join(server, NULL);
+
+	for (int i = 0; i < CLIENT_THREADS; i++) {
+		free(clients[i].samples[0]);
+		free(clients[i].samples[1]);
+	}
+	free(conns);
+	return 0;
+}
@@ -0,0 +1,165 @@
+/* benchmark for decoding big x-www-form-urlencoded bodies: a form of about 1 MB is
+ * parsed with h2ow_post_parse and h2ow_post_parse_vecs, and with the byte-at-a-time
+ * parsers from tests/urlencoded-ref.c they replaced. most of the form is letters, with
+ * an escape or a '+' every 50 bytes or so.
+ *
+ * it also times looking up a few fields (the first, the last and one that isn't
+ * there) with h2ow_post_lazy_get, against h2ow_post_parse_vecs and h2ow_post_get_vec
+ * on the whole form. the lazy lookups run on the form as it was sent, like they would
+ * in a handler, since parse_once copies it into buf each time.
+ *
+ * it prints the best time of some runs for each of them.
+ *
+ * usage: bench-urlencoded [min value length] [max value length] [runs]
+ */
+
+#include "h2ow.h"
+#include "../tests/urlencoded-ref.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FORM_SIZE (1 << 20)
+#define NUM_LOOKUPS 3
+
+// the keys that are looked up; see main
+static h2o_iovec_t lookups[NUM_LOOKUPS];
+
+static char* gen_form(size_t* len, int min_val, int max_val) {
+	char* form = malloc(FORM_SIZE + 1);
+	size_t i = 0;
+
+	while (i < FORM_SIZE - 64) {
+		i += sprintf(form + i, "field%zu=", i);
+
+		int val_len = min_val + rand() % (max_val - min_val + 1);
+		for (int j = 0; j < val_len && i < FORM_SIZE - 8; j++) {
+			int r = rand() % 100;
+			if (r == 0) {
+				memcpy(form + i, "%2F", 3);
+				i += 3;
+			}
+			else if (r == 1) {
+				form[i++] = '+';
+			}
+			else {
+				form[i++] = 'a' + rand() % 26;
+			}
+		}
+		form[i++] = '&';
+	}
+
+	// no trailing '&'
+	*len = i - 1;
+	form[*len] = '\0';
+	return form;
+}
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// parser 0 and 1 are the old and new cstr parsers, 2 and 3 the vecs ones, 4 and 5 the
+// lookups with the vecs parser and the lazy ones
+static double parse_once(const char* form, char* buf, size_t len, int parser) {
+	static ref_field fields[FORM_SIZE / 2];
+	int num_fields;
+	h2o_req_t req;
+
+	memcpy(buf, form, len);
+	memset(&req, 0, sizeof(req));
+	h2o_mem_init_pool(&req.pool);
+	req.entity = h2o_iovec_init(buf, len);
+
+	double start = now_ms();
+	switch (parser) {
+	case 0:
+		ref_post_parse(&req, fields, &num_fields);
+		break;
+
+	case 1: {
+		h2ow_post_data data;
+		h2ow_post_parse(&req, &data);
+		break;
+	}
+
+	case 2:
+		ref_post_parse_vecs(&req, fields, &num_fields);
+		break;
+
+	case 3: {
+		h2ow_post_vecs data;
+		h2ow_post_parse_vecs(&req, &data);
+		break;
+	}
+
+	case 4: {
+		h2ow_post_vecs data;
+		h2ow_post_parse_vecs(&req, &data);
+		for (int i = 0; i < NUM_LOOKUPS; i++)
+			h2ow_post_get_vec(&data, lookups[i].base, lookups[i].len);
+		break;
+	}
+
+	case 5: {
+		h2ow_post_lazy lazy;
+		h2o_iovec_t val;
+		h2ow_post_lazy_init(&req, &lazy);
+		for (int i = 0; i < NUM_LOOKUPS; i++)
+			h2ow_post_lazy_get(&lazy, lookups[i].base, lookups[i].len, &val);
+		break;
+	}
+	}
+	double elapsed = now_ms() - start;
+
+	h2o_mem_clear_pool(&req.pool);
+	return elapsed;
+}
+
+int main(int argc, char** argv) {
+	int min_val = argc > 1 ? atoi(argv[1]) : 20;
+	int max_val = argc > 2 ? atoi(argv[2]) : 300;
+	int runs = argc > 3 ? atoi(argv[3]) : 30;
+
+	if (min_val < 0 || max_val < min_val || runs <= 0) {
+		printf("usage: %s [min value length] [max value length] [runs]\n", argv[0]);
+		return 1;
+	}
+
+	size_t len;
+	srand(1);
+	char* form = gen_form(&len, min_val, max_val);
+	char* buf = malloc(len + 1);
+
+	// the first and the last key, and one that isn't in the form
+	const char* last = strrchr(form, '&') + 1;
+	lookups[0] = h2o_iovec_init("field0", 6);
+	lookups[1] = h2o_iovec_init(last, strchr(last, '=') - last);
+	lookups[2] = h2o_iovec_init("nonexistent", 11);
+
+	double best[6] = { 1e9, 1e9, 1e9, 1e9, 1e9, 1e9 };
+	for (int run = 0; run < runs; run++) {
+		// alternate between the parsers, so they all see the same noise
+		for (int parser = 0; parser < 6; parser++) {
+			double elapsed = parse_once(form, buf, len, parser);
+			if (elapsed < best[parser])
+				best[parser] = elapsed;
+		}
+	}
+
+	printf("%zu byte form, values of %d to %d bytes\n", len, min_val, max_val);
+	printf("cstr: old %.3f ms, new %.3f ms (%.1fx)\n", best[0], best[1],
+	       best[0] / best[1]);
+	printf("vecs: old %.3f ms, new %.3f ms (%.1fx)\n", best[2], best[3],
+	       best[2] / best[3]);
+	printf("%d lookups: vecs %.3f ms, lazy %.3f ms (%.1fx)\n", NUM_LOOKUPS, best[4],
+	       best[5], best[4] / best[5]);
+
+	free(form);
+	free(buf);
+	return 0;
+}
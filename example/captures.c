@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "h2ow.h"
+
+// captures point into req->path and aren't null-terminated, so use %.*s for them
+void user_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_context* rctx,
+                  h2o_iovec_t* captures, int num_captures) {
+	char* response = h2ow_req_pool_alloc(req, 512);
+	int len = 0;
+
+	// for "/users/:id/posts/:post", captures[0] is the id and captures[1] the post
+	for (int i = 0; i < num_captures && len >= 0 && len < 512; i++) {
+		len += snprintf(response + len, 512 - len, "capture %d: %.*s\n", i,
+		                (int)captures[i].len, captures[i].base);
+	}
+
+	if (len < 0 || len >= 512) {
+		req->res.status = 500;
+		req->res.reason = "Internal Server Error";
+		h2o_send_inline(req, H2O_STRLIT("response too long\n"));
+		return;
+	}
+
+	req->res.status = 200;
+	req->res.reason = "OK";
+	h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+	               H2O_STRLIT("text/plain"));
+	h2o_send_inline(req, response, len);
+}
+
+int main() {
+	h2ow_context context;
+	h2ow_set_defaults(&context);
+	h2ow_setopt(&context, H2OW_DEFAULT_HOST, "0.0.0.0", 8080);
+
+	// every ":name" segment of a PARAM_PATH handler is one capture
+	h2ow_register_capture_handler(&context, H2OW_METHOD_GET, "/users/:id/posts/:post",
+	                              H2OW_PARAM_PATH, user_handler);
+
+	// for WILDCARD_PATH handlers, every '*', '?' and [...] is a capture
+	h2ow_register_capture_handler(&context, H2OW_METHOD_GET, "/files/*.*",
+	                              H2OW_WILDCARD_PATH, user_handler);
+
+	// and for REGEX_PATH handlers, every subexpression
+	h2ow_register_capture_handler(&context, H2OW_METHOD_GET,
+	                              "^/archive/([0-9]{4})/([a-z]+)$", H2OW_REGEX_PATH,
+	                              user_handler);
+
+	if (h2ow_run(&context) < 0) {
+		printf("Error running server\n");
+	}
+
+	return 0;
+}
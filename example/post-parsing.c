@@ -14,6 +14,7 @@ const char form[]
           "\t\t<input type=\"text\" name=\"test-field\" required><br>\n"
           "\t\t<button type=\"submit\" formaction=\"/cstr-post\">Submit to c-string-based handler</button>\n"
           "\t\t<button type=\"submit\" formaction=\"/vector-post\">Submit to vector-based handler</button>\n"
+          "\t\t<button type=\"submit\" formaction=\"/lazy-post\">Submit to lazy handler</button>\n"
           "\t</form>\n"
           "</body>\n";
 int form_len = sizeof(form) / sizeof(*form);
@@ -55,7 +56,9 @@ void cstr_post_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_context*
 	int len = snprintf(response, 512, "Found field with key %s and value %s\n",
 	                   field->key, field->val);
 
-	if (len < 0) {
+	// snprintf returns the length the whole string would have had, which is more
+	// than we have in response if the value is too long for it
+	if (len < 0 || len >= 512) {
 		send_error(req);
 		return;
 	}
@@ -69,7 +72,7 @@ void cstr_post_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_context*
 
 void vector_post_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_context* rctx) {
 	// the vector variants of h2ow_post_* work with null bytes, are faster and
-	// will probably at some point support file uploads via multipart/form-data.
+	// also support file uploads via multipart/form-data.
 	// For simple applications they are however a little more annoying to work with,
 	// so you can safely go for the other variants if your code is already fast enough,
 	// since the c string functions are easier to use correctly
@@ -92,7 +95,37 @@ void vector_post_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_contex
 	                   (int)field->key.len, field->key.base, (int)field->val.len,
 	                   field->val.base);
 
-	if (len < 0) {
+	if (len < 0 || len >= 512) {
+		send_error(req);
+		return;
+	}
+
+	req->res.status = 200;
+	req->res.reason = "OK";
+	h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+	               H2O_STRLIT("text/plain"));
+	h2o_send_inline(req, response, len);
+}
+
+void lazy_post_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_context* rctx) {
+	// if you only need a few fields of a form, the lazy variant is faster, since it
+	// only decodes the values you ask for. it leaves the body as it is, and only
+	// works with x-www-form-urlencoded
+	h2ow_post_lazy lazy;
+	h2ow_post_lazy_init(req, &lazy);
+
+	h2o_iovec_t val;
+	if (h2ow_post_lazy_get(&lazy, H2O_STRLIT("test-field"), &val) != 1) {
+		send_error(req);
+		return;
+	}
+
+	char* response = h2ow_req_pool_alloc(req, 512);
+
+	int len = snprintf(response, 512, "Found field with key test-field and value %.*s\n",
+	                   (int)val.len, val.base);
+
+	if (len < 0 || len >= 512) {
 		send_error(req);
 		return;
 	}
@@ -122,6 +155,8 @@ int main() {
 	                      cstr_post_handler);
 	h2ow_register_handler(&context, H2OW_METHOD_POST, "/vector-post", H2OW_FIXED_PATH,
 	                      vector_post_handler);
+	h2ow_register_handler(&context, H2OW_METHOD_POST, "/lazy-post", H2OW_FIXED_PATH,
+	                      lazy_post_handler);
 
 	if (h2ow_run(&context) < 0) {
 		printf("Error running server\n");
@@ -0,0 +1,7 @@
+# routes for static-routes.c; see tools/h2ow-routegen.c for the format
+# methods	type		path			handler		[captures]
+GET|HEAD	fixed		/hello			hello_handler
+POST		fixed		/hello			hello_handler
+GET		fixed		/help			hello_handler
+GET		param		/users/:id		user_handler	captures
+ANY		wildcard	/static/*		hello_handler
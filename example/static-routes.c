@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "h2ow.h"
+
+// generated from routes.spec by h2ow-routegen (see the Makefile)
+extern const h2ow_static_routes example_routes;
+
+void hello_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_context* rctx) {
+	req->res.status = 200;
+	req->res.reason = "OK";
+	h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+	               H2O_STRLIT("text/plain"));
+	h2o_send_inline(req, H2O_STRLIT("hello, world!\n"));
+}
+
+void user_handler(h2o_req_t* req, __attribute__((unused)) h2ow_run_context* rctx,
+                  h2o_iovec_t* captures, __attribute__((unused)) int num_captures) {
+	char* response = h2ow_req_pool_alloc(req, 256);
+	int len = snprintf(response, 256, "user %.*s\n", (int)captures[0].len,
+	                   captures[0].base);
+
+	req->res.status = 200;
+	req->res.reason = "OK";
+	h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+	               H2O_STRLIT("text/plain"));
+	h2o_send_inline(req, response, len < 256 ? len : 255);
+}
+
+int main() {
+	h2ow_context context;
+	h2ow_set_defaults(&context);
+	h2ow_setopt(&context, H2OW_DEFAULT_HOST, "0.0.0.0", 8080);
+
+	// instead of calling h2ow_register_handler for every route
+	if (!h2ow_use_static_routes(&context, &example_routes)) {
+		printf("Error setting up routes\n");
+		return 1;
+	}
+
+	if (h2ow_run(&context) < 0) {
+		printf("Error running server\n");
+	}
+
+	return 0;
+}
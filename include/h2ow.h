@@ -6,6 +6,13 @@
 #include "h2ow/handlers.h"
 #include "h2ow/run-setup.h"
 #include "h2ow/runtime.h"
+#include "h2ow/route-cache.h"
+#include "h2ow/conn-pool.h"
+#include "h2ow/steering.h"
+#include "h2ow/listener.h"
+#include "h2ow/tls.h"
 #include "h2ow/utils.h"
+#include "h2ow/body-stream.h"
+#include "h2ow/multipart.h"
 
 #endif
@@ -0,0 +1,19 @@
+#ifndef _H2OW_ACCEPTOR_H_INCLUDED
+#define _H2OW_ACCEPTOR_H_INCLUDED
+
+#include "defs.h"
+
+// with H2OW_ACCEPT_SHARED: set up the queue of rctx, and if rctx is the first thread,
+// also a listening socket for each of wctx->listen_addrs in rctx->listeners.
+// returns 0 on success or -1 on error, after cleaning up
+int h2ow__create_acceptor(h2ow_run_context* rctx);
+
+// undo h2ow__create_acceptor, calling cb for every handle closed.
+// returns the number of handles closed
+int h2ow__close_acceptor(h2ow_run_context* rctx, uv_close_cb cb);
+
+// called by workers when a connection is closed, in case the acceptor stopped
+// accepting because of the connection limits
+void h2ow__wake_acceptor(h2ow_run_context* rctx);
+
+#endif
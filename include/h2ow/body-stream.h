@@ -0,0 +1,31 @@
+#ifndef _H2OW_BODY_STREAM_H_INCLUDED
+#define _H2OW_BODY_STREAM_H_INCLUDED
+
+#include "defs.h"
+
+// start reading the body of req from a H2OW_HANDLER_STREAMING handler; on_chunk gets
+// every part of it as it arrives, and data is stored in the returned stream. returns
+// NULL if we ran out of memory. the stream belongs to the request, so it mustn't be
+// used after the request is done (e.g. after responding and getting the last chunk)
+h2ow_body_stream* h2ow_stream_body(h2o_req_t* req, h2ow_run_context* rctx,
+                                   h2ow_body_cb on_chunk, void* data);
+
+// stop handing chunks to on_chunk until h2ow_body_resume is called; meanwhile, up to
+// settings->body_window bytes are buffered, and then the client has to wait.
+// both can also be called from on_chunk.
+//
+// a chunk passed to on_chunk stays valid until on_chunk returns if the stream isn't
+// paused then, and otherwise until the next call to h2ow_body_resume, so a handler
+// that pauses in on_chunk can keep using the chunk until it resumes. a handler that
+// pauses has to resume eventually, since h2o doesn't read the rest of the body
+// (or finish reading it, for the last chunk) before that
+void h2ow_body_pause(h2ow_body_stream* stream);
+void h2ow_body_resume(h2ow_body_stream* stream);
+
+// collect the body of req while it is streamed, and call handler with it in
+// req->entity once it's complete, like if it hadn't been streamed. returns 0 on
+// success or -1 if we ran out of memory
+int h2ow__buffer_body(h2o_req_t* req, h2ow_run_context* rctx,
+                      h2ow_request_handler* handler, h2ow_route_match* match);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _H2OW_CAPTURES_H_INCLUDED
+#define _H2OW_CAPTURES_H_INCLUDED
+
+#include "defs.h"
+
+#include <string.h>
+
+// whether p starts a ":name" segment of the PARAM_PATH pattern
+static inline int h2ow__is_param(const char* pattern, const char* p) {
+	return *p == ':' && (p == pattern || p[-1] == '/');
+}
+
+// number of captures that a handler path of the given type produces
+int h2ow__count_captures(const char* path, int type, const regex_t* regex);
+
+// match path (which doesn't need to be null-terminated) against a PARAM_PATH
+// pattern like "/users/:id". returns the number of captures stored in captures,
+// or -1 if the path doesn't match
+int h2ow__match_param_path(const char* pattern, const char* path, size_t path_len,
+                           h2o_iovec_t* captures);
+
+// whether h2ow__match_glob can be used for pattern. patterns it can't handle are
+// ones that fnmatch does weird things with anyway, like unclosed brackets
+int h2ow__is_capture_glob(const char* pattern);
+
+// same as fnmatch(pattern, path, FNM_PATHNAME), but also stores what each '*', '?'
+// and bracket expression matched in captures. returns the number of captures,
+// or -1 if the path doesn't match
+int h2ow__match_glob(const char* pattern, const char* path, size_t path_len,
+                     h2o_iovec_t* captures);
+
+// match path against a compiled REGEX_PATH pattern and store what its subexpressions
+// matched in captures (subexpressions that didn't participate are empty).
+// returns the number of captures, or -1 if the path doesn't match
+int h2ow__match_regex(const regex_t* regex, const char* path, size_t path_len,
+                      h2o_iovec_t* captures);
+
+// hand the captures of a matching handler to whoever called the lookup, copying
+// them into pool so that they live as long as the request
+static inline void h2ow__return_captures(h2o_mem_pool_t* pool, const h2o_iovec_t* src,
+                                         int num, h2o_iovec_t** captures,
+                                         int* num_captures) {
+	*captures = NULL;
+	*num_captures = num;
+
+	if (num > 0) {
+		*captures = h2o_mem_alloc_shared(pool, num * sizeof(*src), NULL);
+		memcpy(*captures, src, num * sizeof(*src));
+	}
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef _H2OW_CONN_POOL_H_INCLUDED
+#define _H2OW_CONN_POOL_H_INCLUDED
+
+#include "defs.h"
+#include "runtime.h"
+
+// preallocate prealloc connection objects, and keep up to max_free more around when
+// they are given back. returns 0 on success or -1 if we ran out of memory
+int h2ow__init_conn_pool(h2ow_conn_pool* pool, int prealloc, int max_free);
+void h2ow__free_conn_pool(h2ow_conn_pool* pool);
+
+// take a connection object out of the pool, or NULL if we ran out of memory
+uv_tcp_and_data* h2ow__conn_pool_get(h2ow_conn_pool* pool);
+void h2ow__conn_pool_put(h2ow_conn_pool* pool, uv_tcp_and_data* conn);
+
+// add up how many connection objects are currently in use and how many are free in
+// the pools of all threads; like h2ow_get_route_cache_stats, this is only
+// approximate while the server is running
+void h2ow_get_conn_pool_stats(h2ow_context* wctx, int* in_use, int* num_free);
+
+#endif
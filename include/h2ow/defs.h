@@ -4,10 +4,15 @@
 #define H2O_USE_LIBUV 1
 
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <regex.h>
 #include <h2o.h>
 #include <uv.h>
 
+#include "uthash.h"
+
 // define likely() and unlikely() depending on the compiler
 #if defined(__GNUC__) || defined(__clang__)
 #	ifndef likely
@@ -25,12 +30,44 @@
 #	endif
 #endif
 
+// run contexts are aligned to this, so threads don't share cache lines
+#define H2OW_CACHE_LINE 64
+
 // some typedefs
 typedef struct h2ow_settings_s h2ow_settings;
 typedef struct h2ow_run_context_s h2ow_run_context;
 typedef struct h2ow_context_s h2ow_context;
 typedef struct h2ow_request_handler_s h2ow_request_handler;
 typedef struct h2ow_handler_lists_s h2ow_handler_lists;
+typedef struct h2ow_route_node_s h2ow_route_node;
+typedef struct h2ow_fixed_route_s h2ow_fixed_route;
+typedef struct h2ow_method_index_s h2ow_method_index;
+typedef struct h2ow_route_match_s h2ow_route_match;
+typedef struct h2ow_route_cache_s h2ow_route_cache;
+typedef struct h2ow_route_cache_entry_s h2ow_route_cache_entry;
+typedef struct h2ow_static_routes_s h2ow_static_routes;
+typedef struct h2ow_conn_pool_s h2ow_conn_pool;
+typedef struct h2ow_free_conn_s h2ow_free_conn;
+typedef struct h2ow_accept_queue_s h2ow_accept_queue;
+typedef struct h2ow_accepted_socket_s h2ow_accepted_socket;
+typedef struct h2ow_inherited_fd_s h2ow_inherited_fd;
+typedef struct h2ow_thread_stats_s h2ow_thread_stats;
+typedef struct h2ow_host_s h2ow_host;
+typedef struct h2ow_listen_addr_s h2ow_listen_addr;
+typedef struct h2ow_listener_s h2ow_listener;
+typedef struct h2ow_ticket_key_s h2ow_ticket_key;
+typedef struct h2ow_session_s h2ow_session;
+typedef struct h2ow_session_shard_s h2ow_session_shard;
+typedef struct h2ow_tls_state_s h2ow_tls_state;
+typedef struct h2ow_phash_s h2ow_phash;
+typedef struct h2ow_phash_displacement_s h2ow_phash_displacement;
+typedef struct h2ow_regex_dfa_s h2ow_regex_dfa;
+typedef struct h2ow_regex_dfa_group_s h2ow_regex_dfa_group;
+typedef struct h2ow_body_stream_s h2ow_body_stream;
+typedef struct h2ow_buffered_body_s h2ow_buffered_body;
+typedef struct h2ow_multipart_s h2ow_multipart;
+typedef struct h2ow_multipart_part_s h2ow_multipart_part;
+typedef struct h2ow_multipart_callbacks_s h2ow_multipart_callbacks;
 
 typedef struct h2ow_handler_and_data_s h2ow_handler_and_data;
 
@@ -46,15 +83,27 @@ typedef struct h2ow_handler_and_data_s h2ow_handler_and_data;
 #define H2OW_METHOD_CONNECT 0x40
 #define H2OW_METHOD_PATCH 0x80
 #define H2OW_METHOD_TRACE 0x100
+// number of methods above; they're bits 0-(NUM_METHODS - 1)
+#define H2OW_NUM_METHODS 9
 
 // idk how enums work lol
 // also, these need to be 0-(NUM_PATH_TYPES - 1) or stuff will break horribly
-#define H2OW_NUM_PATH_TYPES 3
+// (PARAM_PATH handlers like "/users/:id" are matched after FIXED_PATH handlers and
+// before WILDCARD_PATH handlers, no matter what number they have)
+#define H2OW_NUM_PATH_TYPES 4
 #define H2OW_FIXED_PATH 0
 #define H2OW_WILDCARD_PATH 1
 #define H2OW_REGEX_PATH 2
+#define H2OW_PARAM_PATH 3
 
-enum handler_type { H2OW_HANDLER_NORMAL, H2OW_HANDLER_CO };
+// H2OW_HANDLER_STREAMING handlers are called as soon as the headers are there, and
+// can read the body as it arrives with h2ow_stream_body (see body-stream.c)
+enum handler_type {
+	H2OW_HANDLER_NORMAL,
+	H2OW_HANDLER_CO,
+	H2OW_HANDLER_CAPTURES,
+	H2OW_HANDLER_STREAMING
+};
 
 // regex_t's are stored in a seperate array instead of inside the request_handler
 // because on my machine, they are 64 bytes long, while the pointer only uses 8 bytes.
@@ -62,18 +111,393 @@ enum handler_type { H2OW_HANDLER_NORMAL, H2OW_HANDLER_CO };
 // which should give less ram usage and better cache performance
 struct h2ow_request_handler_s {
 	void (*handler)(h2o_req_t*, h2ow_run_context*);
+	// used instead of handler if call_type is H2OW_HANDLER_CAPTURES
+	void (*capture_handler)(h2o_req_t*, h2ow_run_context*, h2o_iovec_t*, int);
 	const char* path;
 	int methods;
 	int call_type;
+	int num_captures;
+};
+
+// collision-free hash function over a fixed set of keys (see phash.c)
+struct h2ow_phash_displacement_s {
+	uint32_t d0, d1;
+};
+
+struct h2ow_phash_s {
+	uint64_t seed;
+	uint32_t num_buckets;
+	uint32_t mask;
+	h2ow_phash_displacement* displacements;
+	int* slots; // index of the key in each slot, or -1
+};
+
+// indices of handlers, grouped by the methods they accept; the handlers for the
+// method with bit m are handlers[starts[m]] to handlers[starts[m + 1] - 1], in
+// registration order. handlers accepting several methods are in several groups
+struct h2ow_method_index_s {
+	int methods; // all methods accepted by any of the handlers
+	int starts[H2OW_NUM_METHODS + 1];
+	int* handlers;
+};
+
+// all FIXED_PATH handlers with the same path
+struct h2ow_fixed_route_s {
+	const char* path;
+	size_t path_len;
+	h2ow_method_index index;
+};
+
+// DFA that matches REGEX_PATH handlers (see regex-dfa.c). if one DFA for all of them
+// would get too big, they are split into groups, each with its own DFA
+struct h2ow_regex_dfa_group_s {
+	int num_states;
+	int start;
+
+	// next state for each state and byte class (num_states * num_classes entries)
+	int32_t* transitions;
+
+	// patterns that have matched once we reach a state, and patterns that have
+	// matched if the path also ends in that state (because of a '$')
+	uint8_t* has_accepts;
+	uint64_t* accepts;
+	uint64_t* accepts_at_end;
+};
+
+// bitsets over the handlers are stored as num_words uint64_t's
+struct h2ow_regex_dfa_s {
+	int num_words;
+
+	// bytes that no pattern distinguishes share a class, which keeps the tables small
+	int num_classes;
+	uint8_t classes[256];
+
+	int num_groups;
+	h2ow_regex_dfa_group* groups;
+
+	// patterns that the DFA doesn't handle, which still need regexec
+	uint64_t* fallback;
+	int num_fallbacks;
+};
+
+// node of the compressed radix tree that is built from the WILDCARD_PATH handlers
+// once the handler lists are frozen (see router.c)
+struct h2ow_route_node_s {
+	// the part of the path leading from the parent to this node, and the length
+	// of the whole path from the root up to and including this node
+	const char* label;
+	int label_len;
+	int depth;
+
+	// children are kept sorted by the first byte of their label, which is
+	// also stored in first_bytes so we don't have to chase pointers while searching
+	int num_children;
+	char* first_bytes;
+	h2ow_route_node** children;
+
+	// indices of WILDCARD_PATH handlers whose literal prefix ends here, sorted
+	// by registration order
+	int num_wildcards;
+	int* wildcards;
+
+	// only used in the tree of PARAM_PATH handlers: the node that a ":name" segment
+	// after this node leads to, and the handlers whose whole path ends here
+	h2ow_route_node* param_child;
+	int num_params;
+	int* params;
+
+	// the wildcards or params of this node, grouped by method
+	h2ow_method_index index;
+};
+
+// result of looking up the handler for a request, apart from the handler itself
+struct h2ow_route_match_s {
+	// only set for handlers with call_type H2OW_HANDLER_CAPTURES
+	h2o_iovec_t* captures;
+	int num_captures;
+
+	// if no handler was found: the methods that handlers for the path accept.
+	// that's 0 if there's no handler for the path at all (404), and if there's
+	// one for other methods, the response should be a 405
+	int allowed_methods;
+};
+
+// handler lists generated at build time by tools/h2ow-routegen.c; find_fixed returns
+// the index of the FIXED_PATH handler for the path and method with bit m (or -1), and
+// stores the methods accepted for the path in allowed_methods if it has any handlers
+struct h2ow_static_routes_s {
+	h2ow_request_handler* handlers_lists[H2OW_NUM_PATH_TYPES];
+	int num_handlers[H2OW_NUM_PATH_TYPES];
+	int (*find_fixed)(const char* path, size_t path_len, int m, int* allowed_methods);
 };
 
 struct h2ow_handler_lists_s {
 	int num_handlers[H2OW_NUM_PATH_TYPES];
 	h2ow_request_handler* handlers_lists[H2OW_NUM_PATH_TYPES];
 	regex_t* regexes; // see comment above the h2ow_request_handler declaration
+	// set if the lists above come from h2ow_use_static_routes; they aren't ours then
+	const h2ow_static_routes* static_routes;
+
+	// set by h2ow__freeze_handler_lists before the server starts; while frozen,
+	// the lists are shared read-only between threads and can't be modified
+	int is_frozen;
+	int num_fixed_routes;
+	h2ow_fixed_route* fixed_routes;
+	h2ow_phash fixed_phash;
+	h2ow_regex_dfa regex_dfa;
+	// bitsets of the REGEX_PATH handlers accepting each method (see regex_dfa)
+	uint64_t* regex_methods;
+	h2ow_route_node* trie;
+	// max number of nodes with wildcards on any path from the root of the trie
+	int max_wildcard_nodes;
+	h2ow_route_node* param_trie;
+	int max_param_captures;
+};
+
+// results of lookups for paths that are at most ROUTE_CACHE_MAX_PATH bytes long and
+// have at most ROUTE_CACHE_MAX_CAPTURES captures can be cached (see route-cache.c)
+#define H2OW_ROUTE_CACHE_MAX_PATH 128
+#define H2OW_ROUTE_CACHE_MAX_CAPTURES 8
+
+struct h2ow_route_cache_entry_s {
+	uint64_t hash;
+	h2ow_request_handler* handler;
+	int method;
+	int allowed_methods;
+	int path_len; // -1 for empty entries
+	int num_captures;
+	// offset and length of each capture in path; the offset is -1 for
+	// subexpressions that didn't match
+	int16_t captures[H2OW_ROUTE_CACHE_MAX_CAPTURES][2];
+	char path[H2OW_ROUTE_CACHE_MAX_PATH];
+};
+
+// direct-mapped cache of lookup results; every thread has its own, so it doesn't
+// need any locking
+struct h2ow_route_cache_s {
+	h2ow_route_cache_entry* entries;
+	uint64_t mask;
+
+	uint64_t hits;
+	uint64_t misses;
+};
+
+// connection objects that aren't in use are kept in a free list, which points into
+// the memory of the objects themselves (see conn-pool.c)
+struct h2ow_free_conn_s {
+	h2ow_free_conn* next;
+};
+
+// per-thread pool of connection objects, so accepting and closing connections
+// usually doesn't need malloc and free
+struct h2ow_conn_pool_s {
+	// objects preallocated in one block; these are never given back to malloc
+	void* slab;
+	size_t slab_size;
+
+	h2ow_free_conn* free_list;
+	int num_free;
+	// objects that aren't from the slab are freed instead of being added to the
+	// free list once it's this long
+	int max_free;
+
+	int in_use;
+};
+
+// sockets that the acceptor hands to a thread with H2OW_ACCEPT_SHARED (see acceptor.c)
+#define H2OW_ACCEPT_QUEUE_SIZE 1024
+
+struct h2ow_accepted_socket_s {
+	int fd;
+	int ssl;
+};
+
+// single-producer single-consumer ring; only the acceptor moves tail, and only the
+// thread owning the queue moves head, so they're on different cache lines
+struct h2ow_accept_queue_s {
+	uv_async_t async;
+	unsigned int head __attribute__((aligned(H2OW_CACHE_LINE)));
+	unsigned int tail __attribute__((aligned(H2OW_CACHE_LINE)));
+	// the owner clears accepting (holding lock) before closing async on shutdown, and
+	// the acceptor only adds sockets and sends to async while holding lock with
+	// accepting set
+	pthread_mutex_t lock;
+	int accepting;
+	h2ow_accepted_socket entries[H2OW_ACCEPT_QUEUE_SIZE];
+};
+
+/* ================ BODY STUFF ================ */
+// called with each chunk of a streamed request body, in order; is_end is set for
+// the last one. chunk is only valid during the call
+typedef void (*h2ow_body_cb)(h2ow_body_stream* stream, h2o_iovec_t chunk, int is_end);
+
+// state of a request body that a H2OW_HANDLER_STREAMING handler reads; allocated
+// from the request's pool
+struct h2ow_body_stream_s {
+	h2o_req_t* req;
+	h2ow_run_context* rctx;
+	void* data; // for the handler
+
+	h2ow_body_cb on_chunk;
+	int paused;
+
+	// chunks that arrived while paused, up to settings->body_window bytes
+	char* window;
+	size_t buffered;
+	int buffered_end;
+	// the handler paused while it got the window, so nothing is copied into it
+	// until it resumes
+	int window_in_use;
+
+	// a chunk we didn't acknowledge yet, either because it didn't fit into the
+	// window, or because the handler paused while it had it (held_delivered). h2o
+	// keeps it alive (and sends no more) until we call proceed_req
+	h2o_iovec_t held;
+	int held_end;
+	int held_delivered;
+};
+
+// body of a request to a handler that wants all of it, while bodies are streamed
+// because other handlers are H2OW_HANDLER_STREAMING
+struct h2ow_buffered_body_s {
+	h2o_req_t* req;
+	h2ow_run_context* rctx;
+	h2ow_request_handler* handler;
+	h2o_iovec_t* captures;
+	int num_captures;
+	h2o_buffer_t* buf;
+};
+
+// rfc 2046 limits boundaries to 70 bytes; the delimiter is "\r\n--" and the boundary
+#define H2OW_MULTIPART_MAX_BOUNDARY 70
+#define H2OW_MULTIPART_MAX_DELIMITER (H2OW_MULTIPART_MAX_BOUNDARY + 4)
+// max size of the headers of one part
+#define H2OW_MULTIPART_MAX_HEADERS 4096
+
+// a part of a multipart/form-data body (see multipart.c). all slices are only valid
+// during the callback they're passed to
+struct h2ow_multipart_part_s {
+	// all headers of the part, each ending with "\r\n"
+	h2o_iovec_t headers;
+	// from the Content-Disposition and Content-Type headers; base is NULL if missing
+	h2o_iovec_t name;
+	h2o_iovec_t filename;
+	h2o_iovec_t content_type;
+};
+
+struct h2ow_multipart_callbacks_s {
+	// a part starts; its body comes next. can call h2ow_multipart_set_fd
+	void (*on_part)(h2ow_multipart* mp, h2ow_multipart_part* part);
+	// a piece of the body of the current part, unless it goes to a file descriptor
+	void (*on_data)(h2ow_multipart* mp, h2o_iovec_t data);
+	// the current part is complete
+	void (*on_part_end)(h2ow_multipart* mp);
+};
+
+// incremental parser state for a multipart/form-data body
+struct h2ow_multipart_s {
+	const h2ow_multipart_callbacks* cbs;
+	void* data; // for the callbacks
+
+	int state;
+	// file descriptor that the body of the current part is written to, or -1
+	int fd;
+
+	// "\r\n--" followed by the boundary
+	char delimiter[H2OW_MULTIPART_MAX_DELIMITER];
+	int delimiter_len;
+
+	// bytes at the end of the last chunk that might start a delimiter
+	char lookbehind[H2OW_MULTIPART_MAX_DELIMITER];
+	int lookbehind_len;
+
+	// how much of "\r\n\r\n" we've seen at the end of the headers so far
+	int crlfs;
+	// headers that span chunks are collected here
+	char headers[H2OW_MULTIPART_MAX_HEADERS];
+	size_t headers_len;
+};
+
+/* ================ LISTENER STUFF ================ */
+// address that every thread listens on (see listener.c)
+struct h2ow_listen_addr_s {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int ssl;
+};
+
+struct h2ow_listener_s {
+	// a uv_pipe_t for unix sockets; both are streams, so h2ow__on_accept can cast
+	// the stream it gets back to a h2ow_listener
+	union {
+		uv_tcp_t tcp;
+		uv_pipe_t pipe;
+	} handle;
+	const h2ow_listen_addr* addr;
+
+	// unix sockets can't use SO_REUSEPORT, so all threads poll a dup of the first
+	// thread's socket
+	int is_dup;
+	// set if we didn't accept a pending connection because of the connection limits
+	int paused;
+
+	// with H2OW_ACCEPT_SHARED, the first thread polls the socket itself
+	uv_poll_t poll;
+	int fd;
+};
+
+/* ================ TLS STUFF ================ */
+// number of ticket keys we decrypt tickets with; the first one also encrypts them
+#define H2OW_MAX_TICKET_KEYS 4
+#define H2OW_SESSION_CACHE_SHARDS 16
+
+// same layout as the 80 byte key files used by nginx and others
+struct h2ow_ticket_key_s {
+	unsigned char name[16];
+	unsigned char hmac_key[32];
+	unsigned char aes_key[32];
+};
+
+struct h2ow_session_s {
+	unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	unsigned int id_len;
+	// when the session expires, in seconds since the epoch
+	uint64_t expires;
+	// the session in DER, so it can be handed to any thread
+	unsigned char* der;
+	int der_len;
+	UT_hash_handle hh;
+};
+
+struct h2ow_session_shard_s {
+	pthread_mutex_t lock;
+	h2ow_session* sessions;
+	int num_sessions;
+} __attribute__((aligned(H2OW_CACHE_LINE)));
+
+// shared by all threads (see tls.c)
+struct h2ow_tls_state_s {
+	pthread_rwlock_t keys_lock;
+	h2ow_ticket_key keys[H2OW_MAX_TICKET_KEYS];
+	int num_keys;
+
+	h2ow_session_shard* shards;
+	int max_sessions_per_shard;
+
+	// only modified using atomic operations
+	uint64_t num_handshakes;
+	uint64_t num_resumed;
 };
 
 /* ================ SETTINGS STUFF ================ */
+#define H2OW_MAX_HOSTS 16
+
+// a listener added with H2OW_ADD_HOST
+struct h2ow_host_s {
+	const char* addr;
+	int port;
+	int ssl;
+};
 
 struct h2ow_settings_s {
 	const char* ip;
@@ -87,6 +511,52 @@ struct h2ow_settings_s {
 	const char* ssl_key_path;
 	SSL_CTX* ssl_ctx;
 	int ssl_port;
+
+	h2ow_host hosts[H2OW_MAX_HOSTS];
+	int num_hosts;
+
+	// ticket keys are managed by us if manage_tickets is set; see H2OW_SSL_TICKET_KEYS
+	int manage_tickets;
+	const char* ticket_key_path;
+	int ticket_rotation_secs;
+	int session_cache_size;
+	int key_privsep;
+
+	int route_cache_size;
+
+	// connection limits (0 means no limit), the percentage of them below which
+	// paused listeners accept again, and whether to send a 503 instead of pausing
+	int max_connections_per_thread;
+	int max_connections;
+	int resume_percent;
+	int overload_503;
+
+	int conn_pool_prealloc;
+	int conn_pool_max_free;
+
+	// cpus that loop threads are pinned to (thread i gets cpus[i % num_cpus]);
+	// if cpus is NULL, threads are spread over all cpus we may run on
+	int pin_threads;
+	const int* cpus;
+	int num_cpus;
+
+	// steer connections to the thread pinned to the cpu that received them
+	int reuseport_steering;
+
+	int accept_model;
+
+	// backlog of listening sockets, seconds for TCP_DEFER_ACCEPT and queue length
+	// for TCP_FASTOPEN (0 disables the latter two)
+	int listen_backlog;
+	int tcp_defer_accept;
+	int tcp_fastopen;
+
+	int upgrade_signal;
+	int ssl_reload_signal;
+
+	// max bytes of a streamed request body that are buffered while its handler
+	// is paused (see body-stream.c)
+	size_t body_window;
 };
 
 /* ================ PRIVATE STUFF ================ */
@@ -97,35 +567,111 @@ struct h2ow_handler_and_data_s {
 	void* more_data;
 };
 
+// counters of one thread that the stats functions add up (see run-setup.c)
+struct h2ow_thread_stats_s {
+	uint64_t route_cache_hits, route_cache_misses;
+	int conns_in_use, free_conns;
+	uint64_t steering_checks, misrouted;
+	uint64_t accept_errors;
+};
+
+// a listening socket passed to us by the process we replace (see upgrade.c)
+struct h2ow_inherited_fd_s {
+	int fd; // -1 once adopted
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+};
+
 /* ================ USER-VISIBLE STUFF ================ */
 // info about stuff running in the current thread
 struct h2ow_run_context_s {
 	h2ow_context* wctx;
 	h2ow_handler_and_data* root_handler;
 
+	// the cpu the thread is pinned to, or -1
+	int cpu;
+
 	h2o_globalconf_t globconf;
 	h2o_hostconf_t* hostconf;
 	h2o_context_t ctx;
 	h2o_accept_ctx_t accept_ctxs[2];
+	// ssl context from h2ow_reload_ssl that the next tls connection switches
+	// accept_ctxs[1] to; only exchanged atomically. we hold a reference to both
+	SSL_CTX* new_ssl_ctx;
 
-	uv_tcp_t listeners[2];
+	// one for each of wctx->listen_addrs, except with H2OW_ACCEPT_SHARED, where
+	// only the first thread has listeners
+	h2ow_listener* listeners;
+	int num_listeners;
 	uv_loop_t loop;
 	uv_signal_t int_handler, term_handler;
+	// only used by the first thread; data is NULL if it isn't active
+	uv_signal_t upgrade_handler;
+	// waits for the instance started by upgrade_handler to say it's ready, on the
+	// read end of a pipe (upgrade_fd); data is NULL if no upgrade is in progress
+	uv_poll_t upgrade_poll;
+	int upgrade_fd;
+	pid_t upgrade_pid;
+	// only used by the first thread, which rotates the ticket keys; data is NULL if
+	// it isn't active
+	uv_timer_t ticket_timer;
+	// only used by the first thread; data is NULL if it isn't active
+	uv_signal_t reload_handler;
+	// the thread that reloads on reload_handler, which h2ow_run joins before it
+	// returns. reload_requests is only changed atomically, and the thread keeps
+	// going until it handled all of them
+	pthread_t reload_thread;
+	int reload_thread_started;
+	int reload_requests;
 
 	int num_connections;
 
+	// number of listeners that have a connection we didn't accept because of the
+	// connection limits; resume_timer checks whether we can accept them now
+	int paused_listeners;
+	uv_timer_t resume_timer;
+	// connections that got a 503 because of H2OW_OVERLOAD_503
+	uint64_t num_shed_connections;
+	// with H2OW_REUSEPORT_STEERING: connections whose cpu we checked, and the ones
+	// among them that were received on another cpu than ours
+	uint64_t num_steering_checks;
+	uint64_t num_misrouted;
+	// accepts that failed, and the libuv error of the last one
+	uint64_t num_accept_errors;
+	int last_accept_error;
+
+	// with H2OW_ACCEPT_SHARED, every thread gets connections through accept_queue
+	h2ow_accept_queue accept_queue;
+	int acceptor_paused;
+
+	h2ow_route_cache route_cache;
+	h2ow_conn_pool conn_pool;
+
+	// requests that h2ow__request_handler got and that aren't done yet
+	int num_inflight;
+	// set while waiting for connections to close after a termination signal
+	uv_timer_t* drain_timer;
+
 	// number of close callbacks currently running that should finish before
 	// a close callback should use uv_stop();
 	// this is only used in case of error, since we otherwise know how much is left
 	int running_cleanup_cbs;
-};
+} __attribute__((aligned(H2OW_CACHE_LINE)));
 
 // for a set of threads
 struct h2ow_context_s {
-	// array of h2ow_run_contexts which are thread-local
-	h2ow_run_context* run_contexts;
+	// array of h2ow_run_contexts which are thread-local; each one is allocated
+	// separately (see placement.c)
+	h2ow_run_context** run_contexts;
 	pthread_t* threads;
 
+	// protects run_contexts and thread_stats from the stats functions, which may be
+	// called from other threads while h2ow_run starts or stops
+	pthread_mutex_t stats_lock;
+	// the counters of each thread when the last h2ow_run returned, or NULL
+	h2ow_thread_stats* thread_stats;
+	int num_thread_stats;
+
 	// settings, which are set before initializing anything from libuv or h2o
 	h2ow_settings settings;
 
@@ -135,8 +681,30 @@ struct h2ow_context_s {
 	// false during cleanup, true if currently accepting and working on connections
 	int is_running;
 
-	// ssl context, which is shared between threads
+	// connections of all threads; only modified using atomic operations
+	int num_connections;
+
+	// requests that were still running when the shutdown timeout expired; can be
+	// read after h2ow_run returns
+	int num_cut_off_requests;
+
+	// ssl context, which is shared between threads. h2ow_reload_ssl replaces it,
+	// but threads keep using the old one until they see the new one
 	SSL_CTX* ssl_ctx;
+	h2ow_tls_state tls;
+
+	// addresses from the settings that every thread listens on
+	h2ow_listen_addr* listen_addrs;
+	int num_listen_addrs;
+
+	// listening sockets from the process we replace; only used while starting
+	h2ow_inherited_fd* inherited_fds;
+	int num_inherited_fds;
+	// pipe to tell the process we replace that we're ready, or -1
+	int ready_fd;
+	// our binary as it was when h2ow_run started, which upgrades exec; NULL if
+	// upgrades are disabled
+	char* exe_path;
 };
 
 #endif
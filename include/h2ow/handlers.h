@@ -10,15 +10,40 @@
 void h2ow__init_handler_lists(h2ow_handler_lists* hl);
 void h2ow__free_handler_lists(h2ow_handler_lists* hl);
 
+// build the lookup structures for the handler lists; after this, no more handlers
+// can be registered until the lists are thawed again. returns 0 on success, -1 on error
+int h2ow__freeze_handler_lists(h2ow_handler_lists* hl);
+void h2ow__thaw_handler_lists(h2ow_handler_lists* hl);
+
 int h2ow_register_handler(h2ow_context* wctx, int methods, const char* path, int type,
                           void (*handler)(h2o_req_t*, h2ow_run_context*));
 
 int h2ow_register_handler6(h2ow_context* wctx, int methods, const char* path, int type,
                            void (*handler)(h2o_req_t*, h2ow_run_context*), int call_type);
 
-// try to find a matching handler, given a path and method
-// return either a pointer to the handler or NULL on failure
+// register a handler that also gets what the placeholders in its path matched
+// (see captures.c), as an array that is allocated from the request's memory pool
+int h2ow_register_capture_handler(h2ow_context* wctx, int methods, const char* path,
+                                  int type,
+                                  void (*handler)(h2o_req_t*, h2ow_run_context*,
+                                                  h2o_iovec_t*, int));
+
+// whether any handler is H2OW_HANDLER_STREAMING, so that h2o should stream bodies
+int h2ow__has_streaming_handlers(const h2ow_handler_lists* hl);
+
+// use handler lists generated by tools/h2ow-routegen.c instead of registering
+// handlers one by one. this only works if no handlers were registered before, and
+// no more can be registered afterwards. returns 1 on success and 0 on error, just
+// like the functions above
+int h2ow_use_static_routes(h2ow_context* wctx, const h2ow_static_routes* routes);
+
+// try to find a matching handler, given a path (which doesn't need to be
+// null-terminated) and method
+// return either a pointer to the handler or NULL on failure. everything else we
+// found out is stored in match (see h2ow_route_match); captures are allocated from pool
 h2ow_request_handler* h2ow__find_matching_handler(h2ow_handler_lists* hl,
-                                                  const char* path, int method);
+                                                  const char* path, size_t path_len,
+                                                  int method, h2o_mem_pool_t* pool,
+                                                  h2ow_route_match* match);
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef _H2OW_LISTENER_H_INCLUDED
+#define _H2OW_LISTENER_H_INCLUDED
+
+#include "defs.h"
+
+// fill wctx->listen_addrs from the settings (see listener.c); needs wctx->ssl_ctx to
+// be set up already. returns 0 on success or -1 on error
+int h2ow__init_listen_addrs(h2ow_context* wctx);
+void h2ow__free_listen_addrs(h2ow_context* wctx);
+
+// get a bound and listening socket for addr, either inherited or a new one (using
+// SO_REUSEPORT if reuseport is set). returns the fd, or -1 on error
+int h2ow__open_listen_socket(h2ow_run_context* rctx, const h2ow_listen_addr* addr,
+                             int reuseport);
+
+// allocate and set up the listeners of rctx (or the acceptor with
+// H2OW_ACCEPT_SHARED). returns 0 on success or -1 on error, after cleaning up
+int h2ow__create_listeners(h2ow_run_context* rctx);
+
+// undo h2ow__create_listeners (except for freeing rctx->listeners), calling cb for
+// every handle closed. returns the number of handles closed
+int h2ow__close_listeners(h2ow_run_context* rctx, uv_close_cb cb);
+
+// set TCP_DEFER_ACCEPT and TCP_FASTOPEN on a listening socket according to the
+// settings; failing to do so only produces a warning
+void h2ow__tune_listener(const h2ow_settings* settings, int fd,
+                         const h2ow_listen_addr* addr);
+
+// remember that accepting a connection failed with the (negative) libuv error err
+void h2ow__count_accept_error(h2ow_run_context* rctx, int err);
+
+// get the number of failed accepts of each thread (per_thread needs space for one
+// entry per thread, or can be NULL), and return their sum. like the other stats
+// functions, this is only approximate while the server is running
+uint64_t h2ow_get_accept_errors(h2ow_context* wctx, uint64_t* per_thread);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _H2OW_MULTIPART_H_INCLUDED
+#define _H2OW_MULTIPART_H_INCLUDED
+
+#include "defs.h"
+
+// start parsing a body with the given Content-Type, which has to be multipart/* with
+// a boundary. cbs and data are stored in mp. returns 0 on success or -1 if the
+// content type isn't usable
+int h2ow_multipart_init(h2ow_multipart* mp, h2o_iovec_t content_type,
+                        const h2ow_multipart_callbacks* cbs, void* data);
+
+// parse the next chunk of the body, calling the callbacks for everything it
+// completes. slices passed to them point into chunk wherever possible. returns 0 on
+// success or -1 if the body is malformed or writing to a file descriptor failed;
+// after that, feeding more fails too
+int h2ow_multipart_feed(h2ow_multipart* mp, h2o_iovec_t chunk);
+
+// check that the body ended properly after the last chunk. returns 0 if it did or
+// -1 if it was cut off
+int h2ow_multipart_finish(h2ow_multipart* mp);
+
+// write the body of the current part to fd instead of passing it to on_data; only
+// useful from on_part. fd isn't closed by us
+void h2ow_multipart_set_fd(h2ow_multipart* mp, int fd);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _H2OW_PHASH_H_INCLUDED
+#define _H2OW_PHASH_H_INCLUDED
+
+#include "defs.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// general purpose 64 bit hash, reading 8 bytes at a time
+static inline uint64_t h2ow__hash(uint64_t seed, const char* s, size_t len) {
+	uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+	uint64_t k;
+
+	while (len >= 8) {
+		memcpy(&k, s, 8);
+		k *= 0x87c37b91114253d5ULL;
+		k = (k << 31) | (k >> 33);
+		h = (h ^ (k * 0x4cf5ad432745937fULL)) * 0x9e3779b97f4a7c15ULL;
+		s += 8, len -= 8;
+	}
+
+	k = 0;
+	memcpy(&k, s, len);
+	h ^= k * 0x87c37b91114253d5ULL;
+
+	// murmur3's finalizer, so all bits of the result depend on all input bits
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+// build a collision-free hash function for the given (distinct) keys.
+// returns 0 on success or -1 if we ran out of memory or couldn't find one
+int h2ow__phash_build(h2ow_phash* ph, const h2o_iovec_t* keys, int num_keys);
+void h2ow__phash_free(h2ow_phash* ph);
+
+// returns the index of the only key that s could be, or -1 if it can't be any
+// of them. the caller still has to compare s with that key
+static inline int h2ow__phash_lookup(const h2ow_phash* ph, const char* s, size_t len) {
+	if (ph->slots == NULL)
+		return -1;
+
+	uint64_t h = h2ow__hash(ph->seed, s, len);
+	uint32_t f1 = (uint32_t)h, f2 = (uint32_t)(h >> 32);
+	uint32_t bucket = ((uint64_t)f2 * ph->num_buckets) >> 32;
+	const h2ow_phash_displacement* d = &ph->displacements[bucket];
+
+	return ph->slots[(f1 + d->d0 * f2 + d->d1) & ph->mask];
+}
+
+#endif
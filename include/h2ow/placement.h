@@ -0,0 +1,15 @@
+#ifndef _H2OW_PLACEMENT_H_INCLUDED
+#define _H2OW_PLACEMENT_H_INCLUDED
+
+#include "defs.h"
+
+// the cpu that thread idx should be pinned to according to H2OW_CPU_AFFINITY,
+// or -1 if it shouldn't be pinned
+int h2ow__thread_cpu(const h2ow_settings* settings, int idx);
+
+// allocate a zeroed run context for a thread that is pinned to cpu (or -1), placing
+// it on the numa node of that cpu where possible. returns NULL on error
+h2ow_run_context* h2ow__alloc_run_context(int cpu);
+void h2ow__free_run_context(h2ow_run_context* rctx);
+
+#endif
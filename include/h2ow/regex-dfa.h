@@ -0,0 +1,21 @@
+#ifndef _H2OW_REGEX_DFA_H_INCLUDED
+#define _H2OW_REGEX_DFA_H_INCLUDED
+
+#include "defs.h"
+
+#include <stdint.h>
+
+// compile the paths of the given REGEX_PATH handlers into a single DFA. patterns
+// that the DFA can't handle are marked in dfa->fallback and have to be checked
+// with regexec. returns 0 on success or -1 if we ran out of memory
+int h2ow__build_regex_dfa(h2ow_regex_dfa* dfa, const h2ow_request_handler* handlers,
+                          int num_handlers);
+void h2ow__free_regex_dfa(h2ow_regex_dfa* dfa);
+
+// run the DFA over path in one pass, setting the bit of every pattern (that isn't
+// a fallback pattern) that regexec would find a match for. matched needs to have
+// room for dfa->num_words words
+void h2ow__regex_dfa_match(const h2ow_regex_dfa* dfa, const char* path, size_t path_len,
+                           uint64_t* matched);
+
+#endif
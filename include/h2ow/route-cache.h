@@ -0,0 +1,26 @@
+#ifndef _H2OW_ROUTE_CACHE_H_INCLUDED
+#define _H2OW_ROUTE_CACHE_H_INCLUDED
+
+#include "defs.h"
+
+// make room for size entries in the cache (rounded up to a power of 2); a size
+// of 0 disables the cache. returns 0 on success or -1 if we ran out of memory
+int h2ow__init_route_cache(h2ow_route_cache* cache, int size);
+void h2ow__free_route_cache(h2ow_route_cache* cache);
+
+// same as h2ow__find_matching_handler, but tries the cache first and adds the
+// result to it otherwise
+h2ow_request_handler* h2ow__cached_find_matching_handler(h2ow_route_cache* cache,
+                                                         h2ow_handler_lists* hl,
+                                                         const char* path,
+                                                         size_t path_len, int method,
+                                                         h2o_mem_pool_t* pool,
+                                                         h2ow_route_match* match);
+
+// add up the hits and misses of the caches of all threads. while the server is
+// running, this is only approximate, since the threads keep counting; after h2ow_run
+// returned, it gets the counts from the end of the run. like the other stats
+// functions, it can be called from any thread
+void h2ow_get_route_cache_stats(h2ow_context* wctx, uint64_t* hits, uint64_t* misses);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _H2OW_ROUTER_H_INCLUDED
+#define _H2OW_ROUTER_H_INCLUDED
+
+#include "defs.h"
+
+// build the hash table over the FIXED_PATH handlers, the DFA for the REGEX_PATH
+// handlers and the radix trees over the PARAM_PATH and WILDCARD_PATH handlers of hl.
+// returns 0 on success or -1 on error
+int h2ow__build_router(h2ow_handler_lists* hl);
+void h2ow__free_router(h2ow_handler_lists* hl);
+
+// same as h2ow__find_matching_handler, but using the structures built by
+// h2ow__build_router. path doesn't need to be null-terminated
+h2ow_request_handler* h2ow__router_find(const h2ow_handler_lists* hl, const char* path,
+                                        size_t path_len, int method, h2o_mem_pool_t* pool,
+                                        h2ow_route_match* match);
+
+#endif
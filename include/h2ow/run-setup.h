@@ -8,4 +8,9 @@
 // h2ow_set_defaults, h2ow_setopt and h2ow_register_handler
 int h2ow_run(h2ow_context* wctx);
 
+// get the counters of up to max threads, either from the running threads or from
+// when the last h2ow_run returned. returns the number of threads we got, which is 0
+// if h2ow_run never ran
+int h2ow__get_thread_stats(h2ow_context* wctx, h2ow_thread_stats* stats, int max);
+
 #endif
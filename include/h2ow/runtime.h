@@ -36,6 +36,15 @@ void h2ow__cleanup_free_cb(uv_handle_t* self);
 void h2ow__on_signal(uv_signal_t* self, int signum);
 void h2ow__on_close(uv_handle_t* conn);
 void h2ow__on_accept(uv_stream_t* listener, int status);
+// for connections that we close without ever handing them to h2o
+void h2ow__on_unused_close(uv_handle_t* conn);
+
+// count a connection that no thread can take, and send it a 503 if H2OW_OVERLOAD_503
+// is set and it isn't a tls one. the caller closes fd afterwards
+void h2ow__shed_socket(h2ow_run_context* rctx, int fd, int ssl);
+
+// hand an accepted connection to h2o, using the https accept context if ssl is set
+void h2ow__add_connection(h2ow_run_context* rctx, uv_tcp_and_data* conn, int ssl);
 
 // loop that runs a fully initialized h2ow_run_context, which is passed as arg.
 // the function prototype is like this to match a pthread start routine
@@ -6,17 +6,76 @@
 enum h2ow_settings {
 	H2OW_DEFAULT_HOST,
 	H2OW_THREAD_COUNT,
-	// not implemented
+	// max ms to wait for open connections to close after SIGINT or SIGTERM
 	H2OW_SHUTDOWN_TIMEOUT,
 	// partly implemented
 	H2OW_DEBUG_LEVEL,
 	// not implemented
 	H2OW_LOG_FORMAT,
+	// listen on another address too; takes the address, a port and whether to use
+	// ssl. the address is an ipv4 or ipv6 address, or "unix:" followed by the path
+	// of a unix socket (whose port is ignored). ipv6 listeners only accept ipv6
+	// connections, so add "0.0.0.0" and "::" for dual-stack
 	H2OW_ADD_HOST,
 	// almost implemented
 	H2OW_SSL_CERT_AND_KEY,
 	H2OW_SSL_PORT,
-	H2OW_SSL_CTX
+	H2OW_SSL_CTX,
+	// number of lookup results each thread caches (0 disables the cache)
+	H2OW_ROUTE_CACHE_SIZE,
+	// number of connection objects each thread preallocates, and how many more
+	// each thread keeps around for reuse when they are closed
+	H2OW_CONN_POOL,
+	// max number of connections per thread and for the whole server (0 means no
+	// limit). threads at a limit stop accepting until they are below
+	// H2OW_RESUME_PERCENT of it, unless H2OW_OVERLOAD_503 is set
+	H2OW_MAX_CONNECTIONS,
+	H2OW_RESUME_PERCENT,
+	H2OW_OVERLOAD_503,
+	// pin loop threads to cpus, and allocate their data on the numa node of their cpu.
+	// takes an array of cpus and its length; thread i is pinned to cpus[i % length].
+	// if the array is NULL, threads are spread over all cpus the process may use
+	H2OW_CPU_AFFINITY,
+	// let the kernel hand each connection to the thread pinned to the cpu that
+	// received it (see steering.c); only useful with H2OW_CPU_AFFINITY
+	H2OW_REUSEPORT_STEERING,
+	// how connections get to threads; one of h2ow_accept_models
+	H2OW_ACCEPT_MODEL,
+	// signal that makes the server exec a new instance of its binary, hand it the
+	// listening sockets and shut down once it's listening on them (see upgrade.c);
+	// 0 disables upgrades
+	H2OW_UPGRADE_SIGNAL,
+	// backlog passed to listen() (128 by default)
+	H2OW_LISTEN_BACKLOG,
+	// seconds a connection may wait for its first data before the kernel hands it
+	// to us anyway; 0 disables TCP_DEFER_ACCEPT
+	H2OW_TCP_DEFER_ACCEPT,
+	// max number of pending TCP fast open requests; 0 disables TCP_FASTOPEN
+	H2OW_TCP_FASTOPEN,
+	// manage session ticket keys ourselves (see tls.c); takes the path of a file with
+	// 80 byte keys (or NULL to generate them) and the number of seconds after which
+	// the file is read again or a new key is generated (0 to never rotate them)
+	H2OW_SSL_TICKET_KEYS,
+	// number of sessions to cache for resumption (see tls.c); 0 leaves it to openssl
+	H2OW_SSL_SESSION_CACHE,
+	// keep the private key from H2OW_SSL_CERT_AND_KEY in a separate process, which
+	// does all operations that need it (see tls.c). this isolates the key, but key
+	// operations still block the loop, and take a bit longer than without it
+	H2OW_SSL_KEY_PRIVSEP,
+	// signal that makes the server load H2OW_SSL_CERT_AND_KEY again, like
+	// h2ow_reload_ssl (see tls.c); 0 disables it
+	H2OW_SSL_RELOAD_SIGNAL,
+	// max number of bytes of a streamed request body to buffer while its handler
+	// doesn't take any (64 KiB by default); 0 stops reading right away
+	H2OW_BODY_WINDOW
+};
+
+enum h2ow_accept_models {
+	// every thread has its own listening socket, and the kernel picks one
+	H2OW_ACCEPT_REUSEPORT,
+	// the first thread accepts all connections and hands them to the thread with the
+	// fewest connections (see acceptor.c)
+	H2OW_ACCEPT_SHARED
 };
 
 enum h2ow_debug_levels {
@@ -0,0 +1,21 @@
+#ifndef _H2OW_STEERING_H_INCLUDED
+#define _H2OW_STEERING_H_INCLUDED
+
+#include "defs.h"
+
+// attach the program that steers connections to the listener of the thread pinned
+// to the cpu that received them to fd, which is a listener of the first thread.
+// returns 0 on success or -1 on error
+int h2ow__attach_steering_prog(h2ow_context* wctx, int fd);
+
+// count whether a connection accepted by rctx was received by its cpu
+void h2ow__check_steering(h2ow_run_context* rctx, uv_tcp_t* conn);
+
+// add up how many connections all threads checked, and how many of them were
+// received on another cpu than the one of the thread that accepted them. the number
+// of misrouted connections of each thread is stored in per_thread, which needs space
+// for one entry per thread (or can be NULL)
+void h2ow_get_steering_stats(h2ow_context* wctx, uint64_t* checked, uint64_t* misrouted,
+                             uint64_t* per_thread);
+
+#endif
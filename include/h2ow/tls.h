@@ -0,0 +1,46 @@
+#ifndef _H2OW_TLS_H_INCLUDED
+#define _H2OW_TLS_H_INCLUDED
+
+#include "defs.h"
+
+// set up ticket keys, the session cache and the stats for wctx->ssl_ctx (if any),
+// according to the settings. returns 0 on success or -1 on error; either way,
+// h2ow__free_tls cleans up afterwards
+int h2ow__init_tls(h2ow_context* wctx);
+void h2ow__free_tls(h2ow_context* wctx);
+
+// create an ssl context from settings->ssl_cert_path and settings->ssl_key_path,
+// using the key helper and kernel tls if they are enabled. returns NULL on error
+SSL_CTX* h2ow__create_ssl_ctx(h2ow_context* wctx);
+
+// switch accept_ctxs[1] of rctx to the context from the last reload, if there is
+// one. must be called on the loop of rctx
+void h2ow__switch_ssl_ctx(h2ow_run_context* rctx);
+
+// drop the references the run contexts hold to ssl contexts, after all threads
+// stopped. reloads that finish afterwards don't do anything
+void h2ow__release_ssl_ctxs(h2ow_context* wctx);
+
+// reload the ssl context on settings->ssl_reload_signal on the loop of rctx.
+// returns 0 on success or -1 on error
+int h2ow__create_reload_handler(h2ow_run_context* rctx);
+
+// wait for the thread the reload handler of rctx started, if there is one. must
+// be called on the loop of rctx, or after it stopped
+void h2ow__join_reload_thread(h2ow_run_context* rctx);
+
+// start rotating the ticket keys every settings->ticket_rotation_secs on the loop of
+// rctx. returns 0 on success or -1 on error
+int h2ow__create_ticket_timer(h2ow_run_context* rctx);
+
+// get the number of tls handshakes all threads completed, and how many of them
+// resumed a session. this keeps counting across runs with the same context
+void h2ow_get_tls_stats(h2ow_context* wctx, uint64_t* handshakes, uint64_t* resumed);
+
+// create a new ssl context from the cert and key files and let all threads switch
+// to it, while connections that already exist keep the old one. it only works
+// while h2ow_run is running, and with H2OW_SSL_CERT_AND_KEY instead of H2OW_SSL_CTX.
+// can be called from any thread; returns 0 on success or -1 on error
+int h2ow_reload_ssl(h2ow_context* wctx);
+
+#endif
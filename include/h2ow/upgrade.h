@@ -0,0 +1,36 @@
+#ifndef _H2OW_UPGRADE_H_INCLUDED
+#define _H2OW_UPGRADE_H_INCLUDED
+
+#include "defs.h"
+
+// name of the environment variable listing the listening sockets that a process
+// inherited from the one it replaces, as a comma-separated list of fds
+#define H2OW_LISTEN_FDS_ENV "H2OW_LISTEN_FDS"
+// name of the environment variable with the fd that a new process writes a byte to
+// once it's listening on the sockets it inherited
+#define H2OW_READY_FD_ENV "H2OW_READY_FD"
+
+// read the listening sockets passed in H2OW_LISTEN_FDS_ENV and the pipe passed in
+// H2OW_READY_FD_ENV, if any. returns 0 on success or -1 if we ran out of memory
+int h2ow__read_inherited_fds(h2ow_context* wctx);
+
+// take an inherited listening socket bound to addr, or return -1 if there's none
+int h2ow__adopt_listener(h2ow_context* wctx, const h2ow_listen_addr* addr);
+
+// close the inherited sockets that weren't adopted, and forget about all of them.
+// also closes the pipe to the process we replace if we didn't say we're ready, which
+// tells it that we failed
+void h2ow__close_inherited_fds(h2ow_context* wctx);
+
+// tell the process we replace that we're listening, so it can shut down
+void h2ow__signal_ready(h2ow_context* wctx);
+
+// start listening for settings->upgrade_signal on the first thread, and remember
+// the path of our binary for it. returns 0 on success or -1 on error
+int h2ow__create_upgrade_handler(h2ow_run_context* rctx);
+
+// close the upgrade signal handler of rctx, and stop waiting for an upgrade that is
+// in progress (the new process then keeps running next to us)
+void h2ow__close_upgrade_handler(h2ow_run_context* rctx);
+
+#endif
@@ -4,38 +4,80 @@
 #include <h2o.h>
 #include "defs.h"
 
-#include "uthash.h"
+// index for finding the fields of a parsed form by their keys (see utils.c)
+typedef struct h2ow_post_index_s {
+	uint8_t* ctrl;
+	int32_t* slots;
+	size_t group_mask;
+} h2ow_post_index;
 
 // null-terminated post x-www-form-urlencoded parsing
 typedef struct h2ow_post_field_s {
 	char* key;
 	char* val;
-	UT_hash_handle hh;
 } h2ow_post_field;
 
 typedef struct h2ow_post_data_s {
+	// all fields, in the order they appeared in
 	h2ow_post_field* fields;
+	int num_fields;
+	h2ow_post_index index;
 } h2ow_post_data;
 
 int h2ow_post_parse(h2o_req_t* req, h2ow_post_data* data);
+// returns NULL if there is no field with key, and the last one if there are several
 h2ow_post_field* h2ow_post_get(h2ow_post_data* data, const char* key);
 
-// vector (pointer + len) based post x-www-form-urlencoded parsing
-// (multipart/form-data parsing might be added later)
+// vector (pointer + len) based post x-www-form-urlencoded and multipart/form-data
+// parsing. for the latter, the keys are the names of the parts, and the values are
+// their bodies (see multipart.h for streaming uploads instead)
 typedef struct h2ow_post_vec_s {
 	h2o_iovec_t key;
 	h2o_iovec_t val;
-	UT_hash_handle hh;
 } h2ow_post_vec;
 
 typedef struct h2ow_post_vecs_s {
+	// all fields, in the order they appeared in
 	h2ow_post_vec* fields;
+	int num_fields;
+	h2ow_post_index index;
 } h2ow_post_vecs;
 
 int h2ow_post_parse_vecs(h2o_req_t* req, h2ow_post_vecs* data);
 h2ow_post_vec* h2ow_post_get_vec(h2ow_post_vecs* data, const char* key,
                                  unsigned int key_len);
 
+// lazy lookup of single x-www-form-urlencoded fields, for handlers that only need a
+// few fields of a big form. instead of decoding and indexing the whole body, every
+// lookup scans the raw body for the key and decodes just the value it finds. the
+// body is left as it is, so don't mix this with h2ow_post_parse(_vecs) on one request
+#define H2OW_POST_LAZY_MEMO 8
+#define H2OW_POST_LAZY_MEMO_KEY 32
+
+// a remembered lookup; keys longer than H2OW_POST_LAZY_MEMO_KEY aren't remembered
+typedef struct h2ow_post_lazy_memo_s {
+	char key[H2OW_POST_LAZY_MEMO_KEY];
+	unsigned int key_len;
+	int found;
+	h2o_iovec_t val;
+} h2ow_post_lazy_memo;
+
+typedef struct h2ow_post_lazy_s {
+	h2o_req_t* req;
+	h2o_iovec_t body;
+	h2ow_post_lazy_memo memo[H2OW_POST_LAZY_MEMO];
+	int num_memo;
+	// entry that gets replaced next once the memo is full
+	int next_memo;
+} h2ow_post_lazy;
+
+void h2ow_post_lazy_init(h2o_req_t* req, h2ow_post_lazy* lazy);
+// returns 1 and sets val to the decoded value if there is a field with key (the
+// last one if there are several), 0 if there is none, and -1 if its value isn't
+// encoded correctly. val points either into the body or into the request's pool
+int h2ow_post_lazy_get(h2ow_post_lazy* lazy, const char* key, unsigned int key_len,
+                       h2o_iovec_t* val);
+
 #define h2ow_req_is_ssl(x) ((x)->scheme == &H2O_URL_SCHEME_HTTPS)
 #define h2ow_req_pool_alloc(req, n) h2o_mem_alloc_shared(&(req)->pool, n, NULL)
 
@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+
+#include "h2ow/acceptor.h"
+#include "h2ow/conn-pool.h"
+#include "h2ow/listener.h"
+#include "h2ow/runtime.h"
+#include "h2ow/settings.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+/* with H2OW_ACCEPT_SHARED, there's only one listening socket per port instead of
+ * one per thread. the first thread polls it and accepts connections itself, then
+ * hands each one to the thread with the fewest connections (counting the ones that
+ * are still queued for it). that keeps long-lived connections (like http2 ones)
+ * from piling up on a few threads, which SO_REUSEPORT can't do since it doesn't
+ * know how many connections each thread has.
+ *
+ * every thread has a single-producer single-consumer ring of accepted sockets.
+ * the acceptor writes entries and moves the tail, the thread itself reads them and
+ * moves the head, and a uv_async tells it when there's something new.
+ *
+ * on shutdown, threads close their async while the acceptor is still running, so
+ * each queue has a flag that says whether its thread still takes connections. the
+ * acceptor only adds to a queue while holding its lock with the flag set, and skips
+ * threads without it, so nothing ends up in a queue that nobody reads anymore.
+ *
+ * connection limits work like in the other mode: threads at their limit aren't
+ * picked, and if no thread can take a connection, the acceptor stops polling
+ * until a thread closes one (or sends a 503 with H2OW_OVERLOAD_503).
+ */
+
+static inline int is_acceptor(const h2ow_run_context* rctx) {
+	return rctx == rctx->wctx->run_contexts[0];
+}
+
+static inline unsigned int load_index(unsigned int* idx) {
+	return __sync_fetch_and_add(idx, 0);
+}
+
+static inline int queue_len(h2ow_accept_queue* queue) {
+	return load_index(&queue->tail) - load_index(&queue->head);
+}
+
+// called by the owner of the queue when the acceptor signals it
+static void on_queue_async(uv_async_t* async) {
+	h2ow_run_context* rctx = async->data;
+	h2ow_accept_queue* queue = &rctx->accept_queue;
+	unsigned int head = queue->head;
+	unsigned int tail = load_index(&queue->tail);
+
+	for (; head != tail; head++) {
+		h2ow_accepted_socket* entry = &queue->entries[head % H2OW_ACCEPT_QUEUE_SIZE];
+		uv_tcp_and_data* conn = h2ow__conn_pool_get(&rctx->conn_pool);
+
+		if (unlikely(conn == NULL)) {
+			close(entry->fd);
+			continue;
+		}
+
+		uv_tcp_init(&rctx->loop, (uv_tcp_t*)conn);
+		conn->more_data = rctx;
+
+		if (unlikely(uv_tcp_open((uv_tcp_t*)conn, entry->fd) != 0)) {
+			close(entry->fd);
+			uv_close((uv_handle_t*)conn, h2ow__on_unused_close);
+			continue;
+		}
+
+		h2ow__add_connection(rctx, conn, entry->ssl);
+	}
+
+	// make sure we're done with the entries before the acceptor reuses them
+	__sync_synchronize();
+	queue->head = head;
+
+	// the acceptor's own queue is also used to wake it up
+	if (is_acceptor(rctx))
+		h2ow__wake_acceptor(rctx);
+}
+
+// the thread that should get the next connection, or NULL if all are at their limit
+static h2ow_run_context* pick_thread(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+	h2ow_run_context* best = NULL;
+	int best_load = 0, total = 0;
+
+	for (int i = 0; i < settings->thread_count; i++) {
+		h2ow_run_context* rctx = wctx->run_contexts[i];
+		int queued = queue_len(&rctx->accept_queue);
+		// only the thread itself changes this, so it's approximate
+		int load = *(volatile int*)&rctx->num_connections + queued;
+
+		total += queued;
+
+		// threads that are draining have few connections, but don't want more
+		if (!*(volatile int*)&rctx->accept_queue.accepting
+		    || queued == H2OW_ACCEPT_QUEUE_SIZE
+		    || (settings->max_connections_per_thread > 0
+		        && load >= settings->max_connections_per_thread))
+		{
+			continue;
+		}
+
+		if (best == NULL || load < best_load) {
+			best = rctx;
+			best_load = load;
+		}
+	}
+
+	total += __sync_fetch_and_add(&wctx->num_connections, 0);
+	if (settings->max_connections > 0 && total >= settings->max_connections)
+		return NULL;
+
+	return best;
+}
+
+// add a socket to the queue of target and wake it up. returns -1 if target stopped
+// taking connections since we picked it
+static int push_socket(h2ow_run_context* target, int fd, int ssl) {
+	h2ow_accept_queue* queue = &target->accept_queue;
+
+	pthread_mutex_lock(&queue->lock);
+	if (unlikely(!queue->accepting)) {
+		pthread_mutex_unlock(&queue->lock);
+		return -1;
+	}
+
+	unsigned int tail = queue->tail;
+	queue->entries[tail % H2OW_ACCEPT_QUEUE_SIZE].fd = fd;
+	queue->entries[tail % H2OW_ACCEPT_QUEUE_SIZE].ssl = ssl;
+
+	// publish the entry before the new tail
+	__sync_synchronize();
+	queue->tail = tail + 1;
+
+	uv_async_send(&queue->async);
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
+
+static void pause_acceptor(h2ow_run_context* rctx) {
+	rctx->acceptor_paused = 1;
+
+	for (int i = 0; i < rctx->num_listeners; i++) {
+		uv_poll_stop(&rctx->listeners[i].poll);
+	}
+}
+
+static void on_listener_readable(uv_poll_t* poll, int status, int events) {
+	h2ow_run_context* rctx = poll->data;
+	h2ow_context* wctx = rctx->wctx;
+	h2ow_listener* listener
+	        = (h2ow_listener*)((char*)poll - offsetof(h2ow_listener, poll));
+	int ssl = listener->addr->ssl;
+	(void)events;
+
+	if (unlikely(!wctx->is_running))
+		return;
+
+	if (unlikely(status != 0)) {
+		h2ow__count_accept_error(rctx, status);
+		return;
+	}
+
+	// don't starve the connections of this thread if lots of them come in
+	for (int i = 0; i < 64; i++) {
+		h2ow_run_context* target = pick_thread(wctx);
+
+		if (target == NULL && !wctx->settings.overload_503) {
+			pause_acceptor(rctx);
+			return;
+		}
+
+		int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			// the connection might've been reset before we got to it, which isn't
+			// worth counting either
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+				h2ow__count_accept_error(rctx, -errno);
+			return;
+		}
+
+		// pick_thread skips threads that stopped taking connections, so this ends
+		while (target != NULL && push_socket(target, fd, ssl) < 0) {
+			target = pick_thread(wctx);
+		}
+
+		if (target == NULL) {
+			h2ow__shed_socket(rctx, fd, ssl);
+			close(fd);
+		}
+	}
+}
+
+void h2ow__wake_acceptor(h2ow_run_context* rctx) {
+	h2ow_run_context* acceptor = rctx->wctx->run_contexts[0];
+
+	if (!*(volatile int*)&acceptor->acceptor_paused)
+		return;
+
+	// only the acceptor may touch its polls. its async is closed once it shuts down,
+	// which workers can't see without the lock
+	if (rctx != acceptor) {
+		h2ow_accept_queue* queue = &acceptor->accept_queue;
+
+		pthread_mutex_lock(&queue->lock);
+		if (queue->accepting)
+			uv_async_send(&queue->async);
+		pthread_mutex_unlock(&queue->lock);
+		return;
+	}
+
+	if (!rctx->wctx->is_running || pick_thread(rctx->wctx) == NULL)
+		return;
+
+	rctx->acceptor_paused = 0;
+	for (int i = 0; i < rctx->num_listeners; i++) {
+		uv_poll_start(&rctx->listeners[i].poll, UV_READABLE, on_listener_readable);
+	}
+}
+
+int h2ow__create_acceptor(h2ow_run_context* rctx) {
+	const h2ow_settings* settings = &rctx->wctx->settings;
+
+	rctx->accept_queue.head = rctx->accept_queue.tail = 0;
+	rctx->acceptor_paused = 0;
+	pthread_mutex_init(&rctx->accept_queue.lock, NULL);
+
+	if (uv_async_init(&rctx->loop, &rctx->accept_queue.async, on_queue_async) < 0) {
+		H2OW_ERR("Couldn't create async handle for the accept queue\n");
+		return -1;
+	}
+	rctx->accept_queue.async.data = rctx;
+	rctx->accept_queue.accepting = 1;
+
+	if (!is_acceptor(rctx))
+		return 0;
+
+	for (int i = 0; i < rctx->wctx->num_listen_addrs; i++) {
+		h2ow_listener* listener = &rctx->listeners[i];
+		const h2ow_listen_addr* addr = &rctx->wctx->listen_addrs[i];
+
+		int fd = h2ow__open_listen_socket(rctx, addr, 0);
+		if (fd < 0)
+			goto err;
+
+		if (uv_poll_init(&rctx->loop, &listener->poll, fd) < 0) {
+			H2OW_ERR("Couldn't create poll handle for the listening socket\n");
+			close(fd);
+			goto err;
+		}
+
+		listener->addr = addr;
+		listener->fd = fd;
+		listener->poll.data = rctx;
+		rctx->num_listeners++;
+
+		if (uv_poll_start(&listener->poll, UV_READABLE, on_listener_readable) < 0) {
+			H2OW_ERR("Couldn't poll the listening socket\n");
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	rctx->running_cleanup_cbs = h2ow__close_acceptor(rctx, h2ow__cleanup_cb);
+	uv_run(&rctx->loop, UV_RUN_DEFAULT);
+	return -1;
+}
+
+int h2ow__close_acceptor(h2ow_run_context* rctx, uv_close_cb cb) {
+	h2ow_accept_queue* queue = &rctx->accept_queue;
+	int num_closed = 1;
+
+	// after this, the acceptor doesn't touch the queue anymore
+	pthread_mutex_lock(&queue->lock);
+	queue->accepting = 0;
+	pthread_mutex_unlock(&queue->lock);
+
+	// nobody is going to open the sockets that are still queued
+	unsigned int tail = load_index(&queue->tail);
+	for (unsigned int head = queue->head; head != tail; head++) {
+		close(queue->entries[head % H2OW_ACCEPT_QUEUE_SIZE].fd);
+	}
+	queue->head = tail;
+
+	uv_close((uv_handle_t*)&queue->async, cb);
+
+	for (int i = 0; i < rctx->num_listeners; i++) {
+		// the fd isn't owned by the poll handle, but it's fine to close it once
+		// uv_close was called
+		uv_close((uv_handle_t*)&rctx->listeners[i].poll, cb);
+		close(rctx->listeners[i].fd);
+		num_closed++;
+	}
+
+	rctx->num_listeners = 0;
+
+	return num_closed;
+}
@@ -0,0 +1,251 @@
+#include "h2ow/body-stream.h"
+#include "h2ow/settings.h"
+#include "h2ow/utils.h"
+
+#include <string.h>
+
+#include <h2o.h>
+
+/* normally, h2o reads the whole request body into req->entity before calling our
+ * handler, so an upload lives in memory completely before a handler sees any of it.
+ * if any handler is H2OW_HANDLER_STREAMING, our h2o handler tells h2o that it
+ * supports streaming instead. h2o then calls it once the headers are there, with
+ * whatever part of the body it already has in req->entity, and sets req->proceed_req.
+ * the rest of the body is passed to req->write_req.cb, one chunk at a time, and h2o
+ * doesn't read more until we acknowledge a chunk by calling req->proceed_req. (if
+ * the whole body arrived with the headers, proceed_req is NULL and the body is
+ * complete in req->entity, just like without streaming.)
+ *
+ * chunks are handed to the handler directly, and acknowledged once it returns. if
+ * the handler paused the stream in on_chunk (e.g. because it is waiting for a write
+ * of that chunk to finish), it may still be using the chunk, so we only acknowledge
+ * it once the handler resumes. chunks that arrive while the stream is paused are
+ * acknowledged while they're copied into a window of settings->body_window bytes,
+ * which is handed to the handler in one piece when it resumes. while the handler
+ * might still use the window (because it paused again while getting it), nothing
+ * new is copied into it. a chunk that can't be copied isn't acknowledged, so the
+ * client has to wait until the handler resumes. that way, an upload never takes up
+ * more memory than the window and the chunk h2o is holding on to.
+ *
+ * handlers that aren't streaming still get the whole body in req->entity, which
+ * h2ow__buffer_body collects for them.
+ */
+
+static void proceed(h2o_req_t* req, size_t written, int is_end) {
+	if (req->proceed_req != NULL)
+		req->proceed_req(req, written, is_end);
+}
+
+static void deliver(h2ow_body_stream* stream, h2o_iovec_t chunk, int is_end) {
+	// empty chunks are only interesting if they end the body
+	if (chunk.len == 0 && !is_end)
+		return;
+
+	stream->on_chunk(stream, chunk, is_end);
+}
+
+// hand a chunk h2o gave us to the handler, and acknowledge it unless the handler
+// paused, and might still use it
+static void deliver_and_proceed(h2ow_body_stream* stream, h2o_iovec_t chunk,
+                                int is_end) {
+	deliver(stream, chunk, is_end);
+
+	if (stream->paused) {
+		stream->held = chunk;
+		stream->held_end = is_end;
+		stream->held_delivered = 1;
+		return;
+	}
+
+	proceed(stream->req, chunk.len, is_end);
+}
+
+// copy chunk into the window if it fits. returns 1 if it did and 0 otherwise
+static int buffer_chunk(h2ow_body_stream* stream, h2o_iovec_t chunk, int is_end) {
+	size_t window = stream->rctx->wctx->settings.body_window;
+
+	if (stream->window_in_use || stream->buffered + chunk.len > window)
+		return 0;
+
+	// allocating from the pool is fine, since this happens at most once per request
+	if (stream->window == NULL && chunk.len > 0) {
+		stream->window = h2ow_req_pool_alloc(stream->req, window);
+	}
+
+	if (chunk.len > 0) {
+		memcpy(stream->window + stream->buffered, chunk.base, chunk.len);
+	}
+	stream->buffered += chunk.len;
+	stream->buffered_end = is_end;
+
+	return 1;
+}
+
+static int on_write_req(void* ctx, h2o_iovec_t chunk, int is_end) {
+	h2ow_body_stream* stream = ctx;
+
+	if (!stream->paused && stream->buffered == 0) {
+		deliver_and_proceed(stream, chunk, is_end);
+	}
+	else if (buffer_chunk(stream, chunk, is_end)) {
+		proceed(stream->req, chunk.len, is_end);
+	}
+	else {
+		// backpressure; h2o doesn't send more until we acknowledge this one
+		stream->held = chunk;
+		stream->held_end = is_end;
+		stream->held_delivered = 0;
+	}
+
+	return 0;
+}
+
+h2ow_body_stream* h2ow_stream_body(h2o_req_t* req, h2ow_run_context* rctx,
+                                   h2ow_body_cb on_chunk, void* data) {
+	h2ow_body_stream* stream = h2ow_req_pool_alloc(req, sizeof(*stream));
+	if (stream == NULL)
+		return NULL;
+
+	memset(stream, 0, sizeof(*stream));
+	stream->req = req;
+	stream->rctx = rctx;
+	stream->data = data;
+	stream->on_chunk = on_chunk;
+
+	h2o_iovec_t first = req->entity.base != NULL ? req->entity : h2o_iovec_init("", 0);
+
+	// the whole body is already there
+	if (req->proceed_req == NULL) {
+		deliver(stream, first, 1);
+		return stream;
+	}
+
+	req->write_req.cb = on_write_req;
+	req->write_req.ctx = stream;
+
+	// the part that arrived with the headers is the first chunk
+	on_write_req(stream, first, 0);
+
+	return stream;
+}
+
+void h2ow_body_pause(h2ow_body_stream* stream) {
+	stream->paused = 1;
+}
+
+void h2ow_body_resume(h2ow_body_stream* stream) {
+	// a chunk handed out while resuming might pause the stream again
+	stream->paused = 0;
+	// the handler is done with everything it got before
+	stream->window_in_use = 0;
+
+	h2o_iovec_t held = stream->held;
+	int held_end = stream->held_end;
+
+	// the handler paused while it had this chunk, so h2o couldn't send anything after
+	// it, and there's nothing in the window
+	if (held.base != NULL && stream->held_delivered) {
+		stream->held = h2o_iovec_init(NULL, 0);
+		stream->held_end = 0;
+		stream->held_delivered = 0;
+		proceed(stream->req, held.len, held_end);
+		return;
+	}
+
+	if (stream->buffered > 0 || stream->buffered_end) {
+		size_t len = stream->buffered;
+		int is_end = stream->buffered_end;
+
+		stream->buffered = 0;
+		stream->buffered_end = 0;
+		deliver(stream, h2o_iovec_init(stream->window, len), is_end);
+
+		// it paused again, and might still be using the window
+		if (stream->paused)
+			stream->window_in_use = 1;
+
+		// or it resumed in on_chunk, which took care of the held chunk already
+		held = stream->held;
+		held_end = stream->held_end;
+	}
+
+	if (held.base == NULL)
+		return;
+
+	// if the handler paused again, the held chunk might fit into the window now
+	if (stream->paused) {
+		if (!buffer_chunk(stream, held, held_end))
+			return;
+
+		stream->held = h2o_iovec_init(NULL, 0);
+		stream->held_end = 0;
+		proceed(stream->req, held.len, held_end);
+		return;
+	}
+
+	stream->held = h2o_iovec_init(NULL, 0);
+	stream->held_end = 0;
+	deliver_and_proceed(stream, held, held_end);
+}
+
+/* ================ BUFFERED BODIES ================ */
+
+static void call_handler(h2ow_buffered_body* body) {
+	h2ow_request_handler* handler = body->handler;
+
+	if (handler->call_type == H2OW_HANDLER_CAPTURES) {
+		handler->capture_handler(body->req, body->rctx, body->captures,
+		                         body->num_captures);
+	}
+	else {
+		handler->handler(body->req, body->rctx);
+	}
+}
+
+static int on_buffered_write_req(void* ctx, h2o_iovec_t chunk, int is_end) {
+	h2ow_buffered_body* body = ctx;
+
+	if (chunk.len > 0) {
+		h2o_iovec_t space = h2o_buffer_reserve(&body->buf, chunk.len);
+		if (space.base == NULL)
+			return -1;
+
+		memcpy(space.base, chunk.base, chunk.len);
+		body->buf->size += chunk.len;
+	}
+
+	proceed(body->req, chunk.len, is_end);
+
+	if (is_end) {
+		body->req->entity = h2o_iovec_init(body->buf->bytes, body->buf->size);
+		call_handler(body);
+	}
+
+	return 0;
+}
+
+static void on_buffered_body_dispose(void* _body) {
+	h2ow_buffered_body* body = _body;
+	h2o_buffer_dispose(&body->buf);
+}
+
+int h2ow__buffer_body(h2o_req_t* req, h2ow_run_context* rctx,
+                      h2ow_request_handler* handler, h2ow_route_match* match) {
+	h2ow_buffered_body* body
+	        = h2o_mem_alloc_shared(&req->pool, sizeof(*body), on_buffered_body_dispose);
+	if (body == NULL)
+		return -1;
+
+	body->req = req;
+	body->rctx = rctx;
+	body->handler = handler;
+	body->captures = match->captures;
+	body->num_captures = match->num_captures;
+	h2o_buffer_init(&body->buf, &h2o_socket_buffer_prototype);
+
+	req->write_req.cb = on_buffered_write_req;
+	req->write_req.ctx = body;
+
+	h2o_iovec_t first = req->entity.base != NULL ? req->entity : h2o_iovec_init("", 0);
+	return on_buffered_write_req(body, first, 0);
+}
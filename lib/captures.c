@@ -0,0 +1,246 @@
+#include "h2ow/captures.h"
+
+#include <string.h>
+
+#include <fnmatch.h>
+
+/* captures are what a handler path with placeholders matched, in the order the
+ * placeholders appear in the path. they all point into the path that was matched,
+ * so nothing is copied:
+ *   - PARAM_PATH: every ":name" segment captures one non-empty path segment
+ *   - WILDCARD_PATH: every '*', '?' and bracket expression captures what it matched;
+ *     a '*' matches as little as possible, unless it's the last one in its segment
+ *   - REGEX_PATH: every parenthesized subexpression captures what regexec says it
+ *     matched; the DFA in regex-dfa.c can't tell us that, so this is done with one
+ *     more regexec for the handler that matched
+ */
+
+// "[...]" is a bracket expression only if it's closed; otherwise fnmatch treats the
+// '[' as a literal. returns a pointer past the closing ']', or NULL
+static const char* bracket_end(const char* p) {
+	p++; // skip the '['
+	if (*p == '!' || *p == '^')
+		p++;
+
+	// a ']' right at the start is a literal
+	if (*p == ']')
+		p++;
+
+	while (*p != ']') {
+		if (*p == '\0')
+			return NULL;
+
+		if (p[0] == '\\' && p[1] != '\0') {
+			p += 2;
+		}
+		else if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+			// classes, collating elements and equivalence classes can contain ']'
+			char delim[3] = { p[1], ']', '\0' };
+			const char* end = strstr(p + 2, delim);
+			if (end == NULL)
+				return NULL;
+			p = end + 2;
+		}
+		else {
+			p++;
+		}
+	}
+
+	return p + 1;
+}
+
+static int bracket_matches(const char* start, const char* end, char c) {
+	// let fnmatch handle the bracket expression itself, so classes, ranges etc.
+	// behave exactly the same as for handlers without captures
+	char bracket[end - start + 1];
+	char str[2] = { c, '\0' };
+
+	memcpy(bracket, start, end - start);
+	bracket[end - start] = '\0';
+
+	return fnmatch(bracket, str, FNM_PATHNAME) == 0;
+}
+
+int h2ow__is_capture_glob(const char* pattern) {
+	for (const char* p = pattern; *p != '\0'; p++) {
+		if (*p == '\\') {
+			// fnmatch doesn't let a '*' match up to an escaped '/', and never
+			// matches a trailing backslash
+			if (p[1] == '/' || p[1] == '\0')
+				return 0;
+			p++;
+		}
+		else if (*p == '[') {
+			// fnmatch treats unclosed brackets in several different ways
+			const char* end = bracket_end(p);
+			if (end == NULL)
+				return 0;
+			p = end - 1;
+		}
+	}
+
+	return 1;
+}
+
+int h2ow__count_captures(const char* path, int type, const regex_t* regex) {
+	int num = 0;
+
+	switch (type) {
+	case H2OW_PARAM_PATH:
+		for (const char* p = path; *p != '\0'; p++) {
+			if (h2ow__is_param(path, p))
+				num++;
+		}
+		break;
+
+	case H2OW_WILDCARD_PATH:
+		for (const char* p = path; *p != '\0'; p++) {
+			const char* end;
+
+			if (*p == '*' || *p == '?') {
+				num++;
+			}
+			else if (*p == '\\' && p[1] != '\0') {
+				p++;
+			}
+			else if (*p == '[' && (end = bracket_end(p)) != NULL) {
+				num++;
+				p = end - 1;
+			}
+		}
+		break;
+
+	case H2OW_REGEX_PATH:
+		num = regex->re_nsub;
+		break;
+	}
+
+	return num;
+}
+
+int h2ow__match_param_path(const char* pattern, const char* path, size_t path_len,
+                           h2o_iovec_t* captures) {
+	size_t pos = 0;
+	int num = 0;
+
+	for (const char* p = pattern; *p != '\0';) {
+		if (h2ow__is_param(pattern, p)) {
+			size_t len = 0;
+			while (pos + len < path_len && path[pos + len] != '/') {
+				len++;
+			}
+
+			if (len == 0)
+				return -1;
+
+			captures[num++] = h2o_iovec_init(path + pos, len);
+			pos += len;
+			p += strcspn(p, "/");
+		}
+		else {
+			if (pos == path_len || path[pos] != *p)
+				return -1;
+			pos++, p++;
+		}
+	}
+
+	return pos == path_len ? num : -1;
+}
+
+int h2ow__match_glob(const char* pattern, const char* path, size_t path_len,
+                     h2o_iovec_t* captures) {
+	// fnmatch stops at the first null byte, so we do too
+	const char* nul = memchr(path, '\0', path_len);
+	const char* s = path;
+	const char* end = nul != NULL ? nul : path + path_len;
+	const char* p = pattern;
+	int num = 0;
+
+	// where to go back to if something after the last '*' doesn't match; we then
+	// let that '*' match one more byte. since '*' can't match a '/', it's never
+	// worth going back further than the last one
+	const char* star_p = NULL;
+	const char* star_s = NULL;
+	int star_num = 0;
+
+	for (;;) {
+		if (*p == '*') {
+			captures[num++] = h2o_iovec_init(s, 0);
+			star_p = ++p;
+			star_s = s;
+			star_num = num;
+			continue;
+		}
+
+		if (*p == '\0' && s == end)
+			return num;
+
+		if (*p != '\0' && s != end) {
+			const char* next = p + 1;
+			int matches, is_capture = 0;
+
+			if (*p == '?') {
+				matches = *s != '/';
+				is_capture = 1;
+			}
+			else if (*p == '[' && (next = bracket_end(p)) != NULL) {
+				matches = bracket_matches(p, next, *s);
+				is_capture = 1;
+			}
+			else if (*p == '[') {
+				next = p + 1;
+				matches = *s == '[';
+			}
+			else if (*p == '\\') {
+				// fnmatch never matches patterns ending with a single backslash
+				next = p[1] != '\0' ? p + 2 : p + 1;
+				matches = p[1] != '\0' && *s == p[1];
+			}
+			else {
+				matches = *s == *p;
+			}
+
+			if (matches) {
+				if (is_capture)
+					captures[num++] = h2o_iovec_init(s, 1);
+				p = next;
+				s++;
+				continue;
+			}
+		}
+
+		// let the last '*' match one more byte, and try again from there
+		if (star_p == NULL || star_s == end || *star_s == '/')
+			return -1;
+
+		star_s++;
+		captures[star_num - 1].len++;
+		p = star_p;
+		s = star_s;
+		num = star_num;
+	}
+}
+
+int h2ow__match_regex(const regex_t* regex, const char* path, size_t path_len,
+                      h2o_iovec_t* captures) {
+	char null_terminated_path[path_len + 1];
+	regmatch_t matches[regex->re_nsub + 1];
+
+	memcpy(null_terminated_path, path, path_len);
+	null_terminated_path[path_len] = '\0';
+
+	if (regexec(regex, null_terminated_path, regex->re_nsub + 1, matches, 0) != 0)
+		return -1;
+
+	// the first match is the whole match, which handlers can't use for anything
+	for (size_t i = 0; i < regex->re_nsub; i++) {
+		const regmatch_t* m = &matches[i + 1];
+
+		if (m->rm_so < 0)
+			captures[i] = h2o_iovec_init(NULL, 0);
+		else
+			captures[i] = h2o_iovec_init(path + m->rm_so, m->rm_eo - m->rm_so);
+	}
+
+	return regex->re_nsub;
+}
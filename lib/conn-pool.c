@@ -0,0 +1,108 @@
+#include "h2ow/conn-pool.h"
+#include "h2ow/run-setup.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* every accepted connection needs a uv_tcp_and_data, which lives until libuv is done
+ * closing the connection. with lots of short-lived connections, getting those from
+ * malloc means taking malloc's locks twice per connection on every thread, so each
+ * thread keeps the ones that were closed in a free list and hands them out again.
+ *
+ * the first few objects can be preallocated in a single block (the slab); those
+ * always go back to the free list. objects that had to be malloc'd later are only
+ * kept while the free list is shorter than max_free, so a burst of connections
+ * doesn't keep its memory forever.
+ */
+
+static inline int is_from_slab(const h2ow_conn_pool* pool, const void* conn) {
+	const char* slab = pool->slab;
+	return pool->slab != NULL && (const char*)conn >= slab
+	       && (const char*)conn < slab + pool->slab_size;
+}
+
+static inline void push_free(h2ow_conn_pool* pool, void* conn) {
+	h2ow_free_conn* entry = conn;
+	entry->next = pool->free_list;
+	pool->free_list = entry;
+	pool->num_free++;
+}
+
+int h2ow__init_conn_pool(h2ow_conn_pool* pool, int prealloc, int max_free) {
+	memset(pool, 0, sizeof(*pool));
+	pool->max_free = max_free > 0 ? max_free : 0;
+
+	if (prealloc <= 0)
+		return 0;
+
+	pool->slab_size = (size_t)prealloc * sizeof(uv_tcp_and_data);
+	pool->slab = malloc(pool->slab_size);
+	if (pool->slab == NULL)
+		return -1;
+
+	// push them backwards, so they are handed out in order
+	uv_tcp_and_data* conns = pool->slab;
+	for (int i = prealloc - 1; i >= 0; i--) {
+		push_free(pool, &conns[i]);
+	}
+
+	return 0;
+}
+
+void h2ow__free_conn_pool(h2ow_conn_pool* pool) {
+	while (pool->free_list != NULL) {
+		h2ow_free_conn* entry = pool->free_list;
+		pool->free_list = entry->next;
+
+		if (!is_from_slab(pool, entry))
+			free(entry);
+	}
+
+	// h2o doesn't let us close everything before the loop stops, so connections might
+	// still be around; in that case, leaking the slab is better than a use after free
+	if (pool->in_use == 0)
+		free(pool->slab);
+
+	memset(pool, 0, sizeof(*pool));
+}
+
+uv_tcp_and_data* h2ow__conn_pool_get(h2ow_conn_pool* pool) {
+	uv_tcp_and_data* conn;
+
+	if (likely(pool->free_list != NULL)) {
+		conn = (uv_tcp_and_data*)pool->free_list;
+		pool->free_list = pool->free_list->next;
+		pool->num_free--;
+	}
+	else {
+		conn = malloc(sizeof(*conn));
+		if (unlikely(conn == NULL))
+			return NULL;
+	}
+
+	pool->in_use++;
+	return conn;
+}
+
+void h2ow__conn_pool_put(h2ow_conn_pool* pool, uv_tcp_and_data* conn) {
+	pool->in_use--;
+
+	if (is_from_slab(pool, conn) || pool->num_free < pool->max_free)
+		push_free(pool, conn);
+	else
+		free(conn);
+}
+
+void h2ow_get_conn_pool_stats(h2ow_context* wctx, int* in_use, int* num_free) {
+	int max = wctx->settings.thread_count > 0 ? wctx->settings.thread_count : 1;
+	h2ow_thread_stats stats[max];
+	int num = h2ow__get_thread_stats(wctx, stats, max);
+
+	*in_use = 0;
+	*num_free = 0;
+
+	for (int i = 0; i < num; i++) {
+		*in_use += stats[i].conns_in_use;
+		*num_free += stats[i].free_conns;
+	}
+}
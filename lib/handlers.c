@@ -1,4 +1,6 @@
 #include "h2ow/handlers.h"
+#include "h2ow/captures.h"
+#include "h2ow/router.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -23,18 +25,51 @@ void h2ow__free_handler_lists(h2ow_handler_lists* hl) {
 	}
 	free(hl->regexes);
 
-	// after that, free all handler lists normally
-	for (int i = 0; i < H2OW_NUM_PATH_TYPES; i++) {
-		free(hl->handlers_lists[i]);
+	// after that, free all handler lists normally, unless they were generated
+	if (hl->static_routes == NULL) {
+		for (int i = 0; i < H2OW_NUM_PATH_TYPES; i++) {
+			free(hl->handlers_lists[i]);
+		}
 	}
+
+	h2ow__thaw_handler_lists(hl);
 }
 
-int h2ow_register_handler6(h2ow_context* wctx, int methods, const char* path, int type,
-                           void (*handler)(h2o_req_t*, h2ow_run_context*),
-                           int call_type) {
+int h2ow__freeze_handler_lists(h2ow_handler_lists* hl) {
+	if (h2ow__build_router(hl) < 0)
+		return -1;
+
+	hl->is_frozen = 1;
+	return 0;
+}
+
+void h2ow__thaw_handler_lists(h2ow_handler_lists* hl) {
+	h2ow__free_router(hl);
+	hl->is_frozen = 0;
+}
+
+static int add_handler(h2ow_context* wctx, int methods, const char* path, int type,
+                       void (*handler)(h2o_req_t*, h2ow_run_context*),
+                       void (*capture_handler)(h2o_req_t*, h2ow_run_context*,
+                                               h2o_iovec_t*, int),
+                       int call_type) {
 	// first, make pointers to the things we actually want to change
 	h2ow_handler_lists* hl = &wctx->handlers;
 
+	if (type < 0 || type >= H2OW_NUM_PATH_TYPES)
+		return 0;
+
+	if (call_type == H2OW_HANDLER_CAPTURES && type == H2OW_WILDCARD_PATH
+	    && !h2ow__is_capture_glob(path))
+	{
+		return 0;
+	}
+
+	// the lists are shared between threads while the server is running, and
+	// generated lists can't grow
+	if (hl->is_frozen || hl->static_routes != NULL)
+		return 0;
+
 	int* num_handlers = &(hl->num_handlers[type]);
 	h2ow_request_handler** handlers = &(hl->handlers_lists[type]);
 
@@ -76,38 +111,139 @@ int h2ow_register_handler6(h2ow_context* wctx, int methods, const char* path, in
 	// fill in the info
 	h2ow_request_handler* new_handler = &(*handlers)[*num_handlers - 1];
 	new_handler->handler = handler;
+	new_handler->capture_handler = capture_handler;
 	new_handler->methods = methods;
 	new_handler->path = path; // maybe useful for debugging in case of REGEX_PATH
 	new_handler->call_type = call_type;
+	new_handler->num_captures = h2ow__count_captures(
+	        path, type, type == H2OW_REGEX_PATH ? &hl->regexes[*num_handlers - 1] : NULL);
 
 	return 1;
 }
 
+int h2ow_register_handler6(h2ow_context* wctx, int methods, const char* path, int type,
+                           void (*handler)(h2o_req_t*, h2ow_run_context*),
+                           int call_type) {
+	// capture handlers have a different signature, so they have their own function
+	if (call_type == H2OW_HANDLER_CAPTURES)
+		return 0;
+
+	return add_handler(wctx, methods, path, type, handler, NULL, call_type);
+}
+
+int h2ow_register_capture_handler(h2ow_context* wctx, int methods, const char* path,
+                                  int type,
+                                  void (*handler)(h2o_req_t*, h2ow_run_context*,
+                                                  h2o_iovec_t*, int)) {
+	return add_handler(wctx, methods, path, type, NULL, handler, H2OW_HANDLER_CAPTURES);
+}
+
 int h2ow_register_handler(h2ow_context* wctx, int methods, const char* path, int type,
                           void (*handler)(h2o_req_t*, h2ow_run_context*)) {
 	return h2ow_register_handler6(wctx, methods, path, type, handler,
 	                              H2OW_HANDLER_NORMAL);
 }
+
+int h2ow__has_streaming_handlers(const h2ow_handler_lists* hl) {
+	for (int type = 0; type < H2OW_NUM_PATH_TYPES; type++) {
+		for (int i = 0; i < hl->num_handlers[type]; i++) {
+			if (hl->handlers_lists[type][i].call_type == H2OW_HANDLER_STREAMING)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+int h2ow_use_static_routes(h2ow_context* wctx, const h2ow_static_routes* routes) {
+	h2ow_handler_lists* hl = &wctx->handlers;
+
+	// the generated lists replace the registered ones, so there mustn't be any
+	if (hl->is_frozen || hl->static_routes != NULL)
+		return 0;
+
+	for (int type = 0; type < H2OW_NUM_PATH_TYPES; type++) {
+		if (hl->num_handlers[type] > 0)
+			return 0;
+
+		for (int i = 0; i < routes->num_handlers[type]; i++) {
+			const h2ow_request_handler* handler = &routes->handlers_lists[type][i];
+
+			if (handler->call_type == H2OW_HANDLER_CAPTURES
+			    && type == H2OW_WILDCARD_PATH && !h2ow__is_capture_glob(handler->path))
+			{
+				return 0;
+			}
+		}
+	}
+
+	// regexes can't be compiled at build time
+	int num_regexes = routes->num_handlers[H2OW_REGEX_PATH];
+	regex_t* regexes = malloc((num_regexes + 1) * sizeof(*regexes));
+	if (regexes == NULL)
+		return 0;
+
+	for (int i = 0; i < num_regexes; i++) {
+		const char* path = routes->handlers_lists[H2OW_REGEX_PATH][i].path;
+
+		if (regcomp(&regexes[i], path, REG_EXTENDED) != 0) {
+			while (i-- > 0) {
+				regfree(&regexes[i]);
+			}
+			free(regexes);
+			return 0;
+		}
+	}
+
+	// the generator leaves counting captures to us, since that needs the regexes
+	for (int type = 0; type < H2OW_NUM_PATH_TYPES; type++) {
+		for (int i = 0; i < routes->num_handlers[type]; i++) {
+			h2ow_request_handler* handler = &routes->handlers_lists[type][i];
+
+			handler->num_captures = h2ow__count_captures(
+			        handler->path, type, type == H2OW_REGEX_PATH ? &regexes[i] : NULL);
+		}
+
+		hl->num_handlers[type] = routes->num_handlers[type];
+		hl->handlers_lists[type] = routes->handlers_lists[type];
+	}
+
+	hl->regexes = regexes;
+	hl->static_routes = routes;
+
+	return 1;
+}
+
 // match_handlers doesn't actually take current_handler since
 // it needs access to the whole handler_lists structure for
-// REGEX_PATH matching
+// REGEX_PATH matching. if the handler wants captures, they are stored in captures
 static inline int match_handler(const h2ow_handler_lists* hl, int type, int i,
-                                const char* path, int method) {
+                                const char* path, size_t path_len,
+                                h2o_iovec_t* captures) {
 	const h2ow_request_handler* handler = &hl->handlers_lists[type][i];
-	if (!(handler->methods & method))
-		return 0;
+	int wants_captures = handler->call_type == H2OW_HANDLER_CAPTURES;
 
 	switch (type) {
 	case H2OW_FIXED_PATH:
 		return streq(handler->path, path);
 		break;
 
+	case H2OW_PARAM_PATH:
+		return h2ow__match_param_path(handler->path, path, path_len, captures) >= 0;
+		break;
+
 	case H2OW_WILDCARD_PATH:
+		if (wants_captures)
+			return h2ow__match_glob(handler->path, path, path_len, captures) >= 0;
+
 		// FNM_PATHNAME makes "/test*" not match "/test/asd"
 		return fnmatch(handler->path, path, FNM_PATHNAME) == 0;
 		break;
 
 	case H2OW_REGEX_PATH:
+		if (wants_captures)
+			return h2ow__match_regex(&hl->regexes[i], path, path_len, captures) >= 0;
+
 		return regexec(&hl->regexes[i], path, 0, NULL, 0) == 0;
 		break;
 	}
@@ -115,10 +251,25 @@ static inline int match_handler(const h2ow_handler_lists* hl, int type, int i,
 }
 
 h2ow_request_handler* h2ow__find_matching_handler(h2ow_handler_lists* hl,
-                                                  const char* path, int method) {
+                                                  const char* path, size_t path_len,
+                                                  int method, h2o_mem_pool_t* pool,
+                                                  h2ow_route_match* match) {
+	// frozen handler lists have their own lookup structures (see router.c)
+	if (hl->is_frozen)
+		return h2ow__router_find(hl, path, path_len, method, pool, match);
+
+	match->captures = NULL;
+	match->num_captures = 0;
+	match->allowed_methods = 0;
+
 	// make an array to order the different types of handlers
-	int type_order[H2OW_NUM_PATH_TYPES]
-	        = { H2OW_FIXED_PATH, H2OW_WILDCARD_PATH, H2OW_REGEX_PATH };
+	int type_order[H2OW_NUM_PATH_TYPES] = { H2OW_FIXED_PATH, H2OW_PARAM_PATH,
+		                                    H2OW_WILDCARD_PATH, H2OW_REGEX_PATH };
+
+	// strcmp, fnmatch and regexec need a null-terminated path
+	char null_terminated_path[path_len + 1];
+	memcpy(null_terminated_path, path, path_len);
+	null_terminated_path[path_len] = '\0';
 
 	for (int i = 0; i < H2OW_NUM_PATH_TYPES; i++) {
 		// first figure out which list we need
@@ -128,15 +279,46 @@ h2ow_request_handler* h2ow__find_matching_handler(h2ow_handler_lists* hl,
 		// then loop through handlers, returning if a match is found
 		for (int j = 0; j < num_handlers; j++) {
 			h2ow_request_handler* current_handler = &hl->handlers_lists[current_type][j];
+			h2o_iovec_t tmp_captures[current_handler->num_captures + 1];
+
+			// remember handlers for other methods, in case we end up with a 405
+			if (!(current_handler->methods & method)) {
+				int new_methods = current_handler->methods & ~match->allowed_methods;
+				if (new_methods
+				    && match_handler(hl, current_type, j, null_terminated_path, path_len,
+				                     tmp_captures))
+				{
+					match->allowed_methods |= current_handler->methods;
+				}
+				continue;
+			}
 
 			// see comment above match_handler on why this needs the whole
-			// handler_lists structure instead of just the current request_handler
-			if (match_handler(hl, current_type, j, path, method)) {
+			// handler_lists structure instead of just the current request_handler.
+			// captures point into the copy, so move them to the original path
+			if (match_handler(hl, current_type, j, null_terminated_path, path_len,
+			                  tmp_captures))
+			{
+				if (current_handler->call_type == H2OW_HANDLER_CAPTURES) {
+					for (int k = 0; k < current_handler->num_captures; k++) {
+						char* base = tmp_captures[k].base;
+						if (base != NULL)
+							tmp_captures[k].base
+							        = (char*)path + (base - null_terminated_path);
+					}
+
+					h2ow__return_captures(pool, tmp_captures,
+					                      current_handler->num_captures,
+					                      &match->captures, &match->num_captures);
+				}
+
+				match->allowed_methods = 0;
 				return current_handler;
 			}
 		}
 	}
 
-	// no matching handler
+	// no matching handler; only keep the methods that actually exist
+	match->allowed_methods &= (1 << H2OW_NUM_METHODS) - 1;
 	return NULL;
 }
@@ -0,0 +1,397 @@
+#include "h2ow/listener.h"
+#include "h2ow/acceptor.h"
+#include "h2ow/runtime.h"
+#include "h2ow/run-setup.h"
+#include "h2ow/settings.h"
+#include "h2ow/steering.h"
+#include "h2ow/upgrade.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* the addresses we listen on are the default host (H2OW_DEFAULT_HOST), the ssl port
+ * on the same ip if we have an ssl context, and everything added with
+ * H2OW_ADD_HOST. they're resolved once in h2ow_run, and then every thread gets a
+ * listener for each of them (or with H2OW_ACCEPT_SHARED, only the first thread).
+ *
+ * tcp listeners of different threads are separate sockets in the same SO_REUSEPORT
+ * group. unix sockets don't support that, so the first thread creates the socket
+ * and the others poll a dup of it; the kernel wakes all of them for a new
+ * connection, but that's fine for the local proxies these are meant for. a socket
+ * file at the path is removed before binding if nobody accepts connections on it
+ * anymore (anything else there is an error), but it isn't removed on shutdown,
+ * since a new process might've inherited the socket (see upgrade.c).
+ */
+
+static int parse_addr(const char* host, int port, h2ow_listen_addr* out) {
+	memset(out, 0, sizeof(*out));
+
+	if (strncmp(host, "unix:", 5) == 0) {
+		struct sockaddr_un* un = (struct sockaddr_un*)&out->addr;
+		const char* path = host + 5;
+
+		if (path[0] == '\0' || strlen(path) >= sizeof(un->sun_path))
+			return -1;
+
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, path);
+		out->addr_len = sizeof(*un);
+	}
+	else if (strchr(host, ':') != NULL) {
+		if (uv_ip6_addr(host, port, (struct sockaddr_in6*)&out->addr) < 0)
+			return -1;
+		out->addr_len = sizeof(struct sockaddr_in6);
+	}
+	else {
+		if (uv_ip4_addr(host, port, (struct sockaddr_in*)&out->addr) < 0)
+			return -1;
+		out->addr_len = sizeof(struct sockaddr_in);
+	}
+
+	return 0;
+}
+
+static int add_listen_addr(h2ow_context* wctx, const char* host, int port, int ssl) {
+	const h2ow_settings* settings = &wctx->settings;
+	h2ow_listen_addr* addr = &wctx->listen_addrs[wctx->num_listen_addrs];
+
+	if (ssl && wctx->ssl_ctx == NULL) {
+		H2OW_WARN("not listening on %s, since it uses ssl and there's no ssl context\n",
+		          host);
+		return 0;
+	}
+
+	if (parse_addr(host, port, addr) < 0) {
+		H2OW_ERR("Couldn't parse address %s\n", host);
+		return -1;
+	}
+
+	addr->ssl = ssl;
+	wctx->num_listen_addrs++;
+	return 0;
+}
+
+int h2ow__init_listen_addrs(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+
+	wctx->num_listen_addrs = 0;
+	wctx->listen_addrs = malloc((settings->num_hosts + 2) * sizeof(*wctx->listen_addrs));
+	if (wctx->listen_addrs == NULL) {
+		H2OW_ERR("not enough memory for the listen addresses\n");
+		return -1;
+	}
+
+	if (add_listen_addr(wctx, settings->ip, settings->port, 0) < 0
+	    || (wctx->ssl_ctx != NULL
+	        && add_listen_addr(wctx, settings->ip, settings->ssl_port, 1) < 0))
+	{
+		goto err;
+	}
+
+	for (int i = 0; i < settings->num_hosts; i++) {
+		const h2ow_host* host = &settings->hosts[i];
+
+		if (add_listen_addr(wctx, host->addr, host->port, host->ssl) < 0)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	h2ow__free_listen_addrs(wctx);
+	return -1;
+}
+
+void h2ow__free_listen_addrs(h2ow_context* wctx) {
+	free(wctx->listen_addrs);
+	wctx->listen_addrs = NULL;
+	wctx->num_listen_addrs = 0;
+}
+
+// a unix socket that is left over from a server that didn't shut down cleanly keeps
+// us from binding to its path, so remove it, but only if it's a socket that nobody
+// accepts connections on anymore. returns 0 if the path can be bound to now
+static int remove_stale_socket(const h2ow_settings* settings,
+                               const h2ow_listen_addr* addr) {
+	const char* path = ((const struct sockaddr_un*)&addr->addr)->sun_path;
+	struct stat st;
+
+	// abstract sockets (and paths that don't exist) don't need any of this
+	if (path[0] == '\0' || lstat(path, &st) == -1)
+		return 0;
+
+	if (!S_ISSOCK(st.st_mode)) {
+		H2OW_ERR("%s exists and isn't a socket\n", path);
+		errno = EADDRINUSE;
+		return -1;
+	}
+
+	// connecting to a stale socket is refused; anything else (including a full
+	// backlog) means that it's still in use
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	int ret = connect(fd, (const struct sockaddr*)&addr->addr, addr->addr_len);
+	int err = errno;
+	close(fd);
+
+	if (ret == 0 || err != ECONNREFUSED) {
+		H2OW_ERR("%s is in use by another server\n", path);
+		errno = EADDRINUSE;
+		return -1;
+	}
+
+	if (unlink(path) == -1 && errno != ENOENT) {
+		H2OW_ERR("Couldn't remove stale socket %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bind_socket(const h2ow_settings* settings, int fd,
+                       const h2ow_listen_addr* addr, int reuseport) {
+	int family = addr->addr.ss_family;
+	int one = 1;
+
+	if (family == AF_UNIX) {
+		if (remove_stale_socket(settings, addr) < 0)
+			return -1;
+	}
+	else if (setsockopt(fd, SOL_SOCKET, reuseport ? SO_REUSEPORT : SO_REUSEADDR, &one,
+	                    sizeof(one))
+	         == -1)
+	{
+		H2OW_ERR("Couldn't set %s flag on socket\n",
+		         reuseport ? "SO_REUSEPORT" : "SO_REUSEADDR");
+		return -1;
+	}
+
+	// ipv4 connections go to ipv4 listeners, so they can use the same port
+	if (family == AF_INET6
+	    && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one)) == -1)
+	{
+		H2OW_ERR("Couldn't set IPV6_V6ONLY flag on socket\n");
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr*)&addr->addr, addr->addr_len) == -1) {
+		H2OW_ERR("Couldn't bind socket\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int h2ow__open_listen_socket(h2ow_run_context* rctx, const h2ow_listen_addr* addr,
+                             int reuseport) {
+	const h2ow_settings* settings = &rctx->wctx->settings;
+
+	// sockets from the process we replace are bound already (and have the steering
+	// program attached, if any)
+	int fd = h2ow__adopt_listener(rctx->wctx, addr);
+	if (fd != -1) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	else {
+		fd = socket(addr->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd == -1) {
+			H2OW_ERR("Couldn't open socket\n");
+			return -1;
+		}
+
+		if (bind_socket(settings, fd, addr, reuseport) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		// the program belongs to the whole reuseport group, so only the first thread
+		// needs to attach it
+		if (reuseport && settings->reuseport_steering && addr->addr.ss_family != AF_UNIX
+		    && rctx == rctx->wctx->run_contexts[0]
+		    && h2ow__attach_steering_prog(rctx->wctx, fd) < 0)
+		{
+			H2OW_WARN("Couldn't attach reuseport steering program, continuing without\n");
+		}
+	}
+
+	// listening again on an adopted socket just updates its backlog
+	h2ow__tune_listener(settings, fd, addr);
+	if (listen(fd, settings->listen_backlog) == -1) {
+		H2OW_ERR("Couldn't listen on socket\n");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// set up rctx->listeners[idx], counting it in rctx->num_listeners once its handle
+// needs to be closed
+static int create_listener(h2ow_run_context* rctx, int idx) {
+	const h2ow_settings* settings = &rctx->wctx->settings;
+	const h2ow_listen_addr* addr = &rctx->wctx->listen_addrs[idx];
+	h2ow_listener* listener = &rctx->listeners[idx];
+	int is_unix = addr->addr.ss_family == AF_UNIX;
+	int fd;
+
+	listener->addr = addr;
+	listener->is_dup = is_unix && rctx != rctx->wctx->run_contexts[0];
+
+	if (listener->is_dup) {
+		fd = fcntl(rctx->wctx->run_contexts[0]->listeners[idx].fd, F_DUPFD_CLOEXEC, 0);
+		if (fd == -1) {
+			H2OW_ERR("Couldn't duplicate the unix socket of the first thread\n");
+			return -1;
+		}
+	}
+	else {
+		fd = h2ow__open_listen_socket(rctx, addr, 1);
+		if (fd == -1)
+			return -1;
+	}
+
+	// create a libuv handle for the socket
+	int err = is_unix ? uv_pipe_init(&rctx->loop, &listener->handle.pipe, 0)
+	                  : uv_tcp_init(&rctx->loop, &listener->handle.tcp);
+	if (err < 0) {
+		H2OW_ERR("Couldn't create a new libuv handle for the socket\n");
+		close(fd);
+		return -1;
+	}
+
+	// from now on, if we have an error, we need to run the uv loop to clean
+	// up the handle (since uv_close is of course asynchronous).
+	rctx->num_listeners++;
+
+	// pass rctx to the listener
+	((uv_handle_t*)&listener->handle)->data = rctx;
+
+	err = is_unix ? uv_pipe_open(&listener->handle.pipe, fd)
+	              : uv_tcp_open(&listener->handle.tcp, fd);
+	if (err < 0) {
+		H2OW_ERR("Couldn't assign the socket to the libuv handle\n");
+		close(fd);
+		return -1;
+	}
+	listener->fd = fd;
+
+	if (uv_listen((uv_stream_t*)&listener->handle, settings->listen_backlog,
+	              h2ow__on_accept)
+	    != 0)
+	{
+		H2OW_ERR("Couldn't listen on bound socket\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int h2ow__create_listeners(h2ow_run_context* rctx) {
+	const h2ow_settings* settings = &rctx->wctx->settings;
+
+	rctx->num_listeners = 0;
+	rctx->paused_listeners = 0;
+
+	// the address of each listener is in it, so the listeners can't be moved around
+	rctx->listeners = calloc(rctx->wctx->num_listen_addrs, sizeof(*rctx->listeners));
+	if (rctx->listeners == NULL) {
+		H2OW_ERR("not enough memory for the listeners\n");
+		return -1;
+	}
+
+	if (settings->accept_model == H2OW_ACCEPT_SHARED)
+		return h2ow__create_acceptor(rctx);
+
+	for (int i = 0; i < rctx->wctx->num_listen_addrs; i++) {
+		if (create_listener(rctx, i) < 0) {
+			// the loop only stops on its own if there's something to clean up
+			rctx->running_cleanup_cbs = h2ow__close_listeners(rctx, h2ow__cleanup_cb);
+			if (rctx->running_cleanup_cbs > 0)
+				uv_run(&rctx->loop, UV_RUN_DEFAULT);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int h2ow__close_listeners(h2ow_run_context* rctx, uv_close_cb cb) {
+	int num_closed = 0;
+
+	if (rctx->wctx->settings.accept_model == H2OW_ACCEPT_SHARED)
+		return h2ow__close_acceptor(rctx, cb);
+
+	for (int i = 0; i < rctx->num_listeners; i++) {
+		uv_close((uv_handle_t*)&rctx->listeners[i].handle, cb);
+		num_closed++;
+	}
+
+	// closing the listeners also drops the connections they were holding back
+	rctx->num_listeners = 0;
+	rctx->paused_listeners = 0;
+
+	return num_closed;
+}
+
+void h2ow__tune_listener(const h2ow_settings* settings, int fd,
+                         const h2ow_listen_addr* addr) {
+	// neither option means anything for unix sockets
+	if (addr->addr.ss_family == AF_UNIX)
+		return;
+
+	// only wake us up once the client actually sent something; the kernel still
+	// completes the handshake, and accepts the connection anyway after the timeout
+	int defer_secs = settings->tcp_defer_accept;
+	if (defer_secs > 0
+	    && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_secs, sizeof(defer_secs))
+	               == -1)
+	{
+		H2OW_WARN("Couldn't set TCP_DEFER_ACCEPT on listening socket\n");
+	}
+
+	int qlen = settings->tcp_fastopen;
+	if (qlen > 0
+	    && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) == -1)
+	{
+		H2OW_WARN("Couldn't set TCP_FASTOPEN on listening socket\n");
+	}
+}
+
+void h2ow__count_accept_error(h2ow_run_context* rctx, int err) {
+	const h2ow_settings* settings = &rctx->wctx->settings;
+
+	// only warn about the first one, since these tend to come in bursts (e.g. when
+	// we run out of file descriptors)
+	if (rctx->num_accept_errors++ == 0) {
+		H2OW_WARN("accepting a connection failed: %s\n", uv_strerror(err));
+	}
+	rctx->last_accept_error = err;
+}
+
+uint64_t h2ow_get_accept_errors(h2ow_context* wctx, uint64_t* per_thread) {
+	int max = wctx->settings.thread_count > 0 ? wctx->settings.thread_count : 1;
+	h2ow_thread_stats stats[max];
+	int num = h2ow__get_thread_stats(wctx, stats, max);
+	uint64_t total = 0;
+
+	for (int i = 0; i < num; i++) {
+		if (per_thread != NULL)
+			per_thread[i] = stats[i].accept_errors;
+		total += stats[i].accept_errors;
+	}
+
+	return total;
+}
@@ -0,0 +1,374 @@
+#include "h2ow/multipart.h"
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+
+#include <unistd.h>
+
+/* multipart bodies consist of parts that are separated by a delimiter, which is
+ * "\r\n--" followed by a boundary from the Content-Type. after the delimiter, there
+ * is either "--" if it was the last one, or a line break and the headers of the
+ * next part. the first delimiter may be at the very start of the body, so we start
+ * as if the body was preceded by a line break.
+ *
+ * we get the body in chunks, as it arrives (see body-stream.c), and hand out
+ * everything as slices of those chunks. the only bytes we copy are the end of a
+ * chunk that might be the start of a delimiter (at most H2OW_MULTIPART_MAX_DELIMITER
+ * of them), and headers of a part that don't fit into one chunk.
+ *
+ * bodies of parts make up almost all of the data, so searching them for the next
+ * delimiter is what needs to be fast. boundaries can't contain '\r', so the
+ * delimiter can only start at a '\r', and we let memchr find those (which glibc does
+ * with simd instructions). only at a '\r' do we compare the rest of the delimiter.
+ */
+
+enum parser_states {
+	// the delimiter is only searched for in these two
+	STATE_PREAMBLE,
+	STATE_BODY,
+	// after a delimiter: padding, then "--" or a line break
+	STATE_AFTER_DELIMITER,
+	STATE_CLOSE_DASH,
+	STATE_DELIMITER_LF,
+	STATE_HEADERS,
+	STATE_EPILOGUE,
+	STATE_ERROR
+};
+
+static int write_all(int fd, const char* buf, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		buf += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+// pass data from the body of a part to its destination
+static int emit(h2ow_multipart* mp, const char* data, size_t len) {
+	if (len == 0 || mp->state == STATE_PREAMBLE)
+		return 0;
+
+	if (mp->fd >= 0)
+		return write_all(mp->fd, data, len);
+
+	if (mp->cbs->on_data != NULL)
+		mp->cbs->on_data(mp, h2o_iovec_init(data, len));
+
+	return 0;
+}
+
+static void on_delimiter(h2ow_multipart* mp) {
+	if (mp->state == STATE_BODY && mp->cbs->on_part_end != NULL)
+		mp->cbs->on_part_end(mp);
+
+	mp->fd = -1;
+	mp->state = STATE_AFTER_DELIMITER;
+}
+
+// returns where parsing continues, or NULL on error
+static const char* scan_body(h2ow_multipart* mp, const char* p, const char* end) {
+	const char* delimiter = mp->delimiter;
+	size_t delimiter_len = mp->delimiter_len;
+
+	// the last chunk ended with what might be the start of a delimiter
+	if (mp->lookbehind_len > 0) {
+		size_t missing = delimiter_len - mp->lookbehind_len;
+		size_t n = (size_t)(end - p) < missing ? (size_t)(end - p) : missing;
+
+		if (memcmp(p, delimiter + mp->lookbehind_len, n) == 0) {
+			if (n < missing) {
+				memcpy(mp->lookbehind + mp->lookbehind_len, p, n);
+				mp->lookbehind_len += n;
+				return end;
+			}
+
+			mp->lookbehind_len = 0;
+			on_delimiter(mp);
+			return p + n;
+		}
+
+		// it was just data after all. since it only contains one '\r', no delimiter
+		// can start in it after its first byte
+		if (emit(mp, mp->lookbehind, mp->lookbehind_len) < 0)
+			return NULL;
+		mp->lookbehind_len = 0;
+	}
+
+	const char* start = p;
+	while (p < end) {
+		const char* cr = memchr(p, '\r', end - p);
+		if (cr == NULL)
+			break;
+
+		size_t left = end - cr;
+		if (left >= delimiter_len) {
+			if (memcmp(cr, delimiter, delimiter_len) == 0) {
+				if (emit(mp, start, cr - start) < 0)
+					return NULL;
+				on_delimiter(mp);
+				return cr + delimiter_len;
+			}
+		}
+		else if (memcmp(cr, delimiter, left) == 0) {
+			// wait for the next chunk to tell whether this is a delimiter
+			if (emit(mp, start, cr - start) < 0)
+				return NULL;
+			memcpy(mp->lookbehind, cr, left);
+			mp->lookbehind_len = left;
+			return end;
+		}
+
+		p = cr + 1;
+	}
+
+	if (emit(mp, start, end - start) < 0)
+		return NULL;
+	return end;
+}
+
+static h2o_iovec_t trim(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+
+	return h2o_iovec_init(p, end - p);
+}
+
+static int name_is(h2o_iovec_t name, const char* expected) {
+	size_t len = strlen(expected);
+	return name.len == len && strncasecmp(name.base, expected, len) == 0;
+}
+
+// find the parameter called name in a header value like
+// 'form-data; name="field"; filename="a.txt"'. quoted values are returned without
+// the quotes (but aren't unescaped). base is NULL if there is no such parameter
+static h2o_iovec_t find_param(h2o_iovec_t value, const char* name) {
+	const char* p = value.base;
+	const char* end = p + value.len;
+
+	while ((p = memchr(p, ';', end - p)) != NULL) {
+		p++;
+		const char* eq = memchr(p, '=', end - p);
+		if (eq == NULL)
+			break;
+
+		int matches = name_is(trim(p, eq), name);
+		const char* val = eq + 1;
+		const char* val_end;
+
+		while (val < end && (*val == ' ' || *val == '\t'))
+			val++;
+
+		if (val < end && *val == '"') {
+			val++;
+			val_end = memchr(val, '"', end - val);
+			if (val_end == NULL)
+				break;
+		}
+		else {
+			val_end = memchr(val, ';', end - val);
+			if (val_end == NULL)
+				val_end = end;
+			h2o_iovec_t tmp = trim(val, val_end);
+			val_end = tmp.base + tmp.len;
+		}
+
+		if (matches)
+			return h2o_iovec_init(val, val_end - val);
+
+		p = val_end;
+	}
+
+	return h2o_iovec_init(NULL, 0);
+}
+
+static void parse_headers(h2ow_multipart_part* part, h2o_iovec_t headers) {
+	const char* p = headers.base;
+	const char* end = p + headers.len;
+
+	part->headers = headers;
+	part->name = part->filename = part->content_type = h2o_iovec_init(NULL, 0);
+
+	while (p < end) {
+		// the block ends with "\r\n", so there always is a '\n'
+		const char* eol = memchr(p, '\n', end - p);
+		const char* line_end = eol > p && eol[-1] == '\r' ? eol - 1 : eol;
+		const char* colon = memchr(p, ':', line_end - p);
+
+		if (colon != NULL) {
+			h2o_iovec_t name = trim(p, colon);
+			h2o_iovec_t value = trim(colon + 1, line_end);
+
+			if (name_is(name, "content-disposition")) {
+				part->name = find_param(value, "name");
+				part->filename = find_param(value, "filename");
+			}
+			else if (name_is(name, "content-type")) {
+				part->content_type = value;
+			}
+		}
+
+		p = eol + 1;
+	}
+}
+
+// returns where parsing continues, or NULL on error
+static const char* scan_headers(h2ow_multipart* mp, const char* p, const char* end) {
+	const char* start = p;
+
+	// headers end with an empty line; crlfs counts how much of "\r\n\r\n" we saw
+	while (p < end && mp->crlfs < 4) {
+		char c = *p++;
+
+		if (c == '\r')
+			mp->crlfs = mp->crlfs == 0 || mp->crlfs == 2 ? mp->crlfs + 1 : 1;
+		else if (c == '\n' && (mp->crlfs == 1 || mp->crlfs == 3))
+			mp->crlfs++;
+		else
+			mp->crlfs = 0;
+	}
+
+	h2o_iovec_t headers;
+	if (mp->crlfs == 4 && mp->headers_len == 0) {
+		headers = h2o_iovec_init(start, p - start);
+	}
+	else {
+		// the headers continue in the next chunk, or started in the last one
+		if (mp->headers_len + (p - start) > sizeof(mp->headers))
+			return NULL;
+
+		memcpy(mp->headers + mp->headers_len, start, p - start);
+		mp->headers_len += p - start;
+
+		if (mp->crlfs < 4)
+			return p;
+
+		headers = h2o_iovec_init(mp->headers, mp->headers_len);
+	}
+
+	// leave out the empty line
+	headers.len -= 2;
+
+	h2ow_multipart_part part;
+	parse_headers(&part, headers);
+
+	mp->state = STATE_BODY;
+	if (mp->cbs->on_part != NULL)
+		mp->cbs->on_part(mp, &part);
+
+	return p;
+}
+
+int h2ow_multipart_feed(h2ow_multipart* mp, h2o_iovec_t chunk) {
+	const char* p = chunk.base;
+	const char* end = p + chunk.len;
+
+	while (p < end) {
+		switch (mp->state) {
+		case STATE_PREAMBLE:
+		case STATE_BODY:
+			p = scan_body(mp, p, end);
+			break;
+
+		case STATE_AFTER_DELIMITER:
+			// transport padding is allowed before the line break
+			if (*p == '-')
+				mp->state = STATE_CLOSE_DASH;
+			else if (*p == '\r')
+				mp->state = STATE_DELIMITER_LF;
+			else if (*p != ' ' && *p != '\t')
+				p = NULL;
+
+			p = p != NULL ? p + 1 : NULL;
+			break;
+
+		case STATE_CLOSE_DASH:
+			mp->state = STATE_EPILOGUE;
+			p = *p == '-' ? p + 1 : NULL;
+			break;
+
+		case STATE_DELIMITER_LF:
+			// the line break after the delimiter counts towards the empty line that
+			// ends the headers, in case there aren't any
+			mp->state = STATE_HEADERS;
+			mp->crlfs = 2;
+			mp->headers_len = 0;
+			p = *p == '\n' ? p + 1 : NULL;
+			break;
+
+		case STATE_HEADERS:
+			p = scan_headers(mp, p, end);
+			break;
+
+		case STATE_EPILOGUE:
+			// anything after the last delimiter is ignored
+			return 0;
+
+		case STATE_ERROR:
+			return -1;
+		}
+
+		if (p == NULL) {
+			mp->state = STATE_ERROR;
+			return -1;
+		}
+	}
+
+	return mp->state == STATE_ERROR ? -1 : 0;
+}
+
+int h2ow_multipart_finish(h2ow_multipart* mp) {
+	return mp->state == STATE_EPILOGUE ? 0 : -1;
+}
+
+void h2ow_multipart_set_fd(h2ow_multipart* mp, int fd) {
+	mp->fd = fd;
+}
+
+int h2ow_multipart_init(h2ow_multipart* mp, h2o_iovec_t content_type,
+                        const h2ow_multipart_callbacks* cbs, void* data) {
+	static const char prefix[] = "multipart/";
+
+	if (content_type.len < sizeof(prefix) - 1
+	    || strncasecmp(content_type.base, prefix, sizeof(prefix) - 1) != 0)
+	{
+		return -1;
+	}
+
+	h2o_iovec_t boundary = find_param(content_type, "boundary");
+	if (boundary.base == NULL || boundary.len == 0
+	    || boundary.len > H2OW_MULTIPART_MAX_BOUNDARY
+	    || memchr(boundary.base, '\r', boundary.len) != NULL)
+	{
+		return -1;
+	}
+
+	mp->cbs = cbs;
+	mp->data = data;
+	mp->state = STATE_PREAMBLE;
+	mp->fd = -1;
+
+	memcpy(mp->delimiter, "\r\n--", 4);
+	memcpy(mp->delimiter + 4, boundary.base, boundary.len);
+	mp->delimiter_len = boundary.len + 4;
+
+	// pretend the body starts after a line break, so the first delimiter can be
+	// at its very start
+	memcpy(mp->lookbehind, "\r\n", 2);
+	mp->lookbehind_len = 2;
+
+	mp->crlfs = 0;
+	mp->headers_len = 0;
+
+	return 0;
+}
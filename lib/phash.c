@@ -0,0 +1,160 @@
+#include "h2ow/phash.h"
+
+#include <stdlib.h>
+
+/* this builds a perfect hash function using the "hash, displace and compress"
+ * scheme: keys are first split into buckets of ~4 keys using one part of their hash.
+ * then, starting with the biggest bucket, we search for a pair of displacements
+ * (d0, d1) for each bucket that sends all of its keys to free slots in the table.
+ * a lookup then costs one hash, one load of the displacements and one of the slot.
+ *
+ * this only runs once before the server starts, so it doesn't need to be very fast.
+ */
+
+// how many seeds to try before giving up, and how many displacement pairs to
+// try per bucket before trying the next seed
+#define MAX_SEEDS 32
+#define MAX_TRIES_PER_BUCKET (1 << 20)
+
+typedef struct key_hash_s {
+	uint32_t f1, f2;
+} key_hash;
+
+// try to find displacements for a bucket and place its keys in ph->slots.
+// returns 1 on success, 0 if no displacements were found
+static int place_bucket(h2ow_phash* ph, const key_hash* hashes, const int* keys,
+                        int num_keys, h2ow_phash_displacement* d) {
+	uint32_t table_size = ph->mask + 1;
+
+	for (uint32_t tries = 0; tries < MAX_TRIES_PER_BUCKET; tries++) {
+		uint32_t d0 = tries / table_size, d1 = tries % table_size;
+		if (d0 >= table_size)
+			break;
+
+		int placed = 0;
+		for (; placed < num_keys; placed++) {
+			const key_hash* h = &hashes[keys[placed]];
+			uint32_t slot = (h->f1 + d0 * h->f2 + d1) & ph->mask;
+
+			if (ph->slots[slot] != -1)
+				break;
+			ph->slots[slot] = keys[placed];
+		}
+
+		if (placed == num_keys) {
+			d->d0 = d0;
+			d->d1 = d1;
+			return 1;
+		}
+
+		// undo what we placed so far (this also works for keys of this bucket
+		// colliding with each other, since those slots are then taken by this bucket)
+		for (int i = 0; i < placed; i++) {
+			const key_hash* h = &hashes[keys[i]];
+			ph->slots[(h->f1 + d0 * h->f2 + d1) & ph->mask] = -1;
+		}
+	}
+
+	return 0;
+}
+
+int h2ow__phash_build(h2ow_phash* ph, const h2o_iovec_t* keys, int num_keys) {
+	memset(ph, 0, sizeof(*ph));
+	if (num_keys == 0)
+		return 0;
+
+	// keep the load factor at or below 80%
+	uint32_t table_size = 1;
+	while (table_size < (uint32_t)num_keys + num_keys / 4 + 1) {
+		table_size <<= 1;
+	}
+	ph->mask = table_size - 1;
+	ph->num_buckets = (num_keys + 3) / 4;
+
+	ph->slots = malloc(table_size * sizeof(*ph->slots));
+	ph->displacements = malloc(ph->num_buckets * sizeof(*ph->displacements));
+	key_hash* hashes = malloc(num_keys * sizeof(*hashes));
+	int* bucket_keys = malloc(num_keys * sizeof(*bucket_keys));
+	int* bucket_starts = malloc((ph->num_buckets + 1) * sizeof(*bucket_starts));
+
+	int ret = -1;
+	if (ph->slots == NULL || ph->displacements == NULL || hashes == NULL
+	    || bucket_keys == NULL || bucket_starts == NULL)
+	{
+		goto out;
+	}
+
+	for (int seed_idx = 0; seed_idx < MAX_SEEDS && ret != 0; seed_idx++) {
+		ph->seed = h2ow__hash(seed_idx, "h2ow", 4);
+
+		// hash all keys and sort them into buckets (counting sort)
+		memset(bucket_starts, 0, (ph->num_buckets + 1) * sizeof(*bucket_starts));
+		for (int i = 0; i < num_keys; i++) {
+			uint64_t h = h2ow__hash(ph->seed, keys[i].base, keys[i].len);
+			hashes[i].f1 = (uint32_t)h;
+			hashes[i].f2 = (uint32_t)(h >> 32);
+
+			uint32_t bucket = ((uint64_t)hashes[i].f2 * ph->num_buckets) >> 32;
+			bucket_starts[bucket + 1]++;
+		}
+
+		int max_bucket_size = 0;
+		for (uint32_t i = 0; i < ph->num_buckets; i++) {
+			if (bucket_starts[i + 1] > max_bucket_size)
+				max_bucket_size = bucket_starts[i + 1];
+			bucket_starts[i + 1] += bucket_starts[i];
+		}
+
+		// use ph->slots as temporary storage for the fill level of each bucket
+		memcpy(ph->slots, bucket_starts, ph->num_buckets * sizeof(*ph->slots));
+		for (int i = 0; i < num_keys; i++) {
+			uint32_t bucket = ((uint64_t)hashes[i].f2 * ph->num_buckets) >> 32;
+			bucket_keys[ph->slots[bucket]++] = i;
+		}
+
+		// now place buckets, biggest first, since those are the hardest to place
+		for (uint32_t i = 0; i < table_size; i++) {
+			ph->slots[i] = -1;
+		}
+
+		ret = 0;
+		for (int size = max_bucket_size; size > 0 && ret == 0; size--) {
+			for (uint32_t b = 0; b < ph->num_buckets; b++) {
+				if (bucket_starts[b + 1] - bucket_starts[b] != size)
+					continue;
+
+				if (!place_bucket(ph, hashes, &bucket_keys[bucket_starts[b]], size,
+				                  &ph->displacements[b]))
+				{
+					ret = -1;
+					break;
+				}
+			}
+		}
+
+		// empty buckets can use any displacements, since lookups that end up in them
+		// are misses anyway (which the caller finds out by comparing the key)
+		for (uint32_t b = 0; b < ph->num_buckets && ret == 0; b++) {
+			if (bucket_starts[b + 1] == bucket_starts[b]) {
+				ph->displacements[b].d0 = 0;
+				ph->displacements[b].d1 = 0;
+			}
+		}
+	}
+
+out:
+	free(hashes);
+	free(bucket_keys);
+	free(bucket_starts);
+
+	if (ret != 0)
+		h2ow__phash_free(ph);
+
+	return ret;
+}
+
+void h2ow__phash_free(h2ow_phash* ph) {
+	free(ph->slots);
+	free(ph->displacements);
+	memset(ph, 0, sizeof(*ph));
+}
@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+
+#include "h2ow/placement.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* with H2OW_CPU_AFFINITY, every loop thread is pinned to one cpu, and its run
+ * context is allocated with its own mmap, which is bound to the numa node of that
+ * cpu before anything touches it. that way, the loop, the h2o context and everything
+ * else in the run context end up in memory that is local to the thread using it
+ * (memory that libuv and h2o malloc themselves still comes from wherever malloc
+ * takes it from). we use the mbind syscall directly so we don't need libnuma.
+ *
+ * run contexts are always allocated separately and are cache line aligned, so
+ * threads never write to the same cache line when updating their counters.
+ */
+
+// from linux/mempolicy.h: prefer the node, but don't fail if it's full
+#define MPOL_PREFERRED 1
+
+int h2ow__thread_cpu(const h2ow_settings* settings, int idx) {
+	if (!settings->pin_threads)
+		return -1;
+
+	if (settings->cpus != NULL)
+		return settings->num_cpus > 0 ? settings->cpus[idx % settings->num_cpus] : -1;
+
+	// spread threads over the cpus we may run on
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || CPU_COUNT(&allowed) == 0)
+		return -1;
+
+	int n = idx % CPU_COUNT(&allowed);
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+			return cpu;
+	}
+
+	return -1;
+}
+
+#ifdef SYS_mbind
+// sysfs has a nodeN entry in the directory of every cpu on machines with numa
+static int cpu_node(int cpu) {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	DIR* dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+
+	int node = -1;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "node", 4) == 0
+		    && sscanf(entry->d_name + 4, "%d", &node) == 1)
+		{
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+#endif
+
+static size_t run_context_size() {
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	return (sizeof(h2ow_run_context) + page_size - 1) / page_size * page_size;
+}
+
+h2ow_run_context* h2ow__alloc_run_context(int cpu) {
+	size_t size = run_context_size();
+
+	// mmap'd memory is zeroed and page aligned, and pages are only assigned to a node
+	// once they are touched
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+	                 -1, 0);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+#ifdef SYS_mbind
+	int node = cpu >= 0 ? cpu_node(cpu) : -1;
+	if (node >= 0 && node < (int)(8 * sizeof(unsigned long))) {
+		unsigned long nodemask = 1UL << node;
+
+		// this is only an optimization, so ignore errors
+		syscall(SYS_mbind, mem, size, MPOL_PREFERRED, &nodemask,
+		        8 * sizeof(nodemask), 0);
+	}
+#else
+	(void)cpu;
+#endif
+
+	return mem;
+}
+
+void h2ow__free_run_context(h2ow_run_context* rctx) {
+	if (rctx != NULL)
+		munmap(rctx, run_context_size());
+}
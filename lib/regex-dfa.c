@@ -0,0 +1,1078 @@
+#include "h2ow/regex-dfa.h"
+#include "h2ow/uthash.h"
+
+#include <ctype.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* instead of calling regexec once per REGEX_PATH handler, all patterns are
+ * compiled into one NFA (thompson construction), which is then turned into a DFA
+ * via subset construction before the server starts. matching then takes a single
+ * table lookup per byte of the path, and tells us every pattern that matched.
+ *
+ * regexec searches for a match anywhere in the path, so after every byte, the
+ * start states of all patterns are added again. '^' can only be passed in the first
+ * state, and '$' only when the path ends, so states remember which patterns would
+ * have matched if the path ended there.
+ *
+ * a DFA for many unanchored patterns can get huge, since its states have to track
+ * every combination of patterns that are partially matched. if it would get too big,
+ * the patterns are split into as few groups as possible, and matching takes one pass
+ * over the path per group.
+ *
+ * only the part of POSIX extended regexes that can be matched like this is
+ * supported; patterns using anything else (back-references, GNU extensions
+ * like \w, collating elements, ...) are left to regexec, as well as patterns that
+ * are too big for a DFA on their own.
+ */
+
+#define MAX_NFA_NODES (1 << 16)
+#define MAX_DFA_STATES 4096
+// bounded repetitions are expanded into copies, so limit how big they can be
+#define MAX_REPEAT 64
+
+// transitions to these aren't states: DFA_END means the path ended at a null byte
+// (which is where regexec would stop), DFA_DEAD that nothing can match anymore
+#define DFA_END (-1)
+#define DFA_DEAD (-2)
+
+typedef struct byte_set_s {
+	uint32_t bits[8];
+} byte_set;
+
+static inline int set_has(const byte_set* set, unsigned char c) {
+	return (set->bits[c >> 5] >> (c & 31)) & 1;
+}
+
+static inline void set_add(byte_set* set, unsigned char c) {
+	set->bits[c >> 5] |= 1u << (c & 31);
+}
+
+enum ast_type { AST_SET, AST_BOL, AST_EOL, AST_EMPTY, AST_CAT, AST_ALT, AST_REPEAT };
+
+typedef struct ast_node_s {
+	enum ast_type type;
+	int left, right; // children for CAT and ALT, left is the repeated node for REPEAT
+	int set;
+	int min, max; // max is -1 for unbounded repetitions
+} ast_node;
+
+enum nfa_type { NFA_CHAR, NFA_JMP, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+typedef struct nfa_node_s {
+	enum nfa_type type;
+	int out, out1;
+	int arg; // index of the byte set for CHAR, index of the pattern for MATCH
+} nfa_node;
+
+typedef struct compiler_s {
+	// shared by all patterns
+	byte_set* sets;
+	int num_sets, sets_cap;
+	nfa_node* nodes;
+	int num_nodes, nodes_cap;
+
+	// state of the pattern that is currently being parsed
+	ast_node* ast;
+	int num_ast, ast_cap;
+	const char* pos;
+	int depth;
+
+	// set if the current pattern uses something we don't support
+	int unsupported;
+	// set if we ran out of memory at any point
+	int oom;
+} compiler;
+
+// grow a dynamic array so it has room for at least one more element
+static int grow(void** arr, int* cap, int num, size_t size) {
+	if (num < *cap)
+		return 0;
+
+	int new_cap = *cap ? *cap * 2 : 16;
+	void* tmp = realloc(*arr, new_cap * size);
+	if (tmp == NULL)
+		return -1;
+
+	*arr = tmp;
+	*cap = new_cap;
+	return 0;
+}
+
+/* ================ PARSING ================ */
+
+static int new_ast(compiler* c, enum ast_type type, int left, int right) {
+	if (c->unsupported || c->oom)
+		return -1;
+
+	if (grow((void**)&c->ast, &c->ast_cap, c->num_ast, sizeof(*c->ast)) < 0) {
+		c->oom = 1;
+		return -1;
+	}
+
+	ast_node* node = &c->ast[c->num_ast];
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->left = left;
+	node->right = right;
+
+	return c->num_ast++;
+}
+
+static int new_set_ast(compiler* c, const byte_set* set) {
+	int idx = new_ast(c, AST_SET, -1, -1);
+	if (idx < 0)
+		return -1;
+
+	if (grow((void**)&c->sets, &c->sets_cap, c->num_sets, sizeof(*c->sets)) < 0) {
+		c->oom = 1;
+		return -1;
+	}
+
+	c->sets[c->num_sets] = *set;
+	c->ast[idx].set = c->num_sets++;
+
+	return idx;
+}
+
+static int char_ast(compiler* c, unsigned char ch) {
+	byte_set set = { { 0 } };
+	set_add(&set, ch);
+	return new_set_ast(c, &set);
+}
+
+// adds the bytes of a "[:name:]" class to set. returns 0, or -1 for unknown classes
+static int add_char_class(byte_set* set, const char* name, int len) {
+	static const struct {
+		const char* name;
+		int (*fn)(int);
+	} classes[] = { { "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+		            { "upper", isupper }, { "lower", islower }, { "space", isspace },
+		            { "xdigit", isxdigit }, { "punct", ispunct }, { "print", isprint },
+		            { "graph", isgraph }, { "cntrl", iscntrl }, { "blank", isblank } };
+
+	for (size_t i = 0; i < sizeof(classes) / sizeof(*classes); i++) {
+		if ((int)strlen(classes[i].name) != len || memcmp(classes[i].name, name, len))
+			continue;
+
+		for (int ch = 0; ch < 256; ch++) {
+			if (classes[i].fn(ch))
+				set_add(set, ch);
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+static int parse_bracket(compiler* c) {
+	byte_set set = { { 0 } };
+	int negate = 0;
+
+	c->pos++; // skip the '['
+	if (*c->pos == '^') {
+		negate = 1;
+		c->pos++;
+	}
+
+	// a ']' right at the start is a literal
+	int first = 1;
+	while (*c->pos != ']' || first) {
+		first = 0;
+
+		if (*c->pos == '\0') {
+			c->unsupported = 1;
+			return -1;
+		}
+
+		if (c->pos[0] == '[' && c->pos[1] == ':') {
+			const char* end = strstr(c->pos + 2, ":]");
+			if (end == NULL || add_char_class(&set, c->pos + 2, end - c->pos - 2) < 0) {
+				c->unsupported = 1;
+				return -1;
+			}
+			c->pos = end + 2;
+			continue;
+		}
+
+		// collating elements and equivalence classes
+		if (c->pos[0] == '[' && (c->pos[1] == '.' || c->pos[1] == '=')) {
+			c->unsupported = 1;
+			return -1;
+		}
+
+		unsigned char lo = *c->pos++;
+		unsigned char hi = lo;
+
+		// a '-' right before the closing ']' is a literal
+		if (c->pos[0] == '-' && c->pos[1] != ']' && c->pos[1] != '\0') {
+			if (c->pos[1] == '[') {
+				c->unsupported = 1;
+				return -1;
+			}
+
+			hi = c->pos[1];
+			c->pos += 2;
+
+			if (hi < lo) {
+				c->unsupported = 1;
+				return -1;
+			}
+		}
+
+		for (int ch = lo; ch <= hi; ch++) {
+			set_add(&set, ch);
+		}
+	}
+	c->pos++; // skip the ']'
+
+	if (negate) {
+		for (int i = 0; i < 8; i++) {
+			set.bits[i] = ~set.bits[i];
+		}
+	}
+
+	return new_set_ast(c, &set);
+}
+
+static int parse_alt(compiler* c);
+
+static int parse_atom(compiler* c) {
+	switch (*c->pos) {
+	case '(': {
+		c->pos++;
+		c->depth++;
+
+		int inner = parse_alt(c);
+		if (*c->pos != ')') {
+			c->unsupported = 1;
+			return -1;
+		}
+
+		c->pos++;
+		c->depth--;
+		return inner;
+	}
+
+	case '.': {
+		byte_set set;
+		memset(&set, 0xff, sizeof(set));
+		c->pos++;
+		return new_set_ast(c, &set);
+	}
+
+	case '[':
+		return parse_bracket(c);
+
+	case '^':
+		c->pos++;
+		return new_ast(c, AST_BOL, -1, -1);
+
+	case '$':
+		c->pos++;
+		return new_ast(c, AST_EOL, -1, -1);
+
+	case '\\': {
+		unsigned char next = c->pos[1];
+
+		// back-references and GNU extensions like \w, \b or \<
+		if (next == '\0' || isalnum(next) || strchr("<>`'", next)) {
+			c->unsupported = 1;
+			return -1;
+		}
+
+		c->pos += 2;
+		return char_ast(c, next);
+	}
+
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		// nothing to repeat; regcomp should have rejected this
+		c->unsupported = 1;
+		return -1;
+
+	default:
+		// this includes a ')' without a matching '(', which is a literal in EREs
+		return char_ast(c, *c->pos++);
+	}
+}
+
+static int parse_number(compiler* c) {
+	int num = 0;
+
+	if (!isdigit((unsigned char)*c->pos))
+		return -1;
+
+	while (isdigit((unsigned char)*c->pos)) {
+		num = num * 10 + (*c->pos++ - '0');
+		if (num > MAX_REPEAT)
+			return -1;
+	}
+
+	return num;
+}
+
+static int contains_anchor(const compiler* c, int idx) {
+	const ast_node* node = &c->ast[idx];
+
+	switch (node->type) {
+	case AST_BOL:
+	case AST_EOL:
+		return 1;
+	case AST_CAT:
+	case AST_ALT:
+		return contains_anchor(c, node->left) || contains_anchor(c, node->right);
+	case AST_REPEAT:
+		return contains_anchor(c, node->left);
+	default:
+		return 0;
+	}
+}
+
+static int parse_piece(compiler* c) {
+	int atom = parse_atom(c);
+
+	for (;;) {
+		int min, max;
+
+		switch (*c->pos) {
+		case '*':
+			min = 0, max = -1;
+			c->pos++;
+			break;
+
+		case '+':
+			min = 1, max = -1;
+			c->pos++;
+			break;
+
+		case '?':
+			min = 0, max = 1;
+			c->pos++;
+			break;
+
+		case '{':
+			c->pos++;
+			min = max = parse_number(c);
+			if (*c->pos == ',') {
+				c->pos++;
+				max = *c->pos == '}' ? -1 : parse_number(c);
+			}
+
+			if (min < 0 || *c->pos != '}' || (max != -1 && max < min)) {
+				c->unsupported = 1;
+				return -1;
+			}
+			c->pos++;
+			break;
+
+		default:
+			return atom;
+		}
+
+		// glibc doesn't treat anchors inside of repetitions like the anchors they
+		// are anywhere else (e.g. "(^a){2}" matches "aa"), so leave those to regexec
+		if (atom < 0 || contains_anchor(c, atom)) {
+			c->unsupported = 1;
+			return -1;
+		}
+
+		atom = new_ast(c, AST_REPEAT, atom, -1);
+		if (atom < 0)
+			return -1;
+
+		c->ast[atom].min = min;
+		c->ast[atom].max = max;
+	}
+}
+
+static int parse_cat(compiler* c) {
+	int result = -1;
+
+	while (*c->pos != '\0' && *c->pos != '|' && !(*c->pos == ')' && c->depth > 0)) {
+		int piece = parse_piece(c);
+		if (piece < 0)
+			return -1;
+
+		result = result < 0 ? piece : new_ast(c, AST_CAT, result, piece);
+	}
+
+	return result < 0 ? new_ast(c, AST_EMPTY, -1, -1) : result;
+}
+
+static int parse_alt(compiler* c) {
+	int result = parse_cat(c);
+
+	while (*c->pos == '|') {
+		c->pos++;
+		result = new_ast(c, AST_ALT, result, parse_cat(c));
+	}
+
+	return result;
+}
+
+/* ================ NFA CONSTRUCTION ================ */
+
+// a piece of the NFA; end is a JMP node whose out still needs to be filled in
+typedef struct fragment_s {
+	int start, end;
+} fragment;
+
+static int new_nfa_node(compiler* c, enum nfa_type type, int out, int out1, int arg) {
+	if (c->num_nodes >= MAX_NFA_NODES) {
+		c->unsupported = 1;
+		return -1;
+	}
+
+	if (grow((void**)&c->nodes, &c->nodes_cap, c->num_nodes, sizeof(*c->nodes)) < 0) {
+		c->oom = 1;
+		return -1;
+	}
+
+	c->nodes[c->num_nodes] = (nfa_node){ type, out, out1, arg };
+	return c->num_nodes++;
+}
+
+static fragment compile_ast(compiler* c, int idx) {
+	fragment ret = { -1, -1 };
+	fragment a, b;
+
+	if (c->unsupported || c->oom)
+		return ret;
+
+	// copy the node, since compiling children might realloc c->ast
+	ast_node node = c->ast[idx];
+
+	switch (node.type) {
+	case AST_SET:
+	case AST_BOL:
+	case AST_EOL: {
+		enum nfa_type type = node.type == AST_SET ? NFA_CHAR :
+		                     node.type == AST_BOL ? NFA_BOL :
+		                                            NFA_EOL;
+		ret.end = new_nfa_node(c, NFA_JMP, -1, -1, 0);
+		ret.start = new_nfa_node(c, type, ret.end, -1, node.set);
+		break;
+	}
+
+	case AST_EMPTY:
+		ret.start = ret.end = new_nfa_node(c, NFA_JMP, -1, -1, 0);
+		break;
+
+	case AST_CAT:
+		a = compile_ast(c, node.left);
+		b = compile_ast(c, node.right);
+		if (a.start < 0 || b.start < 0)
+			break;
+
+		c->nodes[a.end].out = b.start;
+		ret.start = a.start;
+		ret.end = b.end;
+		break;
+
+	case AST_ALT:
+		a = compile_ast(c, node.left);
+		b = compile_ast(c, node.right);
+		if (a.start < 0 || b.start < 0)
+			break;
+
+		ret.end = new_nfa_node(c, NFA_JMP, -1, -1, 0);
+		ret.start = new_nfa_node(c, NFA_SPLIT, a.start, b.start, 0);
+		if (ret.start < 0 || ret.end < 0)
+			break;
+
+		c->nodes[a.end].out = ret.end;
+		c->nodes[b.end].out = ret.end;
+		break;
+
+	case AST_REPEAT:
+		// first, the part that has to match min times
+		ret.start = ret.end = new_nfa_node(c, NFA_JMP, -1, -1, 0);
+		for (int i = 0; i < node.min && ret.start >= 0; i++) {
+			a = compile_ast(c, node.left);
+			if (a.start < 0)
+				return (fragment){ -1, -1 };
+
+			c->nodes[ret.end].out = a.start;
+			ret.end = a.end;
+		}
+
+		if (node.max == -1) {
+			// then a loop for unbounded repetitions
+			a = compile_ast(c, node.left);
+			int end = new_nfa_node(c, NFA_JMP, -1, -1, 0);
+			int split = new_nfa_node(c, NFA_SPLIT, a.start, end, 0);
+			if (a.start < 0 || end < 0 || split < 0)
+				return (fragment){ -1, -1 };
+
+			c->nodes[a.end].out = split;
+			c->nodes[ret.end].out = split;
+			ret.end = end;
+		}
+		else {
+			// or a chain of optional copies for bounded ones
+			for (int i = node.min; i < node.max; i++) {
+				a = compile_ast(c, node.left);
+				int end = new_nfa_node(c, NFA_JMP, -1, -1, 0);
+				int split = new_nfa_node(c, NFA_SPLIT, a.start, end, 0);
+				if (a.start < 0 || end < 0 || split < 0)
+					return (fragment){ -1, -1 };
+
+				c->nodes[a.end].out = end;
+				c->nodes[ret.end].out = split;
+				ret.end = end;
+			}
+		}
+		break;
+	}
+
+	if (ret.start < 0 || ret.end < 0)
+		return (fragment){ -1, -1 };
+
+	return ret;
+}
+
+// compile a pattern into the NFA, and return its start node (or -1)
+static int compile_pattern(compiler* c, const char* pattern, int idx) {
+	c->num_ast = 0;
+	c->pos = pattern;
+	c->depth = 0;
+	c->unsupported = 0;
+
+	int root = parse_alt(c);
+	if (root < 0 || *c->pos != '\0')
+		return -1;
+
+	fragment frag = compile_ast(c, root);
+	if (frag.start < 0)
+		return -1;
+
+	int match = new_nfa_node(c, NFA_MATCH, -1, -1, idx);
+	if (match < 0)
+		return -1;
+
+	c->nodes[frag.end].out = match;
+	return frag.start;
+}
+
+/* ================ DFA CONSTRUCTION ================ */
+
+// a DFA state is identified by the sorted CHAR nodes it consists of and its
+// accepting patterns. keys are laid out as
+// [num_nodes, nodes..., accepts (2 * num_words), accepts_at_end (2 * num_words)]
+typedef struct dfa_state_entry_s {
+	uint32_t* key;
+	int key_len;
+	int id;
+	UT_hash_handle hh;
+} dfa_state_entry;
+
+typedef struct dfa_builder_s {
+	const compiler* c;
+	int num_words;
+
+	// the start nodes of all patterns that are included in the DFA
+	int* starts;
+	int num_starts;
+
+	// scratch space for closures
+	int* stack;
+	int* marks;
+	int mark;
+	int* end_nodes;
+
+	dfa_state_entry* table;
+	dfa_state_entry** states;
+	int num_states;
+} dfa_builder;
+
+static int compare_ints(const void* a, const void* b) {
+	return *(const int*)a - *(const int*)b;
+}
+
+// compute the epsilon closure of seeds and store it as a key in key (which needs room
+// for num_nodes + 1 + 4 * num_words entries). returns the length of the key
+static int closure(dfa_builder* b, const int* seeds, int num_seeds, int at_begin,
+                   uint32_t* key) {
+	const nfa_node* nodes = b->c->nodes;
+	uint64_t any[b->num_words], at_end[b->num_words];
+	int num_chars = 0, num_end_nodes = 0, sp = 0;
+
+	memset(any, 0, sizeof(any));
+	memset(at_end, 0, sizeof(at_end));
+
+	b->mark++;
+	for (int i = 0; i < num_seeds; i++) {
+		b->stack[sp++] = seeds[i];
+	}
+
+	while (sp > 0) {
+		int n = b->stack[--sp];
+		if (n < 0 || b->marks[n] == b->mark)
+			continue;
+		b->marks[n] = b->mark;
+
+		switch (nodes[n].type) {
+		case NFA_CHAR:
+			key[1 + num_chars++] = n;
+			break;
+		case NFA_JMP:
+			b->stack[sp++] = nodes[n].out;
+			break;
+		case NFA_SPLIT:
+			b->stack[sp++] = nodes[n].out1;
+			b->stack[sp++] = nodes[n].out;
+			break;
+		case NFA_BOL:
+			if (at_begin)
+				b->stack[sp++] = nodes[n].out;
+			break;
+		case NFA_EOL:
+			b->end_nodes[num_end_nodes++] = nodes[n].out;
+			break;
+		case NFA_MATCH:
+			any[nodes[n].arg / 64] |= 1ULL << (nodes[n].arg % 64);
+			break;
+		}
+	}
+
+	// now find out what matches if the path ends here, by following
+	// everything that doesn't consume a byte from the '$'s we reached
+	b->mark++;
+	for (int i = 0; i < num_end_nodes; i++) {
+		b->stack[sp++] = b->end_nodes[i];
+	}
+
+	while (sp > 0) {
+		int n = b->stack[--sp];
+		if (n < 0 || b->marks[n] == b->mark)
+			continue;
+		b->marks[n] = b->mark;
+
+		switch (nodes[n].type) {
+		case NFA_CHAR:
+			break;
+		case NFA_SPLIT:
+			b->stack[sp++] = nodes[n].out1;
+			b->stack[sp++] = nodes[n].out;
+			break;
+		case NFA_BOL:
+			if (at_begin)
+				b->stack[sp++] = nodes[n].out;
+			break;
+		case NFA_JMP:
+		case NFA_EOL:
+			b->stack[sp++] = nodes[n].out;
+			break;
+		case NFA_MATCH:
+			at_end[nodes[n].arg / 64] |= 1ULL << (nodes[n].arg % 64);
+			break;
+		}
+	}
+
+	key[0] = num_chars;
+	qsort(key + 1, num_chars, sizeof(*key), compare_ints);
+
+	uint32_t* accepts = key + 1 + num_chars;
+	memcpy(accepts, any, sizeof(any));
+	memcpy(accepts + 2 * b->num_words, at_end, sizeof(at_end));
+
+	return 1 + num_chars + 4 * b->num_words;
+}
+
+// returns the id of the state with the given key, adding it if it doesn't exist yet.
+// returns DFA_DEAD for the state that can't ever match, -3 if there are too
+// many states, or -4 if we ran out of memory
+static int find_or_add_state(dfa_builder* b, const uint32_t* key, int key_len) {
+	int is_dead = key[0] == 0;
+	for (int i = 1 + key[0]; i < key_len && is_dead; i++) {
+		is_dead = key[i] == 0;
+	}
+	if (is_dead)
+		return DFA_DEAD;
+
+	dfa_state_entry* entry;
+	HASH_FIND(hh, b->table, key, key_len * sizeof(*key), entry);
+	if (entry != NULL)
+		return entry->id;
+
+	if (b->num_states >= MAX_DFA_STATES)
+		return -3;
+
+	entry = malloc(sizeof(*entry));
+	uint32_t* key_copy = malloc(key_len * sizeof(*key));
+	dfa_state_entry** new_states
+	        = realloc(b->states, (b->num_states + 1) * sizeof(*b->states));
+	if (new_states != NULL)
+		b->states = new_states;
+
+	if (entry == NULL || key_copy == NULL || new_states == NULL) {
+		free(entry);
+		free(key_copy);
+		return -4;
+	}
+
+	memcpy(key_copy, key, key_len * sizeof(*key));
+	entry->key = key_copy;
+	entry->key_len = key_len;
+	entry->id = b->num_states;
+	b->states[b->num_states++] = entry;
+	HASH_ADD_KEYPTR(hh, b->table, entry->key, key_len * sizeof(*key), entry);
+
+	return entry->id;
+}
+
+static void free_builder_states(dfa_builder* b) {
+	dfa_state_entry *entry, *tmp;
+	HASH_ITER(hh, b->table, entry, tmp) {
+		HASH_DEL(b->table, entry);
+		free(entry->key);
+		free(entry);
+	}
+
+	free(b->states);
+	b->states = NULL;
+	b->num_states = 0;
+}
+
+// group bytes into classes that all byte sets used by the patterns agree on
+static void compute_classes(h2ow_regex_dfa* dfa, const compiler* c, uint8_t* reps) {
+	int classes[256];
+
+	// null bytes end the path for regexec, so they always get their own class
+	for (int ch = 0; ch < 256; ch++) {
+		classes[ch] = ch == 0 ? 0 : 1;
+	}
+	int num_classes = 2;
+
+	for (int i = 0; i < c->num_sets; i++) {
+		// split every class into the bytes inside and outside of the set
+		int split[256][2];
+		memset(split, -1, sizeof(split));
+		int new_num_classes = 0;
+
+		for (int ch = 0; ch < 256; ch++) {
+			int* new_class = &split[classes[ch]][set_has(&c->sets[i], ch)];
+			if (*new_class < 0)
+				*new_class = new_num_classes++;
+			classes[ch] = *new_class;
+		}
+		num_classes = new_num_classes;
+	}
+
+	for (int ch = 255; ch >= 0; ch--) {
+		dfa->classes[ch] = classes[ch];
+		reps[classes[ch]] = ch;
+	}
+	dfa->num_classes = num_classes;
+}
+
+static void free_group(h2ow_regex_dfa_group* group) {
+	free(group->transitions);
+	free(group->has_accepts);
+	free(group->accepts);
+	free(group->accepts_at_end);
+	memset(group, 0, sizeof(*group));
+}
+
+// run the subset construction for the patterns in b->starts.
+// returns 0 on success, -3 if the DFA got too big or -4 if we ran out of memory
+static int build_group(h2ow_regex_dfa* dfa, h2ow_regex_dfa_group* group, dfa_builder* b,
+                       const uint8_t* reps) {
+	const compiler* c = b->c;
+	int key_cap = c->num_nodes + 1 + 4 * b->num_words;
+	uint32_t* key = malloc(key_cap * sizeof(*key));
+	int* seeds = malloc((c->num_nodes + b->num_starts) * sizeof(*seeds));
+	int32_t* transitions = NULL;
+	int ret = -4;
+
+	memset(group, 0, sizeof(*group));
+	if (key == NULL || seeds == NULL)
+		goto out;
+
+	int key_len = closure(b, b->starts, b->num_starts, 1, key);
+	group->start = find_or_add_state(b, key, key_len);
+	if (group->start < 0 && group->start != DFA_DEAD) {
+		ret = group->start;
+		goto out;
+	}
+
+	// states are added while we're iterating, so this is our worklist
+	for (int s = 0; s < b->num_states; s++) {
+		int32_t* new_transitions = realloc(transitions, (size_t)b->num_states
+		                                                        * dfa->num_classes
+		                                                        * sizeof(*transitions));
+		if (new_transitions == NULL)
+			goto out;
+		transitions = new_transitions;
+
+		for (int cls = 0; cls < dfa->num_classes; cls++) {
+			int32_t* next = &transitions[s * dfa->num_classes + cls];
+			unsigned char ch = reps[cls];
+
+			if (ch == 0) {
+				*next = DFA_END;
+				continue;
+			}
+
+			// the key of s might move when states are added, so look it up every time
+			const uint32_t* state_key = b->states[s]->key;
+			int num_seeds = 0;
+			for (uint32_t i = 0; i < state_key[0]; i++) {
+				const nfa_node* node = &c->nodes[state_key[1 + i]];
+				if (set_has(&c->sets[node->arg], ch))
+					seeds[num_seeds++] = node->out;
+			}
+
+			// regexec finds matches starting anywhere, so start every pattern again
+			memcpy(seeds + num_seeds, b->starts, b->num_starts * sizeof(*seeds));
+			num_seeds += b->num_starts;
+
+			key_len = closure(b, seeds, num_seeds, 0, key);
+			*next = find_or_add_state(b, key, key_len);
+			if (*next < 0 && *next != DFA_DEAD) {
+				ret = *next;
+				goto out;
+			}
+		}
+	}
+
+	// now copy everything into the final tables
+	size_t n = b->num_states, words = b->num_words;
+	group->num_states = b->num_states;
+	group->transitions = transitions;
+	group->has_accepts = calloc(n, sizeof(*group->has_accepts));
+	group->accepts = calloc(n * words, sizeof(*group->accepts));
+	group->accepts_at_end = calloc(n * words, sizeof(*group->accepts_at_end));
+	transitions = NULL;
+
+	if (group->has_accepts == NULL || group->accepts == NULL
+	    || group->accepts_at_end == NULL)
+	{
+		goto out;
+	}
+
+	for (size_t s = 0; s < n; s++) {
+		const uint32_t* state_key = b->states[s]->key;
+		const uint32_t* accepts = state_key + 1 + state_key[0];
+
+		memcpy(&group->accepts[s * words], accepts, words * sizeof(uint64_t));
+		memcpy(&group->accepts_at_end[s * words], accepts + 2 * words,
+		       words * sizeof(uint64_t));
+
+		for (size_t w = 0; w < words; w++) {
+			if (group->accepts[s * words + w] != 0)
+				group->has_accepts[s] = 1;
+		}
+	}
+
+	ret = 0;
+
+out:
+	free(key);
+	free(seeds);
+	free(transitions);
+	free_builder_states(b);
+
+	if (ret != 0)
+		free_group(group);
+
+	return ret;
+}
+
+static int add_group(h2ow_regex_dfa* dfa, const h2ow_regex_dfa_group* group) {
+	h2ow_regex_dfa_group* new_groups
+	        = realloc(dfa->groups, (dfa->num_groups + 1) * sizeof(*dfa->groups));
+	if (new_groups == NULL)
+		return -1;
+
+	dfa->groups = new_groups;
+	dfa->groups[dfa->num_groups++] = *group;
+	return 0;
+}
+
+int h2ow__build_regex_dfa(h2ow_regex_dfa* dfa, const h2ow_request_handler* handlers,
+                          int num_handlers) {
+	compiler c;
+	dfa_builder b;
+	uint8_t reps[256];
+	int ret = -1;
+	int* starts = NULL;
+	int* start_patterns = NULL;
+	int num_starts = 0;
+
+	memset(dfa, 0, sizeof(*dfa));
+	memset(&c, 0, sizeof(c));
+	memset(&b, 0, sizeof(b));
+
+	dfa->num_words = (num_handlers + 63) / 64;
+	if (dfa->num_words == 0)
+		dfa->num_words = 1;
+
+	dfa->fallback = calloc(dfa->num_words, sizeof(*dfa->fallback));
+	starts = malloc((num_handlers + 1) * sizeof(*starts));
+	start_patterns = malloc((num_handlers + 1) * sizeof(*start_patterns));
+	if (dfa->fallback == NULL || starts == NULL || start_patterns == NULL)
+		goto out;
+
+	// byte ranges and character classes depend on the locale, and we only
+	// know what they mean in the C locale
+	const char* collate = setlocale(LC_COLLATE, NULL);
+	const char* ctype = setlocale(LC_CTYPE, NULL);
+	int is_c_locale = (collate == NULL || !strcmp(collate, "C") || !strcmp(collate, "POSIX"))
+	                  && (ctype == NULL || !strcmp(ctype, "C") || !strcmp(ctype, "POSIX"));
+
+	for (int i = 0; i < num_handlers; i++) {
+		int start = is_c_locale ? compile_pattern(&c, handlers[i].path, i) : -1;
+		if (c.oom)
+			goto out;
+
+		if (start < 0) {
+			dfa->fallback[i / 64] |= 1ULL << (i % 64);
+			dfa->num_fallbacks++;
+		}
+		else {
+			start_patterns[num_starts] = i;
+			starts[num_starts++] = start;
+		}
+	}
+
+	if (num_starts == 0) {
+		ret = 0;
+		goto out;
+	}
+
+	b.c = &c;
+	b.num_words = dfa->num_words;
+	// every node pushes at most two others, on top of the seeds
+	b.stack = malloc((3 * c.num_nodes + num_handlers + 1) * sizeof(*b.stack));
+	b.marks = calloc(c.num_nodes, sizeof(*b.marks));
+	b.end_nodes = malloc(c.num_nodes * sizeof(*b.end_nodes));
+	if (b.stack == NULL || b.marks == NULL || b.end_nodes == NULL)
+		goto out;
+
+	compute_classes(dfa, &c, reps);
+
+	// put as many patterns as possible into each group. usually, all of them fit
+	// into the first one; otherwise, binary search for how many do
+	for (int first = 0; first < num_starts;) {
+		h2ow_regex_dfa_group group, tmp_group;
+		int fits = 0, doesnt_fit = num_starts - first + 1;
+		int count = num_starts - first;
+
+		memset(&group, 0, sizeof(group));
+		while (fits + 1 < doesnt_fit) {
+			b.starts = starts + first;
+			b.num_starts = count;
+
+			int tmp = build_group(dfa, &tmp_group, &b, reps);
+			if (tmp == -4) {
+				free_group(&group);
+				goto out;
+			}
+
+			if (tmp == 0) {
+				free_group(&group);
+				group = tmp_group;
+				fits = count;
+			}
+			else {
+				doesnt_fit = count;
+			}
+			count = (fits + doesnt_fit) / 2;
+		}
+
+		// if not even a single pattern fits, leave that one to regexec
+		if (fits == 0) {
+			int i = start_patterns[first];
+			dfa->fallback[i / 64] |= 1ULL << (i % 64);
+			dfa->num_fallbacks++;
+			first++;
+			continue;
+		}
+
+		if (add_group(dfa, &group) < 0) {
+			free_group(&group);
+			goto out;
+		}
+		first += fits;
+	}
+
+	ret = 0;
+
+out:
+	free(c.sets);
+	free(c.nodes);
+	free(c.ast);
+	free(starts);
+	free(start_patterns);
+	free(b.stack);
+	free(b.marks);
+	free(b.end_nodes);
+
+	if (ret != 0)
+		h2ow__free_regex_dfa(dfa);
+
+	return ret;
+}
+
+void h2ow__free_regex_dfa(h2ow_regex_dfa* dfa) {
+	for (int i = 0; i < dfa->num_groups; i++) {
+		free_group(&dfa->groups[i]);
+	}
+
+	free(dfa->groups);
+	free(dfa->fallback);
+	memset(dfa, 0, sizeof(*dfa));
+}
+
+static void match_group(const h2ow_regex_dfa* dfa, const h2ow_regex_dfa_group* group,
+                        const char* path, size_t path_len, uint64_t* matched) {
+	int words = dfa->num_words;
+	int state = group->start;
+
+	if (state == DFA_DEAD)
+		return;
+
+	for (int w = 0; w < words; w++) {
+		matched[w] |= group->accepts[state * words + w];
+	}
+
+	const int32_t* transitions = group->transitions;
+	int num_classes = dfa->num_classes;
+
+	for (size_t i = 0; i < path_len; i++) {
+		int next = transitions[state * num_classes + dfa->classes[(unsigned char)path[i]]];
+
+		if (unlikely(next < 0)) {
+			// nothing more can match, and '$' can't match here either
+			if (next == DFA_DEAD)
+				return;
+			// otherwise, we reached a null byte, which ends the path for regexec
+			break;
+		}
+
+		state = next;
+		if (group->has_accepts[state]) {
+			for (int w = 0; w < words; w++) {
+				matched[w] |= group->accepts[state * words + w];
+			}
+		}
+	}
+
+	for (int w = 0; w < words; w++) {
+		matched[w] |= group->accepts_at_end[state * words + w];
+	}
+}
+
+void h2ow__regex_dfa_match(const h2ow_regex_dfa* dfa, const char* path, size_t path_len,
+                           uint64_t* matched) {
+	memset(matched, 0, dfa->num_words * sizeof(*matched));
+
+	for (int i = 0; i < dfa->num_groups; i++) {
+		match_group(dfa, &dfa->groups[i], path, path_len, matched);
+	}
+}
@@ -0,0 +1,128 @@
+#include "h2ow/route-cache.h"
+#include "h2ow/run-setup.h"
+#include "h2ow/handlers.h"
+#include "h2ow/phash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* lookups that end up at wildcard or regex handlers (or at none at all) can cost a
+ * lot of fnmatch and regexec calls, while real traffic tends to hit the same few
+ * paths over and over. so each thread can remember the results of its last lookups
+ * in a direct-mapped table indexed by a hash of the method and path: a hit costs
+ * one hash and one memcmp, and a collision just replaces the old entry.
+ *
+ * FIXED_PATH handlers are found just as fast without the cache, so they aren't
+ * added to it, which leaves more room for everything else.
+ */
+
+int h2ow__init_route_cache(h2ow_route_cache* cache, int size) {
+	memset(cache, 0, sizeof(*cache));
+	if (size <= 0)
+		return 0;
+
+	uint64_t num_entries = 1;
+	while (num_entries < (uint64_t)size) {
+		num_entries <<= 1;
+	}
+
+	cache->entries = malloc(num_entries * sizeof(*cache->entries));
+	if (cache->entries == NULL)
+		return -1;
+
+	for (uint64_t i = 0; i < num_entries; i++) {
+		cache->entries[i].path_len = -1;
+	}
+	cache->mask = num_entries - 1;
+
+	return 0;
+}
+
+void h2ow__free_route_cache(h2ow_route_cache* cache) {
+	free(cache->entries);
+	memset(cache, 0, sizeof(*cache));
+}
+
+static void add_entry(h2ow_route_cache_entry* entry, uint64_t hash, const char* path,
+                      size_t path_len, int method, h2ow_request_handler* handler,
+                      const h2ow_route_match* match) {
+	entry->hash = hash;
+	entry->handler = handler;
+	entry->method = method;
+	entry->allowed_methods = match->allowed_methods;
+	entry->path_len = path_len;
+	entry->num_captures = match->num_captures;
+	memcpy(entry->path, path, path_len);
+
+	// captures point into the path of the request, so remember where
+	for (int i = 0; i < match->num_captures; i++) {
+		const h2o_iovec_t* capture = &match->captures[i];
+
+		entry->captures[i][0] = capture->base == NULL ? -1 : capture->base - path;
+		entry->captures[i][1] = capture->len;
+	}
+}
+
+h2ow_request_handler* h2ow__cached_find_matching_handler(h2ow_route_cache* cache,
+                                                         h2ow_handler_lists* hl,
+                                                         const char* path,
+                                                         size_t path_len, int method,
+                                                         h2o_mem_pool_t* pool,
+                                                         h2ow_route_match* match) {
+	if (cache->entries == NULL || path_len > H2OW_ROUTE_CACHE_MAX_PATH)
+		return h2ow__find_matching_handler(hl, path, path_len, method, pool, match);
+
+	uint64_t hash = h2ow__hash(method, path, path_len);
+	h2ow_route_cache_entry* entry = &cache->entries[hash & cache->mask];
+
+	if (entry->hash == hash && entry->method == method
+	    && entry->path_len == (int)path_len && memcmp(entry->path, path, path_len) == 0)
+	{
+		cache->hits++;
+
+		match->allowed_methods = entry->allowed_methods;
+		match->num_captures = entry->num_captures;
+		match->captures = NULL;
+
+		if (entry->num_captures > 0) {
+			match->captures = h2o_mem_alloc_shared(
+			        pool, entry->num_captures * sizeof(*match->captures), NULL);
+
+			for (int i = 0; i < entry->num_captures; i++) {
+				int offset = entry->captures[i][0];
+				match->captures[i] = h2o_iovec_init(offset < 0 ? NULL : path + offset,
+				                                    entry->captures[i][1]);
+			}
+		}
+
+		return entry->handler;
+	}
+
+	cache->misses++;
+
+	h2ow_request_handler* handler
+	        = h2ow__find_matching_handler(hl, path, path_len, method, pool, match);
+
+	const h2ow_request_handler* fixed = hl->handlers_lists[H2OW_FIXED_PATH];
+	int is_fixed = handler != NULL && handler >= fixed
+	               && handler < fixed + hl->num_handlers[H2OW_FIXED_PATH];
+
+	if (!is_fixed && match->num_captures <= H2OW_ROUTE_CACHE_MAX_CAPTURES)
+		add_entry(entry, hash, path, path_len, method, handler, match);
+
+	return handler;
+}
+
+void h2ow_get_route_cache_stats(h2ow_context* wctx, uint64_t* hits, uint64_t* misses) {
+	int max = wctx->settings.thread_count > 0 ? wctx->settings.thread_count : 1;
+	h2ow_thread_stats stats[max];
+	int num = h2ow__get_thread_stats(wctx, stats, max);
+
+	*hits = 0;
+	*misses = 0;
+
+	for (int i = 0; i < num; i++) {
+		*hits += stats[i].route_cache_hits;
+		*misses += stats[i].route_cache_misses;
+	}
+}
@@ -0,0 +1,813 @@
+#include "h2ow/router.h"
+#include "h2ow/captures.h"
+#include "h2ow/phash.h"
+#include "h2ow/regex-dfa.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fnmatch.h>
+
+/* FIXED_PATH handlers are looked up in a perfect hash table over their paths,
+ * so finding one costs a single hash of the path and a single memcmp. routes from
+ * h2ow_use_static_routes instead come with a matcher that was generated at build time.
+ *
+ * if that doesn't find anything, we use a compressed radix tree over the literal
+ * prefixes (everything up to the first special character) of WILDCARD_PATH handlers.
+ * a lookup walks down the tree once, which gives us the (usually very few) wildcard
+ * handlers whose literal prefix matched. only those are then checked with fnmatch,
+ * and only against the part of the path after their prefix. a path that doesn't
+ * share a prefix with any route thus costs O(path length), no matter how many
+ * routes are registered.
+ *
+ * REGEX_PATH handlers are all matched at once by a DFA (see regex-dfa.c), except
+ * for the ones it can't handle, which still use regexec.
+ *
+ * PARAM_PATH handlers get a radix tree of their own, in which every ":name" segment
+ * is an edge to the param_child of a node. a lookup follows both the literal child
+ * and the param_child where possible, collecting captures on the way.
+ *
+ * all candidates are grouped by method (see h2ow_method_index), so a lookup only
+ * looks at handlers that accept the method of the request. if none of them match,
+ * the methods that would have been accepted tell us whether to send a 404 or a 405.
+ * for fixed and param paths, that comes straight from the index; wildcards and
+ * regexes for other methods still have to be matched, but only in that case.
+ */
+
+// all methods that a handler can accept; H2OW_METHOD_ANY has more bits set
+#define ALL_METHODS ((1 << H2OW_NUM_METHODS) - 1)
+
+static h2ow_route_node* new_node(const char* label, int label_len, int depth) {
+	h2ow_route_node* node = calloc(1, sizeof(*node));
+	if (node == NULL)
+		return NULL;
+
+	node->label = label;
+	node->label_len = label_len;
+	node->depth = depth;
+
+	return node;
+}
+
+static void free_method_index(h2ow_method_index* index) {
+	free(index->handlers);
+	memset(index, 0, sizeof(*index));
+}
+
+// group the given handler indices (in registration order) by method
+static int build_method_index(h2ow_method_index* index,
+                              const h2ow_request_handler* handlers, const int* list,
+                              int num) {
+	int total = 0;
+
+	memset(index, 0, sizeof(*index));
+	for (int m = 0; m < H2OW_NUM_METHODS; m++) {
+		index->starts[m] = total;
+		for (int i = 0; i < num; i++) {
+			if (handlers[list[i]].methods & (1 << m))
+				total++;
+		}
+	}
+	index->starts[H2OW_NUM_METHODS] = total;
+
+	if (total == 0)
+		return 0;
+
+	index->handlers = malloc(total * sizeof(*index->handlers));
+	if (index->handlers == NULL)
+		return -1;
+
+	int pos = 0;
+	for (int m = 0; m < H2OW_NUM_METHODS; m++) {
+		for (int i = 0; i < num; i++) {
+			if (handlers[list[i]].methods & (1 << m)) {
+				index->handlers[pos++] = list[i];
+				index->methods |= 1 << m;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void free_node(h2ow_route_node* node) {
+	for (int i = 0; i < node->num_children; i++) {
+		free_node(node->children[i]);
+	}
+
+	if (node->param_child != NULL)
+		free_node(node->param_child);
+
+	free(node->first_bytes);
+	free(node->children);
+	free(node->wildcards);
+	free(node->params);
+	free_method_index(&node->index);
+	free(node);
+}
+
+// build the method indices of a tree once all handlers are inserted
+static int index_nodes(h2ow_route_node* node, const h2ow_request_handler* handlers) {
+	for (int i = 0; i < node->num_children; i++) {
+		if (index_nodes(node->children[i], handlers) < 0)
+			return -1;
+	}
+
+	if (node->param_child != NULL && index_nodes(node->param_child, handlers) < 0)
+		return -1;
+
+	// nodes are only ever part of one of the trees, so only one of these is set
+	if (node->num_wildcards > 0)
+		return build_method_index(&node->index, handlers, node->wildcards,
+		                          node->num_wildcards);
+
+	return build_method_index(&node->index, handlers, node->params, node->num_params);
+}
+
+static int append_index(int** list, int* num, int idx) {
+	int* new_list = realloc(*list, (*num + 1) * sizeof(**list));
+	if (new_list == NULL)
+		return -1;
+
+	new_list[*num] = idx;
+	*list = new_list;
+	*num += 1;
+
+	return 0;
+}
+
+static int find_child(const h2ow_route_node* node, char c) {
+	// nodes rarely have more than a handful of children, so a linear search
+	// over the first bytes is faster than anything fancy
+	if (node->num_children == 0)
+		return -1;
+
+	const char* found = memchr(node->first_bytes, c, node->num_children);
+	return found == NULL ? -1 : found - node->first_bytes;
+}
+
+static int add_child(h2ow_route_node* parent, h2ow_route_node* child) {
+	int n = parent->num_children;
+
+	char* new_first_bytes = realloc(parent->first_bytes, n + 1);
+	if (new_first_bytes == NULL)
+		return -1;
+	parent->first_bytes = new_first_bytes;
+
+	h2ow_route_node** new_children
+	        = realloc(parent->children, (n + 1) * sizeof(*parent->children));
+	if (new_children == NULL)
+		return -1;
+	parent->children = new_children;
+
+	// keep children sorted by their first byte
+	int i = n;
+	while (i > 0 && (unsigned char)parent->first_bytes[i - 1]
+	                        > (unsigned char)child->label[0]) {
+		parent->first_bytes[i] = parent->first_bytes[i - 1];
+		parent->children[i] = parent->children[i - 1];
+		i--;
+	}
+	parent->first_bytes[i] = child->label[0];
+	parent->children[i] = child;
+	parent->num_children = n + 1;
+
+	return 0;
+}
+
+// returns the node for exactly key[0..len), creating and splitting nodes as needed,
+// or NULL if we're out of memory. labels point into key, so key has to stay alive
+// as long as the tree does (which it does, since it's the path of a handler)
+static h2ow_route_node* insert(h2ow_route_node* root, const char* key, int len) {
+	h2ow_route_node* node = root;
+	int pos = 0;
+
+	while (pos < len) {
+		int i = find_child(node, key[pos]);
+
+		// nothing shares the next byte, so the rest of the key becomes a new leaf
+		if (i < 0) {
+			h2ow_route_node* leaf = new_node(key + pos, len - pos, len);
+			if (leaf == NULL)
+				return NULL;
+			if (add_child(node, leaf) < 0) {
+				free(leaf);
+				return NULL;
+			}
+			return leaf;
+		}
+
+		h2ow_route_node* child = node->children[i];
+		int common = 0;
+		while (common < child->label_len && pos + common < len
+		       && child->label[common] == key[pos + common])
+		{
+			common++;
+		}
+
+		// if the key diverges (or ends) in the middle of the label, split the child
+		// into a node for the common part and a node for the rest of the label
+		if (common < child->label_len) {
+			h2ow_route_node* middle = new_node(child->label, common, pos + common);
+			if (middle == NULL)
+				return NULL;
+			if (add_child(middle, child) < 0) {
+				free(middle);
+				return NULL;
+			}
+
+			child->label += common;
+			child->label_len -= common;
+			middle->first_bytes[0] = child->label[0];
+
+			// the first byte of middle is the same as the one of child, so
+			// the sorting of node->children doesn't change
+			node->children[i] = middle;
+			child = middle;
+		}
+
+		node = child;
+		pos += common;
+	}
+
+	return node;
+}
+
+// length of the part of a wildcard pattern that fnmatch would match literally
+static int literal_prefix_len(const char* pattern) {
+	int len = 0;
+	while (pattern[len] != '\0' && !strchr("*?[\\", pattern[len])) {
+		len++;
+	}
+
+	return len;
+}
+
+static int count_wildcard_nodes(const h2ow_route_node* node) {
+	int max = 0;
+	for (int i = 0; i < node->num_children; i++) {
+		int tmp = count_wildcard_nodes(node->children[i]);
+		if (tmp > max)
+			max = tmp;
+	}
+
+	return max + (node->num_wildcards > 0);
+}
+
+// sort indices of FIXED_PATH handlers by path, and by registration order for
+// handlers with the same path
+static const h2ow_request_handler* sort_handlers;
+static int compare_fixed_handlers(const void* a, const void* b) {
+	int ia = *(const int*)a, ib = *(const int*)b;
+	int cmp = strcmp(sort_handlers[ia].path, sort_handlers[ib].path);
+
+	return cmp != 0 ? cmp : ia - ib;
+}
+
+static void free_fixed_routes(h2ow_handler_lists* hl) {
+	for (int i = 0; i < hl->num_fixed_routes; i++) {
+		free_method_index(&hl->fixed_routes[i].index);
+	}
+	free(hl->fixed_routes);
+	h2ow__phash_free(&hl->fixed_phash);
+
+	hl->fixed_routes = NULL;
+	hl->num_fixed_routes = 0;
+}
+
+// group FIXED_PATH handlers by path and build the perfect hash table over the paths
+static int build_fixed_routes(h2ow_handler_lists* hl) {
+	int num_handlers = hl->num_handlers[H2OW_FIXED_PATH];
+	const h2ow_request_handler* handlers = hl->handlers_lists[H2OW_FIXED_PATH];
+
+	// generated routes come with a matcher of their own
+	if (num_handlers == 0 || hl->static_routes != NULL)
+		return 0;
+
+	int* order = malloc(num_handlers * sizeof(*order));
+	hl->fixed_routes = calloc(num_handlers, sizeof(*hl->fixed_routes));
+	h2o_iovec_t* keys = malloc(num_handlers * sizeof(*keys));
+	if (order == NULL || hl->fixed_routes == NULL || keys == NULL)
+		goto err;
+
+	// this only runs before the server starts, so using a static for qsort is fine
+	for (int i = 0; i < num_handlers; i++) {
+		order[i] = i;
+	}
+	sort_handlers = handlers;
+	qsort(order, num_handlers, sizeof(*order), compare_fixed_handlers);
+
+	// handlers with the same path are next to each other now
+	for (int start = 0, end; start < num_handlers; start = end) {
+		const char* path = handlers[order[start]].path;
+
+		end = start + 1;
+		while (end < num_handlers && strcmp(handlers[order[end]].path, path) == 0) {
+			end++;
+		}
+
+		h2ow_fixed_route* route = &hl->fixed_routes[hl->num_fixed_routes++];
+		route->path = path;
+		route->path_len = strlen(path);
+		keys[hl->num_fixed_routes - 1] = h2o_iovec_init(path, route->path_len);
+
+		if (build_method_index(&route->index, handlers, order + start, end - start) < 0)
+			goto err;
+	}
+
+	if (h2ow__phash_build(&hl->fixed_phash, keys, hl->num_fixed_routes) < 0)
+		goto err;
+
+	free(order);
+	free(keys);
+	return 0;
+
+err:
+	free(order);
+	free(keys);
+	free_fixed_routes(hl);
+	return -1;
+}
+
+// add a PARAM_PATH handler to the tree; literal parts of its path are inserted as
+// usual, and every ":name" segment moves on to the param_child of the current node
+static int insert_param_path(h2ow_route_node* root, const char* path, int idx) {
+	h2ow_route_node* node = root;
+	const char* p = path;
+
+	for (;;) {
+		const char* param = p;
+		while (*param != '\0' && !h2ow__is_param(path, param)) {
+			param++;
+		}
+
+		node = insert(node, p, param - p);
+		if (node == NULL)
+			return -1;
+
+		if (*param == '\0')
+			break;
+
+		if (node->param_child == NULL) {
+			node->param_child = new_node("", 0, 0);
+			if (node->param_child == NULL)
+				return -1;
+		}
+
+		node = node->param_child;
+		p = param + strcspn(param, "/");
+	}
+
+	return append_index(&node->params, &node->num_params, idx);
+}
+
+static int build_param_trie(h2ow_handler_lists* hl) {
+	int num_handlers = hl->num_handlers[H2OW_PARAM_PATH];
+	const h2ow_request_handler* handlers = hl->handlers_lists[H2OW_PARAM_PATH];
+
+	if (num_handlers == 0)
+		return 0;
+
+	hl->param_trie = new_node("", 0, 0);
+	if (hl->param_trie == NULL)
+		return -1;
+
+	// same as for wildcards, index lists need to end up sorted
+	for (int i = 0; i < num_handlers; i++) {
+		if (insert_param_path(hl->param_trie, handlers[i].path, i) < 0)
+			return -1;
+
+		if (handlers[i].num_captures > hl->max_param_captures)
+			hl->max_param_captures = handlers[i].num_captures;
+	}
+
+	return index_nodes(hl->param_trie, handlers);
+}
+
+static int build_regex_methods(h2ow_handler_lists* hl) {
+	int words = hl->regex_dfa.num_words;
+	const h2ow_request_handler* handlers = hl->handlers_lists[H2OW_REGEX_PATH];
+
+	hl->regex_methods = calloc(H2OW_NUM_METHODS * words, sizeof(*hl->regex_methods));
+	if (hl->regex_methods == NULL)
+		return -1;
+
+	for (int i = 0; i < hl->num_handlers[H2OW_REGEX_PATH]; i++) {
+		for (int m = 0; m < H2OW_NUM_METHODS; m++) {
+			if (handlers[i].methods & (1 << m))
+				hl->regex_methods[m * words + i / 64] |= 1ULL << (i % 64);
+		}
+	}
+
+	return 0;
+}
+
+int h2ow__build_router(h2ow_handler_lists* hl) {
+	h2ow_route_node* root = NULL;
+
+	if (build_fixed_routes(hl) < 0)
+		return -1;
+
+	if (h2ow__build_regex_dfa(&hl->regex_dfa, hl->handlers_lists[H2OW_REGEX_PATH],
+	                          hl->num_handlers[H2OW_REGEX_PATH])
+	    < 0)
+	{
+		goto err;
+	}
+
+	if (build_regex_methods(hl) < 0 || build_param_trie(hl) < 0)
+		goto err;
+
+	root = new_node("", 0, 0);
+	if (root == NULL)
+		goto err;
+
+	// handlers are inserted in registration order, so the index lists in
+	// each node end up sorted, which the lookup relies on
+	for (int i = 0; i < hl->num_handlers[H2OW_WILDCARD_PATH]; i++) {
+		const char* path = hl->handlers_lists[H2OW_WILDCARD_PATH][i].path;
+		h2ow_route_node* node = insert(root, path, literal_prefix_len(path));
+
+		if (node == NULL || append_index(&node->wildcards, &node->num_wildcards, i) < 0)
+			goto err;
+	}
+
+	if (index_nodes(root, hl->handlers_lists[H2OW_WILDCARD_PATH]) < 0)
+		goto err;
+
+	hl->trie = root;
+	hl->max_wildcard_nodes = count_wildcard_nodes(root);
+
+	return 0;
+
+err:
+	if (root != NULL)
+		free_node(root);
+	h2ow__free_router(hl);
+	return -1;
+}
+
+void h2ow__free_router(h2ow_handler_lists* hl) {
+	free_fixed_routes(hl);
+	h2ow__free_regex_dfa(&hl->regex_dfa);
+	free(hl->regex_methods);
+	hl->regex_methods = NULL;
+
+	if (hl->trie != NULL)
+		free_node(hl->trie);
+	if (hl->param_trie != NULL)
+		free_node(hl->param_trie);
+
+	hl->trie = NULL;
+	hl->max_wildcard_nodes = 0;
+	hl->param_trie = NULL;
+	hl->max_param_captures = 0;
+}
+
+// the handlers of an index that accept the method with bit m
+static inline const int* method_handlers(const h2ow_method_index* index, int m,
+                                         int* num) {
+	*num = index->starts[m + 1] - index->starts[m];
+	return index->handlers + index->starts[m];
+}
+
+static h2ow_request_handler* find_fixed(const h2ow_handler_lists* hl, const char* path,
+                                        size_t path_len, int m, h2ow_route_match* match) {
+	if (hl->static_routes != NULL) {
+		if (hl->static_routes->find_fixed == NULL)
+			return NULL;
+
+		int allowed = 0;
+		int i = hl->static_routes->find_fixed(path, path_len, m, &allowed);
+		if (i < 0) {
+			match->allowed_methods |= allowed;
+			return NULL;
+		}
+
+		return &hl->handlers_lists[H2OW_FIXED_PATH][i];
+	}
+
+	int idx = h2ow__phash_lookup(&hl->fixed_phash, path, path_len);
+	if (idx < 0)
+		return NULL;
+
+	const h2ow_fixed_route* route = &hl->fixed_routes[idx];
+	if (route->path_len != path_len || memcmp(route->path, path, path_len) != 0)
+		return NULL;
+
+	int num;
+	const int* handlers = method_handlers(&route->index, m, &num);
+	if (num == 0) {
+		match->allowed_methods |= route->index.methods;
+		return NULL;
+	}
+
+	return &hl->handlers_lists[H2OW_FIXED_PATH][handlers[0]];
+}
+
+// state of a search through the PARAM_PATH tree
+typedef struct param_search_s {
+	const char* path;
+	size_t path_len;
+	int m;
+
+	// captures of the current position in the tree, and of the best match so far
+	h2o_iovec_t* captures;
+	h2o_iovec_t* best_captures;
+	int best;
+
+	// methods accepted by any handler whose path matched
+	int allowed_methods;
+} param_search;
+
+static void find_param(param_search* search, const h2ow_route_node* node, size_t pos,
+                       int num_captures) {
+	const char* path = search->path;
+
+	if (pos == search->path_len) {
+		// we want the handler that was registered first, and all of these are
+		// sorted, so the first one is the best one here
+		int num;
+		const int* handlers = method_handlers(&node->index, search->m, &num);
+
+		if (num > 0 && handlers[0] < search->best) {
+			search->best = handlers[0];
+			memcpy(search->best_captures, search->captures,
+			       num_captures * sizeof(*search->captures));
+		}
+
+		search->allowed_methods |= node->index.methods;
+		return;
+	}
+
+	// a literal child and the param_child can both lead to a match, so try both
+	int i = find_child(node, path[pos]);
+	if (i >= 0) {
+		const h2ow_route_node* child = node->children[i];
+		if ((size_t)child->label_len <= search->path_len - pos
+		    && memcmp(child->label, path + pos, child->label_len) == 0)
+		{
+			find_param(search, child, pos + child->label_len, num_captures);
+		}
+	}
+
+	if (node->param_child != NULL && path[pos] != '/') {
+		size_t len = 1;
+		while (pos + len < search->path_len && path[pos + len] != '/') {
+			len++;
+		}
+
+		search->captures[num_captures] = h2o_iovec_init(path + pos, len);
+		find_param(search, node->param_child, pos + len, num_captures + 1);
+	}
+}
+
+static h2ow_request_handler* find_param_path(const h2ow_handler_lists* hl,
+                                             const char* path, size_t path_len, int m,
+                                             h2o_mem_pool_t* pool,
+                                             h2ow_route_match* match) {
+	h2o_iovec_t current_captures[hl->max_param_captures + 1];
+	h2o_iovec_t best_captures[hl->max_param_captures + 1];
+	param_search search;
+
+	search.path = path;
+	search.path_len = path_len;
+	search.m = m;
+	search.captures = current_captures;
+	search.best_captures = best_captures;
+	search.best = INT_MAX;
+	search.allowed_methods = 0;
+
+	find_param(&search, hl->param_trie, 0, 0);
+
+	if (search.best == INT_MAX) {
+		match->allowed_methods |= search.allowed_methods;
+		return NULL;
+	}
+
+	h2ow_request_handler* handler = &hl->handlers_lists[H2OW_PARAM_PATH][search.best];
+	if (handler->call_type == H2OW_HANDLER_CAPTURES)
+		h2ow__return_captures(pool, best_captures, handler->num_captures,
+		                      &match->captures, &match->num_captures);
+
+	return handler;
+}
+
+// match the part of the path after the literal prefix of a wildcard handler
+static int match_wildcard(const h2ow_request_handler* handler, int depth,
+                          const char* path, size_t path_len,
+                          const char* null_terminated_path, h2o_mem_pool_t* pool,
+                          h2ow_route_match* match) {
+	// handlers that want captures are matched by our own glob matcher,
+	// which extracts them on the way
+	if (handler->call_type == H2OW_HANDLER_CAPTURES) {
+		h2o_iovec_t tmp[handler->num_captures + 1];
+		if (h2ow__match_glob(handler->path + depth, path + depth, path_len - depth, tmp)
+		    < 0)
+		{
+			return 0;
+		}
+
+		if (pool != NULL)
+			h2ow__return_captures(pool, tmp, handler->num_captures, &match->captures,
+			                      &match->num_captures);
+		return 1;
+	}
+
+	// FNM_PATHNAME makes "/test*" not match "/test/asd"
+	return fnmatch(handler->path + depth, null_terminated_path + depth, FNM_PATHNAME) == 0;
+}
+
+// once we know that nothing matched, find out which methods would have worked, by
+// matching the wildcard and regex handlers that we skipped because of their method
+static int find_allowed_methods(const h2ow_handler_lists* hl, const char* path,
+                                size_t path_len, const char* null_terminated_path,
+                                const h2ow_route_node** wildcard_nodes,
+                                int num_wildcard_nodes, const uint64_t* matched) {
+	const h2ow_request_handler* wildcards = hl->handlers_lists[H2OW_WILDCARD_PATH];
+	const h2ow_request_handler* regexes = hl->handlers_lists[H2OW_REGEX_PATH];
+	const h2ow_regex_dfa* dfa = &hl->regex_dfa;
+	int allowed = 0;
+
+	// skip handlers that wouldn't add any new methods
+	for (int i = 0; i < num_wildcard_nodes; i++) {
+		const h2ow_route_node* node = wildcard_nodes[i];
+
+		for (int j = 0; j < node->num_wildcards && (node->index.methods & ~allowed); j++) {
+			const h2ow_request_handler* handler = &wildcards[node->wildcards[j]];
+
+			if ((handler->methods & ALL_METHODS & ~allowed)
+			    && match_wildcard(handler, node->depth, path, path_len,
+			                      null_terminated_path, NULL, NULL))
+			{
+				allowed |= handler->methods & ALL_METHODS;
+			}
+		}
+	}
+
+	for (int i = 0; matched != NULL && i < hl->num_handlers[H2OW_REGEX_PATH]; i++) {
+		uint64_t bit = 1ULL << (i % 64);
+		int methods = regexes[i].methods & ALL_METHODS;
+
+		if (!(methods & ~allowed))
+			continue;
+
+		if ((matched[i / 64] & bit)
+		    || ((dfa->fallback[i / 64] & bit)
+		        && regexec(&hl->regexes[i], null_terminated_path, 0, NULL, 0) == 0))
+		{
+			allowed |= methods;
+		}
+	}
+
+	return allowed;
+}
+
+h2ow_request_handler* h2ow__router_find(const h2ow_handler_lists* hl, const char* path,
+                                        size_t path_len, int method, h2o_mem_pool_t* pool,
+                                        h2ow_route_match* match) {
+	// index of the method in the method indices
+	int m = __builtin_ctz(method);
+
+	match->captures = NULL;
+	match->num_captures = 0;
+	match->allowed_methods = 0;
+
+	// FIXED_PATH handlers take priority over everything else
+	h2ow_request_handler* handler = find_fixed(hl, path, path_len, m, match);
+	if (handler != NULL)
+		return handler;
+
+	// then come PARAM_PATH handlers
+	if (hl->param_trie != NULL) {
+		handler = find_param_path(hl, path, path_len, m, pool, match);
+		if (handler != NULL) {
+			// methods of a fixed path only matter if nothing matches at all
+			match->allowed_methods = 0;
+			return handler;
+		}
+	}
+
+	const h2ow_route_node* node = hl->trie;
+	size_t pos = 0;
+
+	// nodes with wildcards that we passed on the way down, from the root downwards
+	const h2ow_route_node* wildcard_nodes[hl->max_wildcard_nodes + 1];
+	int num_wildcard_nodes = 0;
+
+	for (;;) {
+		if (node->num_wildcards > 0)
+			wildcard_nodes[num_wildcard_nodes++] = node;
+
+		if (pos == path_len)
+			break;
+
+		int i = find_child(node, path[pos]);
+		if (i < 0)
+			break;
+
+		const h2ow_route_node* child = node->children[i];
+		if ((size_t)child->label_len > path_len - pos
+		    || memcmp(child->label, path + pos, child->label_len) != 0)
+		{
+			break;
+		}
+
+		pos += child->label_len;
+		node = child;
+	}
+
+	const h2ow_regex_dfa* dfa = &hl->regex_dfa;
+	int num_regexes = hl->num_handlers[H2OW_REGEX_PATH];
+
+	// fnmatch and regexec need a null-terminated path, so only copy it if we
+	// actually have to call one of them
+	int needs_copy = num_wildcard_nodes > 0 || dfa->num_fallbacks > 0;
+	char null_terminated_path[needs_copy ? path_len + 1 : 1];
+	if (needs_copy) {
+		memcpy(null_terminated_path, path, path_len);
+		null_terminated_path[path_len] = '\0';
+	}
+
+	// now check the wildcard handlers for our method whose literal prefix matched;
+	// we want the one that was registered first, so skip everything registered
+	// after the best match we already have
+	h2ow_request_handler* wildcards = hl->handlers_lists[H2OW_WILDCARD_PATH];
+	int best = INT_MAX;
+
+	for (int i = 0; i < num_wildcard_nodes; i++) {
+		const h2ow_route_node* current = wildcard_nodes[i];
+		int num;
+		const int* candidates = method_handlers(&current->index, m, &num);
+
+		for (int j = 0; j < num && candidates[j] < best; j++) {
+			// the prefix already matched, so only match the rest of the pattern
+			if (match_wildcard(&wildcards[candidates[j]], current->depth, path, path_len,
+			                   null_terminated_path, pool, match))
+			{
+				best = candidates[j];
+				break;
+			}
+		}
+	}
+
+	if (best != INT_MAX) {
+		// an earlier match with captures might have been beaten by one without
+		if (wildcards[best].call_type != H2OW_HANDLER_CAPTURES) {
+			match->captures = NULL;
+			match->num_captures = 0;
+		}
+
+		match->allowed_methods = 0;
+		return &wildcards[best];
+	}
+
+	if (num_regexes == 0) {
+		match->allowed_methods |= find_allowed_methods(
+		        hl, path, path_len, null_terminated_path, wildcard_nodes,
+		        num_wildcard_nodes, NULL);
+		return NULL;
+	}
+
+	// the DFA tells us all regexes that matched, so the candidates are those plus
+	// the ones it couldn't handle, as long as they accept our method. go through
+	// them in registration order
+	h2ow_request_handler* regexes = hl->handlers_lists[H2OW_REGEX_PATH];
+	const uint64_t* methods = &hl->regex_methods[m * dfa->num_words];
+	uint64_t matched[dfa->num_words];
+	h2ow__regex_dfa_match(dfa, path, path_len, matched);
+
+	for (int w = 0; w < dfa->num_words; w++) {
+		uint64_t candidates = (matched[w] | dfa->fallback[w]) & methods[w];
+
+		while (candidates != 0) {
+			int i = w * 64 + __builtin_ctzll(candidates);
+			uint64_t bit = candidates & -candidates;
+			candidates ^= bit;
+
+			if (!(matched[w] & bit)
+			    && regexec(&hl->regexes[i], null_terminated_path, 0, NULL, 0) != 0)
+			{
+				continue;
+			}
+
+			// the DFA can't tell us what subexpressions matched, so that
+			// takes one more regexec for handlers that want captures
+			if (regexes[i].call_type == H2OW_HANDLER_CAPTURES) {
+				h2o_iovec_t tmp[regexes[i].num_captures + 1];
+				if (h2ow__match_regex(&hl->regexes[i], path, path_len, tmp) >= 0)
+					h2ow__return_captures(pool, tmp, regexes[i].num_captures,
+					                      &match->captures, &match->num_captures);
+			}
+
+			match->allowed_methods = 0;
+			return &regexes[i];
+		}
+	}
+
+	match->allowed_methods |= find_allowed_methods(hl, path, path_len,
+	                                               null_terminated_path, wildcard_nodes,
+	                                               num_wildcard_nodes, matched);
+	return NULL;
+}
@@ -1,7 +1,23 @@
+#define _GNU_SOURCE
+
+#include "h2ow/run-setup.h"
 #include "h2ow/runtime.h"
 #include "h2ow/settings.h"
-
+#include "h2ow/handlers.h"
+#include "h2ow/route-cache.h"
+#include "h2ow/conn-pool.h"
+#include "h2ow/placement.h"
+#include "h2ow/steering.h"
+#include "h2ow/acceptor.h"
+#include "h2ow/listener.h"
+#include "h2ow/upgrade.h"
+#include "h2ow/tls.h"
+
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <openssl/err.h>
 #include <openssl/ssl.h>
@@ -35,89 +51,14 @@ static int create_signal_handler(h2ow_run_context* rctx, int signum) {
 	return 0;
 }
 
-static int create_reuseaddr_socket(h2ow_run_context* rctx) {
-	const h2ow_settings* settings = &rctx->wctx->settings;
-	int fd;
-
-	fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (fd == -1) {
-		H2OW_ERR("Couldn't open socket\n");
-		return -1;
-	}
-
-	int reuse_addr = 1;
-	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse_addr, sizeof(reuse_addr)) == -1) {
-		H2OW_ERR("Couldn't set SO_REUSEPORT flag on socket\n");
-		close(fd);
-		return -1;
-	}
-
-	return fd;
-}
-
-static int create_listener(h2ow_run_context* rctx, int ssl) {
-	const h2ow_settings* settings = &rctx->wctx->settings;
-	struct sockaddr_in addr;
-	uv_tcp_t* listener = &rctx->listeners[ssl ? 1 : 0];
-
-	// create a libuv handle to later assign a socket to
-	if (uv_tcp_init(&rctx->loop, listener) < 0) {
-		H2OW_ERR("Couldn't create a new libuv handle for the socket\n");
-		return -1;
-	}
-
-	// create an address that we can later bind the socket to
-	if (uv_ip4_addr(settings->ip, ssl ? settings->ssl_port : settings->port, &addr) < 0) {
-		H2OW_ERR("Couldn't get address to bind to\n");
-		return -1;
-	}
-
-	// create a socket and an address for it
-	int sockfd = create_reuseaddr_socket(rctx);
-	if (sockfd == -1) {
-		H2OW_ERR("Couldn't open socket\n");
-		close(sockfd);
-		return -1;
-	}
-
-	// open the socket as a libuv handle
-	if (uv_tcp_open(listener, sockfd) < 0) {
-		H2OW_ERR("Couldn't assign the socket to the libuv handle\n");
-		close(sockfd);
-		return -1;
-	}
-
-	// from now on, if we have an error, we need to run the uv loop to clean
-	// up the handle (since uv_close is of course asynchronous).
-
-	// pass rctx to the listener
-	listener->data = rctx;
-
-	// bind/listen on the listener
-	if (uv_tcp_bind(listener, (struct sockaddr*)&addr, 0) != 0) {
-		H2OW_ERR("Couldn't bind socket\n");
-		goto err;
-	}
-
-	if (uv_listen((uv_stream_t*)listener, 128, h2ow__on_accept) != 0) {
-		H2OW_ERR("Couldn't listen on bound socket\n");
-		goto err;
-	}
-
-	return 0;
-
-err:
-	rctx->running_cleanup_cbs = 1;
-	uv_close((uv_handle_t*)listener, h2ow__cleanup_cb);
-	uv_run(&rctx->loop, UV_RUN_DEFAULT);
-	return -1;
-}
-
 static void register_handler(h2ow_run_context* rctx) {
 	h2o_pathconf_t* pc = h2o_config_register_path(rctx->hostconf, "/", 0);
 	rctx->root_handler
 	        = (h2ow_handler_and_data*)h2o_create_handler(pc, sizeof(*rctx->root_handler));
 	rctx->root_handler->super.on_req = h2ow__request_handler;
+	// h2o only calls us before the whole body is there if we say we can handle that
+	rctx->root_handler->super.supports_request_streaming
+	        = h2ow__has_streaming_handlers(&rctx->wctx->handlers);
 	rctx->root_handler->more_data = rctx;
 }
 
@@ -145,30 +86,9 @@ static int try_create_ssl_ctx(h2ow_context* wctx) {
 	else if (settings->ssl_cert_path != NULL && settings->ssl_key_path != NULL) {
 		init_openssl_once();
 
-		wctx->ssl_ctx = SSL_CTX_new(TLS_server_method());
-
-		// sorry for the looks of this but this is what clang-format wants it to look
-		// like and its still better than doing a million seperate ifs
-		if (wctx->ssl_ctx == NULL
-		    || SSL_CTX_use_certificate_chain_file(wctx->ssl_ctx, settings->ssl_cert_path)
-		               != 1
-		    || SSL_CTX_use_PrivateKey_file(wctx->ssl_ctx, settings->ssl_key_path,
-		                                   SSL_FILETYPE_PEM)
-		               != 1)
-		{
-			unsigned int err = ERR_get_error();
-			H2OW_ERR("couldn't create ssl context because %s failed: %s\n",
-			         ERR_func_error_string(err), ERR_reason_error_string(err));
-
+		wctx->ssl_ctx = h2ow__create_ssl_ctx(wctx);
+		if (wctx->ssl_ctx == NULL)
 			return -1;
-		}
-
-#if H2O_USE_NPN
-		h2o_ssl_register_npn_protocols(wctx->ssl_ctx, h2o_http2_npn_protocols);
-#endif
-#if H2O_USE_ALPN
-		h2o_ssl_register_alpn_protocols(wctx->ssl_ctx, h2o_http2_alpn_protocols);
-#endif
 	}
 	else if (settings->ssl_cert_path != NULL || settings->ssl_key_path != NULL) {
 		H2OW_WARN(
@@ -178,37 +98,128 @@ static int try_create_ssl_ctx(h2ow_context* wctx) {
 	return 0;
 }
 
+/* the stats functions (h2ow_get_route_cache_stats and friends) may be called from
+ * other threads at any time, so they go through h2ow__get_thread_stats, which only
+ * looks at run_contexts while holding stats_lock. the threads keep counting while
+ * it reads, so it uses atomic loads, and the sums are only approximate while the
+ * server runs. before the run contexts are unmapped, their counters are copied to
+ * wctx->thread_stats, so they can still be read after h2ow_run returned.
+ */
+static void read_thread_stats(const h2ow_run_context* rctx, h2ow_thread_stats* stats) {
+	memset(stats, 0, sizeof(*stats));
+	if (rctx == NULL)
+		return;
+
+	stats->route_cache_hits = __atomic_load_n(&rctx->route_cache.hits, __ATOMIC_RELAXED);
+	stats->route_cache_misses
+	        = __atomic_load_n(&rctx->route_cache.misses, __ATOMIC_RELAXED);
+	stats->conns_in_use = __atomic_load_n(&rctx->conn_pool.in_use, __ATOMIC_RELAXED);
+	stats->free_conns = __atomic_load_n(&rctx->conn_pool.num_free, __ATOMIC_RELAXED);
+	stats->steering_checks
+	        = __atomic_load_n(&rctx->num_steering_checks, __ATOMIC_RELAXED);
+	stats->misrouted = __atomic_load_n(&rctx->num_misrouted, __ATOMIC_RELAXED);
+	stats->accept_errors = __atomic_load_n(&rctx->num_accept_errors, __ATOMIC_RELAXED);
+}
+
+int h2ow__get_thread_stats(h2ow_context* wctx, h2ow_thread_stats* stats, int max) {
+	int num = 0;
+
+	pthread_mutex_lock(&wctx->stats_lock);
+
+	if (wctx->run_contexts != NULL) {
+		num = wctx->settings.thread_count < max ? wctx->settings.thread_count : max;
+		for (int i = 0; i < num; i++)
+			read_thread_stats(wctx->run_contexts[i], &stats[i]);
+	}
+	else if (wctx->thread_stats != NULL) {
+		num = wctx->num_thread_stats < max ? wctx->num_thread_stats : max;
+		memcpy(stats, wctx->thread_stats, num * sizeof(*stats));
+	}
+
+	pthread_mutex_unlock(&wctx->stats_lock);
+	return num;
+}
+
+static void free_run_contexts(h2ow_run_context** contexts, int num) {
+	if (contexts == NULL)
+		return;
+
+	for (int i = 0; i < num; i++) {
+		h2ow__free_run_context(contexts[i]);
+	}
+	free(contexts);
+}
+
+static void free_wctx_buffers(h2ow_context* wctx) {
+	int num_threads = wctx->settings.thread_count;
+	h2ow_run_context** contexts = wctx->run_contexts;
+
+	// keep the counters, and make sure nobody reads the run contexts anymore before
+	// unmapping them. if we can't keep the counters, they read as 0 afterwards
+	h2ow_thread_stats* stats = malloc(num_threads * sizeof(*stats));
+
+	pthread_mutex_lock(&wctx->stats_lock);
+
+	for (int i = 0; stats != NULL && i < num_threads; i++) {
+		read_thread_stats(contexts != NULL ? contexts[i] : NULL, &stats[i]);
+		// the pools are gone with the run contexts
+		stats[i].conns_in_use = 0;
+		stats[i].free_conns = 0;
+	}
+
+	free(wctx->thread_stats);
+	wctx->thread_stats = stats;
+	wctx->num_thread_stats = stats != NULL ? num_threads : 0;
+	wctx->run_contexts = NULL;
+
+	pthread_mutex_unlock(&wctx->stats_lock);
+
+	free_run_contexts(contexts, num_threads);
+	free(wctx->threads);
+	wctx->threads = NULL;
+}
+
 static int allocate_wctx_buffers(h2ow_context* wctx) {
 	h2ow_settings* settings = &wctx->settings;
 	int num_threads = settings->thread_count;
 
-	wctx->run_contexts = calloc(num_threads, sizeof(*wctx->run_contexts));
-	if (wctx->run_contexts == NULL) {
+	h2ow_run_context** contexts = calloc(num_threads, sizeof(*contexts));
+	if (contexts == NULL) {
 		H2OW_ERR("not enough memory to allocate run contexts\n");
 
 		return -1;
 	}
 
+	// figure out all cpus before pinning anything, since that changes which cpus
+	// we may run on
+	for (int i = 0; i < num_threads; i++) {
+		int cpu = h2ow__thread_cpu(settings, i);
+
+		contexts[i] = h2ow__alloc_run_context(cpu);
+		if (contexts[i] == NULL) {
+			H2OW_ERR("not enough memory to allocate run contexts\n");
+
+			free_run_contexts(contexts, num_threads);
+			return -1;
+		}
+
+		contexts[i]->cpu = cpu;
+	}
+
 	wctx->threads = malloc(num_threads * sizeof(*wctx->threads));
 	if (wctx->threads == NULL) {
 		H2OW_ERR("not enough memory to allocate pthread handles\n");
 
-		free(wctx->run_contexts);
+		free_run_contexts(contexts, num_threads);
 		return -1;
 	}
 
-	return 0;
-}
-
-// adds the number of additional uv_close calls to running_cleanup_cbs
-static void close_uv_listeners(h2ow_run_context* rctx) {
-	uv_close((uv_handle_t*)&rctx->listeners[0], h2ow__cleanup_cb);
-	rctx->running_cleanup_cbs++;
+	// only publish them once they're complete
+	pthread_mutex_lock(&wctx->stats_lock);
+	wctx->run_contexts = contexts;
+	pthread_mutex_unlock(&wctx->stats_lock);
 
-	if (rctx->wctx->ssl_ctx != NULL) {
-		uv_close((uv_handle_t*)&rctx->listeners[1], h2ow__cleanup_cb);
-		rctx->running_cleanup_cbs++;
-	}
+	return 0;
 }
 
 static void run_all_threads(h2ow_context* wctx, thread_data* thread_infos) {
@@ -223,8 +234,23 @@ static void run_all_threads(h2ow_context* wctx, thread_data* thread_infos) {
 
 	// start the other threads (skip the first, since this thread becomes #1)
 	for (int i = 1; i < num_threads; i++) {
-		int tmp = pthread_create(&wctx->threads[i], NULL, h2ow__per_thread_loop,
+		int cpu = wctx->run_contexts[i]->cpu;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+
+		if (cpu >= 0) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(cpu, &cpus);
+
+			if (pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus) != 0) {
+				H2OW_WARN("couldn't pin thread %d to cpu %d\n", i, cpu);
+			}
+		}
+
+		int tmp = pthread_create(&wctx->threads[i], &attr, h2ow__per_thread_loop,
 		                         &thread_infos[i]);
+		pthread_attr_destroy(&attr);
 
 		// continue anyway if pthread_create fails, but remember
 		// whether we should pthread_join
@@ -234,9 +260,29 @@ static void run_all_threads(h2ow_context* wctx, thread_data* thread_infos) {
 		}
 	}
 
-	// this thread becomes thread #1
+	// this thread becomes thread #1, so it's pinned until the server stops
+	cpu_set_t old_cpus;
+	int cpu = wctx->run_contexts[0]->cpu;
+	int restore_cpus = 0;
+
+	if (cpu >= 0
+	    && pthread_getaffinity_np(pthread_self(), sizeof(old_cpus), &old_cpus) == 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+
+		restore_cpus = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+		if (!restore_cpus) {
+			H2OW_WARN("couldn't pin thread 0 to cpu %d\n", cpu);
+		}
+	}
+
 	h2ow__per_thread_loop(&thread_infos[0]);
 
+	if (restore_cpus)
+		pthread_setaffinity_np(pthread_self(), sizeof(old_cpus), &old_cpus);
+
 	for (int i = 1; i < num_threads; i++) {
 		if (threads_started[i]) {
 			pthread_join(wctx->threads[i], NULL);
@@ -263,11 +309,33 @@ int h2ow_run(h2ow_context* wctx) {
 		return -1;
 	}
 
-	if (try_create_ssl_ctx(wctx) < 0) {
+	if (h2ow__read_inherited_fds(wctx) < 0) {
+		H2OW_ERR("not enough memory to read the inherited listeners\n");
+
+		free_wctx_buffers(wctx);
+		return -1;
+	}
+
+	if (try_create_ssl_ctx(wctx) < 0 || h2ow__init_tls(wctx) < 0) {
 		ret = -5;
 		goto cleanup;
 	}
 
+	// build the router once; after this, the handler lists are read-only and can
+	// be shared between all threads
+	if (h2ow__freeze_handler_lists(&wctx->handlers) < 0) {
+		H2OW_ERR("not enough memory to build the router\n");
+
+		ret = -6;
+		goto cleanup;
+	}
+
+	// needs to know whether we have an ssl context
+	if (h2ow__init_listen_addrs(wctx) < 0) {
+		ret = -4;
+		goto cleanup;
+	}
+
 	// now init stuff per thread
 	if (num_threads <= 0) {
 		H2OW_ERR("num_threads is %d, exiting\n", num_threads);
@@ -275,8 +343,11 @@ int h2ow_run(h2ow_context* wctx) {
 		goto cleanup;
 	}
 
+	wctx->num_connections = 0;
+	wctx->num_cut_off_requests = 0;
+
 	for (int i = 0; i < num_threads; i++) {
-		h2ow_run_context* rctx = &wctx->run_contexts[i];
+		h2ow_run_context* rctx = wctx->run_contexts[i];
 
 		thread_infos[i].wctx = wctx;
 		thread_infos[i].idx = i;
@@ -285,6 +356,23 @@ int h2ow_run(h2ow_context* wctx) {
 		rctx->wctx = wctx;
 		rctx->num_connections = 0;
 
+		if (h2ow__init_route_cache(&rctx->route_cache, settings->route_cache_size) < 0) {
+			H2OW_ERR("not enough memory for the route cache of thread %d\n", i);
+
+			ret = -3;
+			goto cleanup;
+		}
+
+		if (h2ow__init_conn_pool(&rctx->conn_pool, settings->conn_pool_prealloc,
+		                         settings->conn_pool_max_free)
+		    < 0)
+		{
+			H2OW_ERR("not enough memory for the connection pool of thread %d\n", i);
+
+			ret = -3;
+			goto cleanup;
+		}
+
 		// h2o initialization depends on a uv loop, so init that second
 		if (uv_loop_init(&rctx->loop) < 0) {
 			H2OW_ERR("Failed to init uv loop for thread %d\n", i);
@@ -309,38 +397,25 @@ int h2ow_run(h2ow_context* wctx) {
 		if (wctx->ssl_ctx != NULL) {
 			rctx->accept_ctxs[1].ctx = &rctx->ctx;
 			rctx->accept_ctxs[1].hosts = rctx->globconf.hosts;
+			// every thread holds its own reference, since reloading replaces them
+			// one by one (see tls.c)
+			SSL_CTX_up_ref(wctx->ssl_ctx);
 			rctx->accept_ctxs[1].ssl_ctx = wctx->ssl_ctx;
 		}
 
 		register_handler(rctx);
 
-		if (create_listener(rctx, 0) < 0) {
-			H2OW_ERR("Failed to create plain http listener for thread %d\n", i);
+		if (h2ow__create_listeners(rctx) < 0) {
+			H2OW_ERR("Failed to create listeners for thread %d\n", i);
 
 			ret = -4;
 			goto cleanup;
 		}
-		if (wctx->ssl_ctx != NULL) {
-			if (create_listener(rctx, 1) < 0) {
-				H2OW_ERR("Failed to create ssl listener for thread %d\n", i);
-
-				rctx->running_cleanup_cbs = 1;
-				uv_close((uv_handle_t*)&rctx->listeners[0], h2ow__cleanup_cb);
-				uv_run(&rctx->loop, UV_RUN_DEFAULT);
-				// can't close the loop since h2o registers some handles to the uv loop
-
-				ret = -4;
-				goto cleanup;
-			}
-		}
 
 		if (create_signal_handler(rctx, SIGINT) < 0) {
 			H2OW_ERR("Failed to register SIGINT handler for thread %d\n", i);
 
-			// close_uv_listeners adds the number of additional uv_close calls to
-			// running_cleanup_cbs, so set that to 0
-			rctx->running_cleanup_cbs = 0;
-			close_uv_listeners(rctx);
+			rctx->running_cleanup_cbs = h2ow__close_listeners(rctx, h2ow__cleanup_cb);
 			uv_run(&rctx->loop, UV_RUN_DEFAULT);
 			// can't close the loop since h2o registers some handles to the uv loop
 
@@ -351,10 +426,8 @@ int h2ow_run(h2ow_context* wctx) {
 		if (create_signal_handler(rctx, SIGTERM) < 0) {
 			H2OW_ERR("Failed to register SIGTERM handler for thread %d\n", i);
 
-			// close_uv_listeners adds the number of additional uv_close calls to
-			// running_cleanup_cbs, so set that to 1 (for the SIGINT handler)
-			rctx->running_cleanup_cbs = 1;
-			close_uv_listeners(rctx);
+			// one more for the SIGINT handler
+			rctx->running_cleanup_cbs = h2ow__close_listeners(rctx, h2ow__cleanup_cb) + 1;
 			uv_close((uv_handle_t*)&rctx->int_handler, h2ow__cleanup_cb);
 			uv_run(&rctx->loop, UV_RUN_DEFAULT);
 			// can't close the loop since h2o registers some handles to the uv loop
@@ -363,31 +436,86 @@ int h2ow_run(h2ow_context* wctx) {
 			goto cleanup;
 		}
 
+		// not fatal, since the server works fine without them
+		rctx->upgrade_handler.data = NULL;
+		rctx->upgrade_poll.data = NULL;
+		if (i == 0 && settings->upgrade_signal != 0
+		    && h2ow__create_upgrade_handler(rctx) < 0)
+		{
+			H2OW_WARN("Failed to register upgrade signal handler, continuing without\n");
+		}
+
+		rctx->ticket_timer.data = NULL;
+		if (i == 0 && wctx->ssl_ctx != NULL && settings->manage_tickets
+		    && settings->ticket_rotation_secs > 0 && h2ow__create_ticket_timer(rctx) < 0)
+		{
+			H2OW_WARN("Failed to create ticket key rotation timer, continuing without\n");
+		}
+
+		rctx->reload_handler.data = NULL;
+		if (i == 0 && wctx->ssl_ctx != NULL && settings->ssl_reload_signal != 0
+		    && h2ow__create_reload_handler(rctx) < 0)
+		{
+			H2OW_WARN("Failed to register ssl reload handler, continuing without\n");
+		}
+
 		// in case we error out during initialization, use cleanup_until to tell
 		// later parts or the code how many thread contexts have been fully initialized
 		cleanup_until = i;
 	}
 
+	// all listeners exist now, so the process we replace can shut down, and the
+	// inherited sockets we didn't take are unused
+	h2ow__signal_ready(wctx);
+	h2ow__close_inherited_fds(wctx);
+
 	run_all_threads(wctx, thread_infos);
 
 cleanup:
 	sigaction(SIGPIPE, &old_sigpipe_act, NULL);
 
+	h2ow__close_inherited_fds(wctx);
+
 	for (int i = 0; i <= cleanup_until; i++) {
 		// we can't do much here, since we can't call uv_loop_close
 		// because h2o registers some timers and doesn't bother to support
 		// cleaning them up. (trying to clean up libh2o will cause an abort)
 		// github.com/kazuho plis
-		h2ow_run_context* rctx = &wctx->run_contexts[i];
+		h2ow_run_context* rctx = wctx->run_contexts[i];
 		delete_handler(rctx);
 	}
 
+	// run contexts are zeroed when they are allocated, so this is fine even for
+	// the ones we didn't get to
+	for (int i = 0; i < num_threads; i++) {
+		h2ow__free_route_cache(&wctx->run_contexts[i]->route_cache);
+		h2ow__free_conn_pool(&wctx->run_contexts[i]->conn_pool);
+		// the listeners were closed by h2ow__on_signal or when erroring out
+		free(wctx->run_contexts[i]->listeners);
+		// zeroed for the threads whose acceptor wasn't set up, which is fine too
+		if (settings->accept_model == H2OW_ACCEPT_SHARED)
+			pthread_mutex_destroy(&wctx->run_contexts[i]->accept_queue.lock);
+	}
+
+	h2ow__free_listen_addrs(wctx);
+
+	free(wctx->exe_path);
+	wctx->exe_path = NULL;
+
+	h2ow__thaw_handler_lists(&wctx->handlers);
+
+	// a reload that is still running uses wctx, which the caller may free as soon
+	// as we return
+	if (num_threads > 0)
+		h2ow__join_reload_thread(wctx->run_contexts[0]);
+	h2ow__release_ssl_ctxs(wctx);
+	h2ow__free_tls(wctx);
+
 	// only clean up ssl context if we created it
 	if (settings->ssl_ctx == NULL && wctx->ssl_ctx != NULL)
 		SSL_CTX_free(wctx->ssl_ctx);
 
-	free(wctx->run_contexts);
-	free(wctx->threads);
+	free_wctx_buffers(wctx);
 
 	return ret;
 }
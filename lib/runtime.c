@@ -1,6 +1,14 @@
 #include "h2ow/runtime.h"
 #include "h2ow/settings.h"
 #include "h2ow/handlers.h"
+#include "h2ow/route-cache.h"
+#include "h2ow/conn-pool.h"
+#include "h2ow/steering.h"
+#include "h2ow/acceptor.h"
+#include "h2ow/listener.h"
+#include "h2ow/tls.h"
+#include "h2ow/upgrade.h"
+#include "h2ow/body-stream.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -29,11 +37,19 @@ void h2ow__cleanup_free_cb(uv_handle_t* self) {
 	free(self);
 }
 
-static void stop_loop(uv_timer_t* timer) {
-	h2ow_run_context* rctx = timer->data;
-	h2ow_settings* settings = &rctx->wctx->settings;
+/* on SIGINT or SIGTERM, we stop accepting and ask h2o to shut down its connections
+ * (h2o sends a GOAWAY on http2 connections, and Connection: close on the response
+ * to the next request on http1 ones). then the loop keeps running until all
+ * connections are closed, or until settings->shutdown_timeout ms have passed,
+ * whichever comes first. requests that are still running at that point are cut off;
+ * we count them by giving every request an object in its pool whose dispose
+ * callback runs once the request is done.
+ */
 
-	H2OW_NOTE("Timer expired, stopping the loop (after cleaning up self)\n");
+// stop the loop (after cleaning up the drain timer)
+static void finish_draining(h2ow_run_context* rctx) {
+	uv_timer_t* timer = rctx->drain_timer;
+	rctx->drain_timer = NULL;
 
 	uv_timer_stop(timer);
 
@@ -41,6 +57,27 @@ static void stop_loop(uv_timer_t* timer) {
 	uv_close((uv_handle_t*)timer, h2ow__cleanup_free_cb);
 }
 
+static void stop_loop(uv_timer_t* timer) {
+	h2ow_run_context* rctx = timer->data;
+	h2ow_settings* settings = &rctx->wctx->settings;
+
+	if (rctx->num_inflight > 0) {
+		H2OW_WARN("Shutdown timeout expired, cutting off %d requests on %d connections\n",
+		          rctx->num_inflight, rctx->num_connections);
+		__sync_fetch_and_add(&rctx->wctx->num_cut_off_requests, rctx->num_inflight);
+	}
+	else {
+		H2OW_NOTE("Timer expired, stopping the loop (after cleaning up self)\n");
+	}
+
+	finish_draining(rctx);
+}
+
+static void on_request_dispose(void* data) {
+	h2ow_run_context* rctx = *(h2ow_run_context**)data;
+	rctx->num_inflight--;
+}
+
 void h2ow__on_signal(uv_signal_t* self, int signum) {
 	h2ow_run_context* rctx = self->data;
 	h2ow_settings* settings = &rctx->wctx->settings;
@@ -63,9 +100,18 @@ void h2ow__on_signal(uv_signal_t* self, int signum) {
 		if (rctx->term_handler.data != NULL)
 			uv_close((uv_handle_t*)&rctx->term_handler, NULL);
 
-		uv_close((uv_handle_t*)&rctx->listeners[0], NULL);
-		if (rctx->wctx->ssl_ctx != NULL)
-			uv_close((uv_handle_t*)&rctx->listeners[1], NULL);
+		h2ow__close_upgrade_handler(rctx);
+
+		if (rctx->ticket_timer.data != NULL)
+			uv_close((uv_handle_t*)&rctx->ticket_timer, NULL);
+
+		if (rctx->reload_handler.data != NULL)
+			uv_close((uv_handle_t*)&rctx->reload_handler, NULL);
+
+		h2ow__close_listeners(rctx, NULL);
+
+		if (rctx->resume_timer.data != NULL)
+			uv_close((uv_handle_t*)&rctx->resume_timer, NULL);
 
 		h2o_context_request_shutdown(&rctx->ctx);
 
@@ -73,11 +119,13 @@ void h2ow__on_signal(uv_signal_t* self, int signum) {
 		uv_timer_t* stop_timer = malloc(sizeof(*stop_timer));
 		if (stop_timer == NULL || uv_timer_init(&rctx->loop, stop_timer) < 0) {
 			// try to exit asap
+			free(stop_timer);
 			uv_stop(&rctx->loop);
 			return;
 		}
 
-		if (uv_timer_start(stop_timer, stop_loop, 5000, 0) < 0) {
+		int timeout = settings->shutdown_timeout > 0 ? settings->shutdown_timeout : 0;
+		if (uv_timer_start(stop_timer, stop_loop, timeout, 0) < 0) {
 			// also try to exit asap
 			uv_close((uv_handle_t*)stop_timer, (uv_close_cb)free);
 			uv_stop(&rctx->loop);
@@ -85,6 +133,13 @@ void h2ow__on_signal(uv_signal_t* self, int signum) {
 		}
 
 		stop_timer->data = rctx;
+		rctx->drain_timer = stop_timer;
+
+		// h2ow__on_close stops the loop once the last connection is closed
+		if (rctx->num_connections == 0) {
+			H2OW_NOTE("No open connections, stopping the loop\n");
+			finish_draining(rctx);
+		}
 
 		break;
 
@@ -94,27 +149,71 @@ void h2ow__on_signal(uv_signal_t* self, int signum) {
 	}
 }
 
-void h2ow__on_close(uv_handle_t* conn) {
-	// this is called when a socket is closed; decrement the connections counter
-	h2ow_run_context* rctx = ((uv_tcp_and_data*)conn)->more_data;
-	rctx->num_connections--;
+/* connections can be limited per thread and for the whole server (see
+ * H2OW_MAX_CONNECTIONS). once a limit is reached, a listener stops accepting
+ * connections: we just don't call uv_accept for the one we were told about, which
+ * makes libuv stop polling the listener until we do. the kernel keeps queueing new
+ * connections in the meantime, until its backlog is full. once the number of
+ * connections drops below resume_percent of the limit, we accept the pending one,
+ * and libuv starts polling again.
+ *
+ * alternatively, with H2OW_OVERLOAD_503, connections over the limit are accepted,
+ * get a 503 if we can write it right away, and are closed immediately.
+ */
+
+// how often paused threads check whether they can accept again, in ms. this is
+// needed because connections closing on other threads don't tell us when the
+// number of connections of the whole server drops
+#define RESUME_INTERVAL 20
+
+static const char overload_response[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                        "Content-Length: 0\r\n"
+                                        "Connection: close\r\n\r\n";
 
-	free(conn);
+void h2ow__shed_socket(h2ow_run_context* rctx, int fd, int ssl) {
+	rctx->num_shed_connections++;
+
+	// there's no point in sending a plain text response to a tls client, and if the
+	// response doesn't fit into the socket buffer, the client doesn't get one
+	if (rctx->wctx->settings.overload_503 && !ssl)
+		send(fd, overload_response, sizeof(overload_response) - 1,
+		     MSG_DONTWAIT | MSG_NOSIGNAL);
 }
 
-void h2ow__on_accept(uv_stream_t* listener, int status) {
-	uv_tcp_and_data* conn;
-	h2o_socket_t* sock;
-	h2ow_run_context* rctx = listener->data;
+static inline int total_connections(h2ow_context* wctx) {
+	return __sync_fetch_and_add(&wctx->num_connections, 0);
+}
 
-	if (unlikely(status != 0 || !rctx->wctx->is_running)) {
-		return;
+// whether we are below the connection limits, or below the low-water marks if
+// resuming is set
+static int may_accept(h2ow_run_context* rctx, int resuming) {
+	const h2ow_settings* settings = &rctx->wctx->settings;
+	int per_thread = settings->max_connections_per_thread;
+	int total = settings->max_connections;
+
+	if (resuming) {
+		per_thread = per_thread * settings->resume_percent / 100;
+		total = total * settings->resume_percent / 100;
+		per_thread = per_thread > 0 ? per_thread : 1;
+		total = total > 0 ? total : 1;
 	}
 
-	conn = malloc(sizeof(*conn));
+	if (settings->max_connections_per_thread > 0 && rctx->num_connections >= per_thread)
+		return 0;
+
+	return settings->max_connections <= 0 || total_connections(rctx->wctx) < total;
+}
+
+void h2ow__on_unused_close(uv_handle_t* conn) {
+	h2ow_run_context* rctx = ((uv_tcp_and_data*)conn)->more_data;
+	h2ow__conn_pool_put(&rctx->conn_pool, (uv_tcp_and_data*)conn);
+}
+
+static uv_tcp_and_data* new_connection(h2ow_run_context* rctx, uv_stream_t* listener) {
+	uv_tcp_and_data* conn = h2ow__conn_pool_get(&rctx->conn_pool);
 	if (unlikely(conn == NULL)) {
 		fprintf(stderr, "Out of memory\n");
-		return;
+		return NULL;
 	}
 
 	// create a new connection object
@@ -122,26 +221,152 @@ void h2ow__on_accept(uv_stream_t* listener, int status) {
 	conn->more_data = rctx;
 
 	// try to accept a connection; thats why we got called
-	if (unlikely(uv_accept(listener, (uv_stream_t*)conn) != 0)) {
-		uv_close((uv_handle_t*)conn, (uv_close_cb)free);
-		return;
+	int err = uv_accept(listener, (uv_stream_t*)conn);
+	if (unlikely(err != 0)) {
+		h2ow__count_accept_error(rctx, err);
+		uv_close((uv_handle_t*)conn, h2ow__on_unused_close);
+		return NULL;
 	}
 
+	return conn;
+}
+
+void h2ow__add_connection(h2ow_run_context* rctx, uv_tcp_and_data* conn, int ssl) {
+	// pick up a reloaded certificate; connections on the old one keep it alive
+	if (ssl && unlikely(*(SSL_CTX* volatile*)&rctx->new_ssl_ctx != NULL))
+		h2ow__switch_ssl_ctx(rctx);
+
 	// create an h2o_socket which is a wrapper for h2o's internals for sockets
-	sock = h2o_uv_socket_create((uv_stream_t*)conn, h2ow__on_close);
-	// and add the socket to the h2o context via the accept context (figure out which
-	// context by getting the idx of the current listener in rctx->listeners)
-	int ctx_idx = (uv_tcp_t*)listener - rctx->listeners;
-	h2o_accept(&rctx->accept_ctxs[ctx_idx], sock);
+	h2o_socket_t* sock = h2o_uv_socket_create((uv_stream_t*)conn, h2ow__on_close);
+	// and add the socket to the h2o context via the accept context
+	h2o_accept(&rctx->accept_ctxs[ssl ? 1 : 0], sock);
 
-	// if we get here, we established a new connection; increment the connection counter
+	// if we get here, we established a new connection; increment the connection counters
 	rctx->num_connections++;
+	__sync_fetch_and_add(&rctx->wctx->num_connections, 1);
+}
+
+static void accept_connection(h2ow_run_context* rctx, uv_stream_t* listener) {
+	uv_tcp_and_data* conn = new_connection(rctx, listener);
+	if (unlikely(conn == NULL))
+		return;
+
+	if (rctx->wctx->settings.reuseport_steering)
+		h2ow__check_steering(rctx, (uv_tcp_t*)conn);
+
+	// the listener knows which accept context to use
+	h2ow__add_connection(rctx, conn, ((h2ow_listener*)listener)->addr->ssl);
+}
+
+static void shed_connection(h2ow_run_context* rctx, uv_stream_t* listener) {
+	uv_tcp_and_data* conn = new_connection(rctx, listener);
+	if (unlikely(conn == NULL))
+		return;
+
+	// an accepted tcp handle always has an fd, and sending to -1 just fails
+	uv_os_fd_t fd = -1;
+	uv_fileno((uv_handle_t*)conn, &fd);
+	h2ow__shed_socket(rctx, fd, ((h2ow_listener*)listener)->addr->ssl);
+
+	uv_close((uv_handle_t*)conn, h2ow__on_unused_close);
+}
+
+static void try_resume(h2ow_run_context* rctx) {
+	if (rctx->paused_listeners == 0 || !rctx->wctx->is_running || !may_accept(rctx, 1))
+		return;
+
+	rctx->paused_listeners = 0;
+	uv_timer_stop(&rctx->resume_timer);
+
+	// accepting the pending connection makes libuv poll the listener again
+	for (int i = 0; i < rctx->num_listeners; i++) {
+		h2ow_listener* listener = &rctx->listeners[i];
+
+		if (listener->paused) {
+			listener->paused = 0;
+			accept_connection(rctx, (uv_stream_t*)&listener->handle);
+		}
+	}
+}
+
+static void on_resume_timer(uv_timer_t* timer) {
+	try_resume(timer->data);
+}
+
+static void pause_accepting(h2ow_run_context* rctx, uv_stream_t* listener) {
+	h2ow_settings* settings = &rctx->wctx->settings;
+
+	if (!((h2ow_listener*)listener)->paused) {
+		((h2ow_listener*)listener)->paused = 1;
+		rctx->paused_listeners++;
+	}
+
+	// the timer is only created once we need it; h2ow__on_signal closes it if its
+	// data is set
+	if (rctx->resume_timer.data == NULL) {
+		if (uv_timer_init(&rctx->loop, &rctx->resume_timer) < 0) {
+			H2OW_WARN("couldn't create timer; only closing connections on this thread "
+			          "will resume accepting\n");
+			return;
+		}
+		rctx->resume_timer.data = rctx;
+	}
+
+	if (!uv_is_active((uv_handle_t*)&rctx->resume_timer))
+		uv_timer_start(&rctx->resume_timer, on_resume_timer, RESUME_INTERVAL,
+		               RESUME_INTERVAL);
+}
+
+void h2ow__on_close(uv_handle_t* conn) {
+	// this is called when a socket is closed; decrement the connections counters
+	h2ow_run_context* rctx = ((uv_tcp_and_data*)conn)->more_data;
+	rctx->num_connections--;
+	__sync_fetch_and_sub(&rctx->wctx->num_connections, 1);
+
+	h2ow__conn_pool_put(&rctx->conn_pool, (uv_tcp_and_data*)conn);
+
+	// we're shutting down, and this was the last connection
+	if (unlikely(rctx->drain_timer != NULL && rctx->num_connections == 0)) {
+		h2ow_settings* settings = &rctx->wctx->settings;
+		H2OW_NOTE("All connections closed, stopping the loop\n");
+
+		finish_draining(rctx);
+		return;
+	}
+
+	if (rctx->wctx->settings.accept_model == H2OW_ACCEPT_SHARED)
+		h2ow__wake_acceptor(rctx);
+	else
+		try_resume(rctx);
+}
+
+void h2ow__on_accept(uv_stream_t* listener, int status) {
+	h2ow_run_context* rctx = listener->data;
+
+	if (unlikely(!rctx->wctx->is_running)) {
+		return;
+	}
+
+	if (unlikely(status != 0)) {
+		h2ow__count_accept_error(rctx, status);
+		return;
+	}
+
+	if (unlikely(!may_accept(rctx, 0))) {
+		if (rctx->wctx->settings.overload_503)
+			shed_connection(rctx, listener);
+		else
+			pause_accepting(rctx, listener);
+		return;
+	}
+
+	accept_connection(rctx, listener);
 }
 
 void* h2ow__per_thread_loop(void* arg) {
 	thread_data* data = arg;
 	h2ow_context* wctx = data->wctx;
-	h2ow_run_context* rctx = &wctx->run_contexts[data->idx];
+	h2ow_run_context* rctx = wctx->run_contexts[data->idx];
 
 	uv_run(&rctx->loop, UV_RUN_DEFAULT);
 
@@ -191,6 +416,33 @@ static int method_to_num(const char* method, int len) {
 	}
 }
 
+// build the value of an Allow header for the given methods
+static h2o_iovec_t allowed_methods_header(h2o_req_t* req, int methods) {
+	// same order as the bits of the H2OW_METHOD_* defines
+	static const char* names[H2OW_NUM_METHODS] = { "GET",     "POST",   "HEAD",
+		                                           "PUT",     "DELETE", "OPTIONS",
+		                                           "CONNECT", "PATCH",  "TRACE" };
+
+	// all names with ", " between them fit into 64 bytes
+	char* buf = h2o_mem_alloc_shared(&req->pool, 64, NULL);
+	size_t len = 0;
+
+	for (int i = 0; i < H2OW_NUM_METHODS; i++) {
+		if (!(methods & (1 << i)))
+			continue;
+
+		if (len > 0) {
+			memcpy(buf + len, ", ", 2);
+			len += 2;
+		}
+
+		memcpy(buf + len, names[i], strlen(names[i]));
+		len += strlen(names[i]);
+	}
+
+	return h2o_iovec_init(buf, len);
+}
+
 // determine whether logging the string is ok or could cause problems
 // (this should eventually be moved to a logging.c file when we get more
 // sophisticated logging, see TODOs in settings.h)
@@ -208,6 +460,12 @@ int h2ow__request_handler(h2o_handler_t* self, h2o_req_t* req) {
 	h2ow_run_context* rctx = tmp->more_data;
 	h2ow_settings* settings = &rctx->wctx->settings;
 
+	// count the request as in flight until its pool is cleared (see stop_loop)
+	h2ow_run_context** inflight
+	        = h2o_mem_alloc_shared(&req->pool, sizeof(*inflight), on_request_dispose);
+	*inflight = rctx;
+	rctx->num_inflight++;
+
 	int method = method_to_num(req->method.base, req->method.len);
 
 	if (unlikely(method == -1)) {
@@ -222,18 +480,36 @@ int h2ow__request_handler(h2o_handler_t* self, h2o_req_t* req) {
 		return 0;
 	}
 
-	char null_terminated_path[req->path.len + 1];
-	memcpy(null_terminated_path, req->path.base, req->path.len);
-	null_terminated_path[req->path.len] = '\0';
+	h2ow_route_match match;
+	h2ow_request_handler* handler = h2ow__cached_find_matching_handler(
+	        &rctx->route_cache, &rctx->wctx->handlers, req->path.base, req->path.len,
+	        method, &req->pool, &match);
 
-	h2ow_request_handler* handler = h2ow__find_matching_handler(
-	        &rctx->wctx->handlers, null_terminated_path, method);
+	// there are handlers for the path, just not for this method
+	if (unlikely(handler == NULL && match.allowed_methods != 0)) {
+		H2OW_NOTE("Responding with 405 to a request with a method that isn't allowed\n");
+
+		h2o_iovec_t allow = allowed_methods_header(req, match.allowed_methods);
+
+		req->res.status = 405;
+		req->res.reason = "Method Not Allowed";
+		h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ALLOW, NULL, allow.base,
+		               allow.len);
+		h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+		               H2O_STRLIT("text/plain"));
+		h2o_send_inline(req, H2O_STRLIT("method not allowed :("));
+
+		return 0;
+	}
 
 	if (unlikely(handler == NULL)) {
-		H2OW_NOTE("Sending 404 for a request to %s\n",
-		          is_string_safe(null_terminated_path, req->path.len) ?
-		                  null_terminated_path :
-		                  "<contains unsafe characters>");
+		if (is_string_safe(req->path.base, req->path.len)) {
+			H2OW_NOTE("Sending 404 for a request to %.*s\n", (int)req->path.len,
+			          req->path.base);
+		}
+		else {
+			H2OW_NOTE("Sending 404 for a request to <contains unsafe characters>\n");
+		}
 
 		req->res.status = 404;
 		req->res.reason = "Not Found";
@@ -244,7 +520,24 @@ int h2ow__request_handler(h2o_handler_t* self, h2o_req_t* req) {
 		return 0;
 	}
 
-	handler->handler(req, rctx);
+	// if there are streaming handlers, h2o calls us before the body is complete, and
+	// other handlers have to wait for the rest of it (see body-stream.c)
+	if (req->proceed_req != NULL && handler->call_type != H2OW_HANDLER_STREAMING) {
+		if (unlikely(h2ow__buffer_body(req, rctx, handler, &match) < 0)) {
+			req->res.status = 500;
+			req->res.reason = "Internal Server Error";
+			h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+			               H2O_STRLIT("text/plain"));
+			h2o_send_inline(req, H2O_STRLIT("out of memory"));
+		}
+
+		return 0;
+	}
+
+	if (handler->call_type == H2OW_HANDLER_CAPTURES)
+		handler->capture_handler(req, rctx, match.captures, match.num_captures);
+	else
+		handler->handler(req, rctx);
 
 	return 0;
 }
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include <unistd.h>
 
@@ -23,8 +24,57 @@ void h2ow_set_defaults(h2ow_context* wctx) {
 	settings->ssl_ctx = NULL;
 	settings->ssl_port = 8443;
 
+	settings->num_hosts = 0;
+
+	settings->manage_tickets = 0;
+	settings->ticket_key_path = NULL;
+	settings->ticket_rotation_secs = 0;
+	settings->session_cache_size = 0;
+	settings->key_privsep = 0;
+	settings->ssl_reload_signal = 0;
+
+	settings->body_window = 64 * 1024;
+
+	settings->route_cache_size = 0;
+
+	settings->conn_pool_prealloc = 0;
+	settings->conn_pool_max_free = 256;
+
+	settings->max_connections_per_thread = 0;
+	settings->max_connections = 0;
+	settings->resume_percent = 90;
+	settings->overload_503 = 0;
+
+	settings->pin_threads = 0;
+	settings->cpus = NULL;
+	settings->num_cpus = 0;
+
+	settings->reuseport_steering = 0;
+	settings->accept_model = H2OW_ACCEPT_REUSEPORT;
+
+	settings->listen_backlog = 128;
+	settings->tcp_defer_accept = 0;
+	settings->tcp_fastopen = 0;
+
+	settings->upgrade_signal = 0;
+
 	wctx->is_running = 0;
+	wctx->num_connections = 0;
+	wctx->num_cut_off_requests = 0;
 	wctx->ssl_ctx = NULL;
+	memset(&wctx->tls, 0, sizeof(wctx->tls));
+	pthread_rwlock_init(&wctx->tls.keys_lock, NULL);
+	wctx->listen_addrs = NULL;
+	wctx->num_listen_addrs = 0;
+	wctx->inherited_fds = NULL;
+	wctx->num_inherited_fds = 0;
+	wctx->ready_fd = -1;
+	wctx->exe_path = NULL;
+	wctx->run_contexts = NULL;
+	wctx->threads = NULL;
+	pthread_mutex_init(&wctx->stats_lock, NULL);
+	wctx->thread_stats = NULL;
+	wctx->num_thread_stats = 0;
 }
 
 void h2ow_setopt(h2ow_context* wctx, int setting, ...) {
@@ -65,6 +115,19 @@ void h2ow_setopt(h2ow_context* wctx, int setting, ...) {
 		break;
 	}
 
+	case H2OW_ADD_HOST: {
+		const char* addr = va_arg(args, const char*);
+		int port = va_arg(args, int);
+		int ssl = va_arg(args, int);
+		if (settings->num_hosts == H2OW_MAX_HOSTS) {
+			H2OW_WARN("ignoring host %s, since there are already %d\n", addr,
+			          H2OW_MAX_HOSTS);
+			break;
+		}
+		settings->hosts[settings->num_hosts++] = (h2ow_host){ addr, port, ssl };
+		break;
+	}
+
 	case H2OW_SSL_CERT_AND_KEY: {
 		const char* cert_path = va_arg(args, const char*);
 		const char* key_path = va_arg(args, const char*);
@@ -85,6 +148,123 @@ void h2ow_setopt(h2ow_context* wctx, int setting, ...) {
 		break;
 	}
 
+	case H2OW_ROUTE_CACHE_SIZE: {
+		int size = va_arg(args, int);
+		settings->route_cache_size = size;
+		break;
+	}
+
+	case H2OW_CONN_POOL: {
+		int prealloc = va_arg(args, int);
+		int max_free = va_arg(args, int);
+		settings->conn_pool_prealloc = prealloc;
+		settings->conn_pool_max_free = max_free;
+		break;
+	}
+
+	case H2OW_MAX_CONNECTIONS: {
+		int per_thread = va_arg(args, int);
+		int total = va_arg(args, int);
+		settings->max_connections_per_thread = per_thread;
+		settings->max_connections = total;
+		break;
+	}
+
+	case H2OW_RESUME_PERCENT: {
+		int percent = va_arg(args, int);
+		if (percent < 0 || percent > 100) {
+			H2OW_WARN("ignoring resume percentage %d, which isn't in [0, 100]\n",
+			          percent);
+			break;
+		}
+		settings->resume_percent = percent;
+		break;
+	}
+
+	case H2OW_OVERLOAD_503: {
+		int enabled = va_arg(args, int);
+		settings->overload_503 = enabled;
+		break;
+	}
+
+	case H2OW_CPU_AFFINITY: {
+		const int* cpus = va_arg(args, const int*);
+		int num_cpus = va_arg(args, int);
+		settings->pin_threads = 1;
+		settings->cpus = cpus;
+		settings->num_cpus = num_cpus;
+		break;
+	}
+
+	case H2OW_REUSEPORT_STEERING: {
+		int enabled = va_arg(args, int);
+		settings->reuseport_steering = enabled;
+		break;
+	}
+
+	case H2OW_ACCEPT_MODEL: {
+		int model = va_arg(args, int);
+		settings->accept_model = model;
+		break;
+	}
+
+	case H2OW_UPGRADE_SIGNAL: {
+		int signum = va_arg(args, int);
+		settings->upgrade_signal = signum;
+		break;
+	}
+
+	case H2OW_LISTEN_BACKLOG: {
+		int backlog = va_arg(args, int);
+		settings->listen_backlog = backlog;
+		break;
+	}
+
+	case H2OW_TCP_DEFER_ACCEPT: {
+		int secs = va_arg(args, int);
+		settings->tcp_defer_accept = secs;
+		break;
+	}
+
+	case H2OW_TCP_FASTOPEN: {
+		int qlen = va_arg(args, int);
+		settings->tcp_fastopen = qlen;
+		break;
+	}
+
+	case H2OW_SSL_TICKET_KEYS: {
+		const char* path = va_arg(args, const char*);
+		int rotation_secs = va_arg(args, int);
+		settings->manage_tickets = 1;
+		settings->ticket_key_path = path;
+		settings->ticket_rotation_secs = rotation_secs;
+		break;
+	}
+
+	case H2OW_SSL_SESSION_CACHE: {
+		int size = va_arg(args, int);
+		settings->session_cache_size = size;
+		break;
+	}
+
+	case H2OW_SSL_KEY_PRIVSEP: {
+		int enabled = va_arg(args, int);
+		settings->key_privsep = enabled;
+		break;
+	}
+
+	case H2OW_SSL_RELOAD_SIGNAL: {
+		int signum = va_arg(args, int);
+		settings->ssl_reload_signal = signum;
+		break;
+	}
+
+	case H2OW_BODY_WINDOW: {
+		int size = va_arg(args, int);
+		settings->body_window = size > 0 ? size : 0;
+		break;
+	}
+
 	default: {
 		H2OW_WARN("ignoring unknown setting with number %d\n", setting);
 		break;
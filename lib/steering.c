@@ -0,0 +1,97 @@
+#include "h2ow/steering.h"
+#include "h2ow/run-setup.h"
+
+#include <stdlib.h>
+
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+/* every thread has its own listener in the same SO_REUSEPORT group, and the kernel
+ * usually picks one of them by hashing the addresses of a new connection. with
+ * H2OW_REUSEPORT_STEERING, we instead attach a classic bpf program to the group
+ * which looks at the cpu that received the connection and returns the index of the
+ * listener of the thread pinned to that cpu. listeners are indexed in the order
+ * they were added to the group, which is the order of the threads since they are
+ * set up one after another. if no thread is pinned to the cpu, the program returns
+ * cpu % num_threads.
+ *
+ * threads count connections that were received on another cpu than theirs, so the
+ * misrouted counters should stay close to 0 if the steering works. they are kept per
+ * thread, so a thread whose cpu doesn't match its place in the group stands out.
+ */
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#	define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+#ifndef SO_INCOMING_CPU
+#	define SO_INCOMING_CPU 49
+#endif
+
+int h2ow__attach_steering_prog(h2ow_context* wctx, int fd) {
+	int num_threads = wctx->settings.thread_count;
+
+	// load the cpu, compare it to the cpu of every thread, fall back to the modulo
+	int len = 2 * num_threads + 3;
+	if (len > BPF_MAXINSNS)
+		return -1;
+
+	struct sock_filter* code = malloc(len * sizeof(*code));
+	if (code == NULL)
+		return -1;
+
+	int pc = 0;
+	code[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+	                                          SKF_AD_OFF + SKF_AD_CPU);
+
+	for (int i = 0; i < num_threads; i++) {
+		int cpu = wctx->run_contexts[i]->cpu;
+
+		// a thread that isn't pinned never matches, since cpus aren't negative
+		code[pc++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		                                          (uint32_t)cpu, 0, 1);
+		code[pc++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+	}
+
+	code[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num_threads);
+	code[pc++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+	struct sock_fprog prog = { .len = pc, .filter = code };
+	int ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+
+	free(code);
+	return ret == 0 ? 0 : -1;
+}
+
+void h2ow__check_steering(h2ow_run_context* rctx, uv_tcp_t* conn) {
+	uv_os_fd_t fd;
+	int cpu;
+	socklen_t len = sizeof(cpu);
+
+	if (rctx->cpu < 0 || uv_fileno((uv_handle_t*)conn, &fd) != 0
+	    || getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) != 0)
+	{
+		return;
+	}
+
+	rctx->num_steering_checks++;
+	if (cpu != rctx->cpu)
+		rctx->num_misrouted++;
+}
+
+void h2ow_get_steering_stats(h2ow_context* wctx, uint64_t* checked, uint64_t* misrouted,
+                             uint64_t* per_thread) {
+	int max = wctx->settings.thread_count > 0 ? wctx->settings.thread_count : 1;
+	h2ow_thread_stats stats[max];
+	int num = h2ow__get_thread_stats(wctx, stats, max);
+
+	*checked = 0;
+	*misrouted = 0;
+
+	for (int i = 0; i < num; i++) {
+		if (per_thread != NULL)
+			per_thread[i] = stats[i].misrouted;
+		*checked += stats[i].steering_checks;
+		*misrouted += stats[i].misrouted;
+	}
+}
@@ -0,0 +1,740 @@
+#include "h2ow/tls.h"
+#include "h2ow/settings.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include <neverbleed.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#	include <openssl/core_names.h>
+#else
+#	include <openssl/hmac.h>
+#endif
+
+/* since all threads share one SSL_CTX, but the kernel spreads reconnects over all
+ * of them (and possibly over several processes behind the same address), we take
+ * over two things from openssl:
+ *
+ * session tickets are encrypted with keys that we manage. they're either read from
+ * a file (in the 80 byte format nginx uses; the first key encrypts, the others only
+ * decrypt), so that several processes can share them, or generated randomly. every
+ * settings->ticket_rotation_secs, the first thread either reads the file again or
+ * generates a new key and keeps the last few ones for decrypting.
+ *
+ * with settings->session_cache_size, sessions are also cached by us instead of by
+ * openssl, in a table that is split into shards with their own locks, so that
+ * threads resuming different sessions don't wait for each other. when a shard is
+ * full, its oldest session is thrown out.
+ *
+ * either way, we count completed handshakes and how many of them were resumed.
+ *
+ * with settings->key_privsep, the private key is loaded by neverbleed (from h2o's
+ * deps), which forks a helper process that keeps the key and does all signing and
+ * decryption for us over a unix socket, so a memory disclosure bug in our process
+ * can't leak the key. this is only about isolation: the loop still waits for every
+ * key operation, which now also takes a round trip to the helper, so handshakes get
+ * a little slower rather than faster. the helper is started once per process,
+ * before any loop threads exist.
+ *
+ * h2ow_reload_ssl (or settings->ssl_reload_signal) creates a new context from the
+ * cert and key files, without blocking any loop, and hands it to every thread
+ * through rctx->new_ssl_ctx. each thread switches to it when it accepts its next
+ * tls connection, so handshakes never wait for a reload. every thread holds its
+ * own reference to the context it uses, and every SSL object holds one to the
+ * context it was created from, so old contexts are freed once the last thread
+ * switched away from them and the last connection using them is closed. ticket
+ * keys and the session cache belong to wctx, so sessions survive reloads.
+ */
+
+static int ex_data_idx = -1;
+static int counted_idx = -1;
+
+static h2ow_context* ctx_to_wctx(SSL_CTX* ctx) {
+	return SSL_CTX_get_ex_data(ctx, ex_data_idx);
+}
+
+static h2ow_context* ssl_to_wctx(const SSL* ssl) {
+	return ctx_to_wctx(SSL_get_SSL_CTX(ssl));
+}
+
+/* ================ TICKET KEYS ================ */
+
+// read up to H2OW_MAX_TICKET_KEYS keys from path (ignoring the rest). returns the
+// number read, or -1 if the file doesn't contain a whole number of keys
+static int read_ticket_keys(const char* path, h2ow_ticket_key* keys) {
+	FILE* f = fopen(path, "rb");
+	struct stat st;
+
+	if (f == NULL)
+		return -1;
+
+	if (fstat(fileno(f), &st) == -1 || st.st_size == 0
+	    || st.st_size % sizeof(*keys) != 0)
+	{
+		fclose(f);
+		return -1;
+	}
+
+	size_t num_keys = st.st_size / sizeof(*keys);
+	if (num_keys > H2OW_MAX_TICKET_KEYS)
+		num_keys = H2OW_MAX_TICKET_KEYS;
+
+	num_keys = fread(keys, sizeof(*keys), num_keys, f);
+	fclose(f);
+
+	return num_keys > 0 ? (int)num_keys : -1;
+}
+
+static int generate_ticket_key(h2ow_ticket_key* key) {
+	return RAND_bytes((unsigned char*)key, sizeof(*key)) == 1 ? 0 : -1;
+}
+
+static void rotate_ticket_keys(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+	h2ow_tls_state* tls = &wctx->tls;
+	h2ow_ticket_key keys[H2OW_MAX_TICKET_KEYS];
+	int num_keys;
+
+	if (settings->ticket_key_path != NULL) {
+		num_keys = read_ticket_keys(settings->ticket_key_path, keys);
+		if (num_keys < 0) {
+			H2OW_WARN("couldn't read ticket keys from %s, keeping the old ones\n",
+			          settings->ticket_key_path);
+			return;
+		}
+	}
+	else {
+		if (generate_ticket_key(&keys[0]) < 0) {
+			H2OW_WARN("couldn't generate a new ticket key, keeping the old ones\n");
+			return;
+		}
+
+		// the old ones still decrypt tickets until they fall off the end
+		num_keys = tls->num_keys < H2OW_MAX_TICKET_KEYS ? tls->num_keys + 1
+		                                                : H2OW_MAX_TICKET_KEYS;
+		memcpy(&keys[1], tls->keys, (num_keys - 1) * sizeof(*keys));
+	}
+
+	pthread_rwlock_wrlock(&tls->keys_lock);
+	memcpy(tls->keys, keys, num_keys * sizeof(*keys));
+	tls->num_keys = num_keys;
+	pthread_rwlock_unlock(&tls->keys_lock);
+
+	OPENSSL_cleanse(keys, sizeof(keys));
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX hmac_ctx_t;
+
+static int init_hmac(hmac_ctx_t* hctx, unsigned char* key) {
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key, 32),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0),
+		OSSL_PARAM_construct_end(),
+	};
+	return EVP_MAC_CTX_set_params(hctx, params);
+}
+#else
+typedef HMAC_CTX hmac_ctx_t;
+
+static int init_hmac(hmac_ctx_t* hctx, unsigned char* key) {
+	return HMAC_Init_ex(hctx, key, 32, EVP_sha256(), NULL);
+}
+#endif
+
+// returns 1 if the ticket was encrypted or decrypted using the current key, 2 if it
+// was decrypted with an old key (so openssl issues a new one), 0 if we don't know
+// the key of the ticket and -1 on error
+static int on_ticket_key(SSL* ssl, unsigned char* name, unsigned char* iv,
+                         EVP_CIPHER_CTX* cctx, hmac_ctx_t* hctx, int enc) {
+	h2ow_tls_state* tls = &ssl_to_wctx(ssl)->tls;
+	int ret = 0;
+
+	pthread_rwlock_rdlock(&tls->keys_lock);
+
+	if (enc) {
+		h2ow_ticket_key* key = &tls->keys[0];
+
+		memcpy(name, key->name, sizeof(key->name));
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1
+		    || !EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv)
+		    || !init_hmac(hctx, key->hmac_key))
+		{
+			ret = -1;
+		}
+		else {
+			ret = 1;
+		}
+	}
+	else {
+		for (int i = 0; i < tls->num_keys; i++) {
+			h2ow_ticket_key* key = &tls->keys[i];
+
+			if (memcmp(name, key->name, sizeof(key->name)) != 0)
+				continue;
+
+			if (!init_hmac(hctx, key->hmac_key)
+			    || !EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv))
+			{
+				ret = -1;
+			}
+			else {
+				// tls 1.3 clients shouldn't reuse tickets, and openssl only sends
+				// them a new one if we ask for it
+				ret = i == 0 && SSL_version(ssl) < TLS1_3_VERSION ? 1 : 2;
+			}
+			break;
+		}
+	}
+
+	pthread_rwlock_unlock(&tls->keys_lock);
+	return ret;
+}
+
+static void on_ticket_timer(uv_timer_t* timer) {
+	h2ow_run_context* rctx = timer->data;
+	rotate_ticket_keys(rctx->wctx);
+}
+
+int h2ow__create_ticket_timer(h2ow_run_context* rctx) {
+	uint64_t interval = (uint64_t)rctx->wctx->settings.ticket_rotation_secs * 1000;
+
+	if (uv_timer_init(&rctx->loop, &rctx->ticket_timer) < 0)
+		return -1;
+
+	if (uv_timer_start(&rctx->ticket_timer, on_ticket_timer, interval, interval) < 0) {
+		uv_close((uv_handle_t*)&rctx->ticket_timer, NULL);
+		return -1;
+	}
+
+	rctx->ticket_timer.data = rctx;
+	return 0;
+}
+
+/* ================ SESSION CACHE ================ */
+
+static h2ow_session_shard* shard_for(h2ow_tls_state* tls, const unsigned char* id,
+                                     unsigned int id_len) {
+	// session ids are random, so any of their bytes make a fine hash
+	unsigned int hash = 0;
+	for (unsigned int i = 0; i < id_len && i < sizeof(hash); i++) {
+		hash = (hash << 8) | id[i];
+	}
+
+	return &tls->shards[hash % H2OW_SESSION_CACHE_SHARDS];
+}
+
+static void free_session(h2ow_session* session) {
+	OPENSSL_free(session->der);
+	free(session);
+}
+
+static int on_new_session(SSL* ssl, SSL_SESSION* sess) {
+	h2ow_tls_state* tls = &ssl_to_wctx(ssl)->tls;
+	unsigned int id_len;
+	const unsigned char* id = SSL_SESSION_get_id(sess, &id_len);
+
+	if (id_len == 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+		return 0;
+
+	h2ow_session* session = calloc(1, sizeof(*session));
+	if (session == NULL)
+		return 0;
+
+	session->der_len = i2d_SSL_SESSION(sess, &session->der);
+	if (session->der_len <= 0) {
+		free(session);
+		return 0;
+	}
+
+	memcpy(session->id, id, id_len);
+	session->id_len = id_len;
+	session->expires = SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess);
+
+	h2ow_session_shard* shard = shard_for(tls, id, id_len);
+	h2ow_session* old;
+
+	pthread_mutex_lock(&shard->lock);
+
+	HASH_FIND(hh, shard->sessions, id, id_len, old);
+	if (old != NULL) {
+		HASH_DELETE(hh, shard->sessions, old);
+		shard->num_sessions--;
+		free_session(old);
+	}
+	// uthash iterates in insertion order, so the first one is the oldest
+	else if (shard->num_sessions == tls->max_sessions_per_shard) {
+		old = shard->sessions;
+		HASH_DELETE(hh, shard->sessions, old);
+		shard->num_sessions--;
+		free_session(old);
+	}
+
+	HASH_ADD(hh, shard->sessions, id, id_len, session);
+	shard->num_sessions++;
+
+	pthread_mutex_unlock(&shard->lock);
+
+	// we didn't keep a reference to sess
+	return 0;
+}
+
+static SSL_SESSION* on_get_session(SSL* ssl, const unsigned char* id, int len,
+                                   int* copy) {
+	unsigned int id_len = len;
+	h2ow_tls_state* tls = &ssl_to_wctx(ssl)->tls;
+	h2ow_session_shard* shard = shard_for(tls, id, id_len);
+	h2ow_session* session;
+	SSL_SESSION* sess = NULL;
+
+	*copy = 0;
+
+	pthread_mutex_lock(&shard->lock);
+
+	HASH_FIND(hh, shard->sessions, id, id_len, session);
+	if (session != NULL) {
+		if (session->expires > (uint64_t)time(NULL)) {
+			const unsigned char* der = session->der;
+			sess = d2i_SSL_SESSION(NULL, &der, session->der_len);
+		}
+		else {
+			HASH_DELETE(hh, shard->sessions, session);
+			shard->num_sessions--;
+			free_session(session);
+		}
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	return sess;
+}
+
+static void on_remove_session(SSL_CTX* ctx, SSL_SESSION* sess) {
+	h2ow_tls_state* tls = &ctx_to_wctx(ctx)->tls;
+	unsigned int id_len;
+	const unsigned char* id = SSL_SESSION_get_id(sess, &id_len);
+	h2ow_session_shard* shard = shard_for(tls, id, id_len);
+	h2ow_session* session;
+
+	pthread_mutex_lock(&shard->lock);
+
+	HASH_FIND(hh, shard->sessions, id, id_len, session);
+	if (session != NULL) {
+		HASH_DELETE(hh, shard->sessions, session);
+		shard->num_sessions--;
+		free_session(session);
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static void free_session_cache(h2ow_tls_state* tls) {
+	if (tls->shards == NULL)
+		return;
+
+	for (int i = 0; i < H2OW_SESSION_CACHE_SHARDS; i++) {
+		h2ow_session_shard* shard = &tls->shards[i];
+		h2ow_session *session, *tmp;
+
+		HASH_ITER(hh, shard->sessions, session, tmp) {
+			HASH_DELETE(hh, shard->sessions, session);
+			free_session(session);
+		}
+		pthread_mutex_destroy(&shard->lock);
+	}
+
+	free(tls->shards);
+	tls->shards = NULL;
+}
+
+static int init_session_cache(h2ow_tls_state* tls, int size) {
+	tls->shards = aligned_alloc(H2OW_CACHE_LINE,
+	                            H2OW_SESSION_CACHE_SHARDS * sizeof(*tls->shards));
+	if (tls->shards == NULL)
+		return -1;
+
+	tls->max_sessions_per_shard = (size + H2OW_SESSION_CACHE_SHARDS - 1)
+	                              / H2OW_SESSION_CACHE_SHARDS;
+
+	for (int i = 0; i < H2OW_SESSION_CACHE_SHARDS; i++) {
+		pthread_mutex_init(&tls->shards[i].lock, NULL);
+		tls->shards[i].sessions = NULL;
+		tls->shards[i].num_sessions = 0;
+	}
+
+	return 0;
+}
+
+/* ================ STATS ================ */
+
+static void on_ssl_info(const SSL* ssl, int where, int ret) {
+	(void)ret;
+
+	// tls 1.3 signals this again after sending tickets, so only count it once
+	if (!(where & SSL_CB_HANDSHAKE_DONE) || SSL_get_ex_data(ssl, counted_idx) != NULL)
+		return;
+
+	SSL_set_ex_data((SSL*)ssl, counted_idx, (void*)1);
+
+	h2ow_tls_state* tls = &ssl_to_wctx(ssl)->tls;
+	__sync_fetch_and_add(&tls->num_handshakes, 1);
+	if (SSL_session_reused((SSL*)ssl))
+		__sync_fetch_and_add(&tls->num_resumed, 1);
+}
+
+void h2ow_get_tls_stats(h2ow_context* wctx, uint64_t* handshakes, uint64_t* resumed) {
+	*handshakes = __sync_fetch_and_add(&wctx->tls.num_handshakes, 0);
+	*resumed = __sync_fetch_and_add(&wctx->tls.num_resumed, 0);
+}
+
+/* ================ SETUP ================ */
+
+static int load_privsep_key(h2ow_context* wctx, SSL_CTX* ctx) {
+	const h2ow_settings* settings = &wctx->settings;
+	static neverbleed_t* neverbleed = NULL;
+	char errbuf[NEVERBLEED_ERRBUF_SIZE];
+
+	if (neverbleed == NULL) {
+		neverbleed_t* nb = malloc(sizeof(*nb));
+		if (nb == NULL) {
+			H2OW_ERR("not enough memory to start the private key helper\n");
+			return -1;
+		}
+
+		if (neverbleed_init(nb, errbuf) != 0) {
+			H2OW_ERR("couldn't start the private key helper: %s\n", errbuf);
+			free(nb);
+			return -1;
+		}
+
+		// the helper lives as long as we do
+		neverbleed = nb;
+	}
+
+	const char* path = settings->ssl_key_path;
+	if (neverbleed_load_private_key_file(neverbleed, ctx, path, errbuf) != 1) {
+		H2OW_ERR("couldn't load the private key in the helper: %s\n", errbuf);
+		return -1;
+	}
+
+	return 0;
+}
+
+SSL_CTX* h2ow__create_ssl_ctx(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+	SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+
+	// sorry for the looks of this but this is what clang-format wants it to look
+	// like and its still better than doing a million seperate ifs
+	if (ctx == NULL
+	    || SSL_CTX_use_certificate_chain_file(ctx, settings->ssl_cert_path) != 1
+	    || (!settings->key_privsep
+	        && SSL_CTX_use_PrivateKey_file(ctx, settings->ssl_key_path, SSL_FILETYPE_PEM)
+	                   != 1))
+	{
+		unsigned int err = ERR_get_error();
+		H2OW_ERR("couldn't create ssl context because %s failed: %s\n",
+		         ERR_func_error_string(err), ERR_reason_error_string(err));
+
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+
+	// the key is only loaded by the helper process
+	if (settings->key_privsep && load_privsep_key(wctx, ctx) < 0) {
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+
+#if H2O_USE_NPN
+	h2o_ssl_register_npn_protocols(ctx, h2o_http2_npn_protocols);
+#endif
+#if H2O_USE_ALPN
+	h2o_ssl_register_alpn_protocols(ctx, h2o_http2_alpn_protocols);
+#endif
+
+	return ctx;
+}
+
+// point ctx at our callbacks; wctx->tls has to be set up already
+static int configure_ssl_ctx(h2ow_context* wctx, SSL_CTX* ctx) {
+	const h2ow_settings* settings = &wctx->settings;
+
+	if (!SSL_CTX_set_ex_data(ctx, ex_data_idx, wctx)) {
+		H2OW_ERR("couldn't attach our data to the ssl context\n");
+		return -1;
+	}
+
+	SSL_CTX_set_info_callback(ctx, on_ssl_info);
+
+	if (settings->manage_tickets) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, on_ticket_key);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, on_ticket_key);
+#endif
+	}
+
+	if (wctx->tls.shards != NULL) {
+		long mode = SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL;
+		SSL_CTX_set_session_cache_mode(ctx, mode);
+		SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+		SSL_CTX_sess_set_get_cb(ctx, on_get_session);
+		SSL_CTX_sess_set_remove_cb(ctx, on_remove_session);
+	}
+
+	return 0;
+}
+
+int h2ow__init_tls(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+	h2ow_tls_state* tls = &wctx->tls;
+	SSL_CTX* ctx = wctx->ssl_ctx;
+
+	tls->num_keys = 0;
+	tls->shards = NULL;
+	tls->num_handshakes = 0;
+	tls->num_resumed = 0;
+
+	if (ctx == NULL)
+		return 0;
+
+	// the indices are process-wide, and openssl is initialized once anyway
+	if (ex_data_idx == -1) {
+		ex_data_idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+		counted_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	}
+	if (ex_data_idx == -1 || counted_idx == -1) {
+		H2OW_ERR("couldn't attach our data to the ssl context\n");
+		return -1;
+	}
+
+	if (settings->manage_tickets) {
+		if (settings->ticket_key_path != NULL) {
+			tls->num_keys = read_ticket_keys(settings->ticket_key_path, tls->keys);
+			if (tls->num_keys < 0) {
+				H2OW_ERR("couldn't read ticket keys from %s, which needs to consist "
+				         "of 80 byte keys\n",
+				         settings->ticket_key_path);
+				return -1;
+			}
+		}
+		else {
+			if (generate_ticket_key(&tls->keys[0]) < 0) {
+				H2OW_ERR("couldn't generate a ticket key\n");
+				return -1;
+			}
+			tls->num_keys = 1;
+		}
+	}
+
+	if (settings->session_cache_size > 0
+	    && init_session_cache(tls, settings->session_cache_size) < 0)
+	{
+		H2OW_ERR("not enough memory for the session cache\n");
+		return -1;
+	}
+
+	return configure_ssl_ctx(wctx, ctx);
+}
+
+void h2ow__free_tls(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+	h2ow_tls_state* tls = &wctx->tls;
+	SSL_CTX* ctx = wctx->ssl_ctx;
+
+	// a user-provided ssl context might outlive us, so it shouldn't call us anymore
+	if (ctx != NULL && ex_data_idx != -1 && ctx_to_wctx(ctx) == wctx) {
+		SSL_CTX_set_info_callback(ctx, NULL);
+
+		if (settings->manage_tickets) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, NULL);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(ctx, NULL);
+#endif
+		}
+
+		if (tls->shards != NULL) {
+			SSL_CTX_sess_set_new_cb(ctx, NULL);
+			SSL_CTX_sess_set_get_cb(ctx, NULL);
+			SSL_CTX_sess_set_remove_cb(ctx, NULL);
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		}
+
+		SSL_CTX_set_ex_data(ctx, ex_data_idx, NULL);
+	}
+
+	free_session_cache(tls);
+
+	OPENSSL_cleanse(tls->keys, sizeof(tls->keys));
+	tls->num_keys = 0;
+}
+
+/* ================ RELOADING ================ */
+
+// serializes reloads, and reloads with the end of a run
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// hand ctx (whose reference we take over) to every thread
+static int publish_ssl_ctx(h2ow_context* wctx, SSL_CTX* ctx) {
+	pthread_mutex_lock(&reload_lock);
+
+	if (!wctx->is_running || wctx->run_contexts == NULL) {
+		pthread_mutex_unlock(&reload_lock);
+		SSL_CTX_free(ctx);
+		return -1;
+	}
+
+	for (int i = 0; i < wctx->settings.thread_count; i++) {
+		h2ow_run_context* rctx = wctx->run_contexts[i];
+
+		SSL_CTX_up_ref(ctx);
+		SSL_CTX* pending = __sync_lock_test_and_set(&rctx->new_ssl_ctx, ctx);
+		// the thread didn't accept a tls connection since the last reload
+		if (pending != NULL)
+			SSL_CTX_free(pending);
+	}
+
+	SSL_CTX* old = wctx->ssl_ctx;
+	wctx->ssl_ctx = ctx;
+	SSL_CTX_free(old);
+
+	pthread_mutex_unlock(&reload_lock);
+	return 0;
+}
+
+int h2ow_reload_ssl(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+
+	if (settings->ssl_ctx != NULL || settings->ssl_cert_path == NULL
+	    || settings->ssl_key_path == NULL)
+	{
+		H2OW_WARN("can only reload ssl contexts we created from a cert and a key\n");
+		return -1;
+	}
+
+	if (!wctx->is_running || wctx->ssl_ctx == NULL) {
+		H2OW_WARN("not reloading the ssl context, since the server isn't running\n");
+		return -1;
+	}
+
+	// this is the slow part, which happens without holding any lock
+	SSL_CTX* ctx = h2ow__create_ssl_ctx(wctx);
+	if (ctx == NULL)
+		return -1;
+
+	if (configure_ssl_ctx(wctx, ctx) < 0) {
+		SSL_CTX_free(ctx);
+		return -1;
+	}
+
+	if (publish_ssl_ctx(wctx, ctx) < 0) {
+		H2OW_WARN("not reloading the ssl context, since the server isn't running\n");
+		return -1;
+	}
+
+	H2OW_NOTE("reloaded the ssl context\n");
+	return 0;
+}
+
+void h2ow__switch_ssl_ctx(h2ow_run_context* rctx) {
+	SSL_CTX* ctx = __sync_lock_test_and_set(&rctx->new_ssl_ctx, NULL);
+	if (ctx == NULL)
+		return;
+
+	// SSL objects hold a reference to their context, so connections that were
+	// accepted with the old one can keep using it
+	SSL_CTX_free(rctx->accept_ctxs[1].ssl_ctx);
+	rctx->accept_ctxs[1].ssl_ctx = ctx;
+}
+
+void h2ow__release_ssl_ctxs(h2ow_context* wctx) {
+	pthread_mutex_lock(&reload_lock);
+
+	// keep reloads that are still running from publishing anything
+	wctx->is_running = 0;
+
+	// run contexts are zeroed when they are allocated, so this is fine even for
+	// the ones that never got an ssl context
+	for (int i = 0; wctx->run_contexts != NULL && i < wctx->settings.thread_count; i++) {
+		h2ow_run_context* rctx = wctx->run_contexts[i];
+
+		if (rctx->accept_ctxs[1].ssl_ctx != NULL)
+			SSL_CTX_free(rctx->accept_ctxs[1].ssl_ctx);
+		if (rctx->new_ssl_ctx != NULL)
+			SSL_CTX_free(rctx->new_ssl_ctx);
+
+		rctx->accept_ctxs[1].ssl_ctx = NULL;
+		rctx->new_ssl_ctx = NULL;
+	}
+
+	pthread_mutex_unlock(&reload_lock);
+}
+
+static void* reload_thread(void* arg) {
+	h2ow_run_context* rctx = arg;
+	int handled;
+
+	// signals that arrive while we're reloading only make us reload once more
+	do {
+		handled = __sync_fetch_and_add(&rctx->reload_requests, 0);
+		h2ow_reload_ssl(rctx->wctx);
+	} while (__sync_sub_and_fetch(&rctx->reload_requests, handled) != 0);
+
+	return NULL;
+}
+
+static void on_reload_signal(uv_signal_t* self, int signum) {
+	h2ow_run_context* rctx = self->data;
+	const h2ow_settings* settings = &rctx->wctx->settings;
+	(void)signum;
+
+	if (!rctx->wctx->is_running)
+		return;
+
+	// the thread is still running, and will pick this one up
+	if (__sync_fetch_and_add(&rctx->reload_requests, 1) != 0)
+		return;
+
+	// the last thread is done with its requests, so this doesn't block for long
+	h2ow__join_reload_thread(rctx);
+
+	// reading the certificate and the key would block the loop
+	if (pthread_create(&rctx->reload_thread, NULL, reload_thread, rctx) != 0) {
+		H2OW_WARN("couldn't start a thread to reload the ssl context\n");
+		rctx->reload_requests = 0;
+		return;
+	}
+	rctx->reload_thread_started = 1;
+}
+
+void h2ow__join_reload_thread(h2ow_run_context* rctx) {
+	if (!rctx->reload_thread_started)
+		return;
+
+	pthread_join(rctx->reload_thread, NULL);
+	rctx->reload_thread_started = 0;
+}
+
+int h2ow__create_reload_handler(h2ow_run_context* rctx) {
+	int signum = rctx->wctx->settings.ssl_reload_signal;
+
+	if (uv_signal_init(&rctx->loop, &rctx->reload_handler) < 0)
+		return -1;
+
+	if (uv_signal_start(&rctx->reload_handler, on_reload_signal, signum) < 0) {
+		uv_close((uv_handle_t*)&rctx->reload_handler, NULL);
+		return -1;
+	}
+
+	rctx->reload_handler.data = rctx;
+	return 0;
+}
@@ -0,0 +1,470 @@
+#define _GNU_SOURCE
+
+#include "h2ow/upgrade.h"
+#include "h2ow/runtime.h"
+#include "h2ow/settings.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* on settings->upgrade_signal (see H2OW_UPGRADE_SIGNAL), the server starts a new
+ * instance of its binary with the same arguments, passing the listening sockets of
+ * all threads in the H2OW_LISTEN_FDS environment variable. the binary is the file
+ * /proc/self/exe pointed to when h2ow_run started, and not /proc/self/exe itself,
+ * which keeps pointing to the old binary once a deploy renamed a new one over it.
+ *
+ * h2ow_run in the new process adopts the inherited sockets instead of creating new
+ * ones, matching them by address. since both processes share the same sockets,
+ * connections that arrive in the meantime just wait in the kernel's queue until
+ * the new process accepts them, while the old one drains its open connections.
+ * inherited sockets that aren't adopted (e.g. because the new process has fewer
+ * threads) are closed.
+ *
+ * the old process only shuts down (like on SIGTERM) once the new one wrote a byte
+ * to the pipe in H2OW_READY_FD, which it does when all its listeners exist. if the
+ * new process exits before that (because exec failed, or h2ow_run returned an
+ * error), the old one gets EOF instead, keeps serving, and can be upgraded again.
+ */
+
+extern char** environ;
+
+static void read_ready_fd(h2ow_context* wctx) {
+	const char* val = getenv(H2OW_READY_FD_ENV);
+	char* end;
+
+	wctx->ready_fd = -1;
+	if (val == NULL)
+		return;
+
+	long fd = strtol(val, &end, 10);
+	if (end != val && *end == '\0' && fd >= 0 && fd <= INT32_MAX
+	    && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0)
+	{
+		wctx->ready_fd = fd;
+	}
+
+	unsetenv(H2OW_READY_FD_ENV);
+}
+
+int h2ow__read_inherited_fds(h2ow_context* wctx) {
+	const char* list = getenv(H2OW_LISTEN_FDS_ENV);
+
+	wctx->inherited_fds = NULL;
+	wctx->num_inherited_fds = 0;
+
+	read_ready_fd(wctx);
+
+	if (list == NULL)
+		return 0;
+
+	int max_fds = 1;
+	for (const char* p = list; *p != '\0'; p++) {
+		if (*p == ',')
+			max_fds++;
+	}
+
+	wctx->inherited_fds = malloc(max_fds * sizeof(*wctx->inherited_fds));
+	if (wctx->inherited_fds == NULL)
+		return -1;
+
+	for (const char* p = list; *p != '\0';) {
+		char* end;
+		long fd = strtol(p, &end, 10);
+		h2ow_inherited_fd* entry = &wctx->inherited_fds[wctx->num_inherited_fds];
+
+		memset(&entry->addr, 0, sizeof(entry->addr));
+		entry->addr_len = sizeof(entry->addr);
+
+		// only take sockets that are what we'd create ourselves
+		if (end != p && fd >= 0 && fd <= INT32_MAX
+		    && getsockname(fd, (struct sockaddr*)&entry->addr, &entry->addr_len) == 0
+		    && (entry->addr.ss_family == AF_INET || entry->addr.ss_family == AF_INET6
+		        || entry->addr.ss_family == AF_UNIX))
+		{
+			entry->fd = fd;
+			wctx->num_inherited_fds++;
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+
+		p = end + strcspn(end, ",");
+		if (*p == ',')
+			p++;
+	}
+
+	// whatever we start shouldn't think it inherited them too
+	unsetenv(H2OW_LISTEN_FDS_ENV);
+
+	return 0;
+}
+
+// whether an inherited socket is bound to addr
+static int is_bound_to(const h2ow_inherited_fd* entry, const h2ow_listen_addr* addr) {
+	if (entry->addr.ss_family != addr->addr.ss_family)
+		return 0;
+
+	switch (addr->addr.ss_family) {
+	case AF_INET: {
+		const struct sockaddr_in* a = (const struct sockaddr_in*)&entry->addr;
+		const struct sockaddr_in* b = (const struct sockaddr_in*)&addr->addr;
+		return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+	}
+
+	case AF_INET6: {
+		const struct sockaddr_in6* a = (const struct sockaddr_in6*)&entry->addr;
+		const struct sockaddr_in6* b = (const struct sockaddr_in6*)&addr->addr;
+		return a->sin6_port == b->sin6_port
+		       && !memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr));
+	}
+
+	case AF_UNIX: {
+		const struct sockaddr_un* a = (const struct sockaddr_un*)&entry->addr;
+		const struct sockaddr_un* b = (const struct sockaddr_un*)&addr->addr;
+		return !strncmp(a->sun_path, b->sun_path, sizeof(a->sun_path));
+	}
+
+	default:
+		return 0;
+	}
+}
+
+int h2ow__adopt_listener(h2ow_context* wctx, const h2ow_listen_addr* addr) {
+	for (int i = 0; i < wctx->num_inherited_fds; i++) {
+		h2ow_inherited_fd* entry = &wctx->inherited_fds[i];
+
+		if (entry->fd >= 0 && is_bound_to(entry, addr)) {
+			int fd = entry->fd;
+			entry->fd = -1;
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
+void h2ow__close_inherited_fds(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+
+	for (int i = 0; i < wctx->num_inherited_fds; i++) {
+		if (wctx->inherited_fds[i].fd >= 0) {
+			H2OW_WARN("closing unused inherited listener %d\n",
+			          wctx->inherited_fds[i].fd);
+			close(wctx->inherited_fds[i].fd);
+		}
+	}
+
+	free(wctx->inherited_fds);
+	wctx->inherited_fds = NULL;
+	wctx->num_inherited_fds = 0;
+
+	// we didn't get to h2ow__signal_ready, so the old process should keep serving
+	if (wctx->ready_fd >= 0) {
+		close(wctx->ready_fd);
+		wctx->ready_fd = -1;
+	}
+}
+
+void h2ow__signal_ready(h2ow_context* wctx) {
+	const h2ow_settings* settings = &wctx->settings;
+
+	if (wctx->ready_fd < 0)
+		return;
+
+	// SIGPIPE is ignored while h2ow_run runs, in case the old process is gone
+	if (write(wctx->ready_fd, "1", 1) != 1) {
+		H2OW_WARN("couldn't tell the old process that we're ready\n");
+	}
+
+	close(wctx->ready_fd);
+	wctx->ready_fd = -1;
+}
+
+// remember the path of our binary in wctx->exe_path; returns 0 or -1
+static int find_exe_path(h2ow_context* wctx) {
+	static const char deleted[] = " (deleted)";
+	char buf[PATH_MAX];
+
+	free(wctx->exe_path);
+	wctx->exe_path = NULL;
+
+	ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+	if (len <= 0 || len == sizeof(buf) - 1)
+		return -1;
+	buf[len] = '\0';
+
+	// our binary was replaced before we got here, so what's there now is what an
+	// upgrade should start
+	size_t suffix = sizeof(deleted) - 1;
+	if ((size_t)len > suffix && !strcmp(buf + len - suffix, deleted))
+		buf[len - suffix] = '\0';
+
+	wctx->exe_path = strdup(buf);
+	return wctx->exe_path != NULL ? 0 : -1;
+}
+
+// the listening sockets of all threads
+static int listener_fds(h2ow_context* wctx, int* fds) {
+	int num = 0;
+
+	for (int i = 0; i < wctx->settings.thread_count; i++) {
+		h2ow_run_context* rctx = wctx->run_contexts[i];
+
+		// dups of the first thread's unix sockets would only be closed again
+		for (int j = 0; j < rctx->num_listeners; j++) {
+			if (!rctx->listeners[j].is_dup)
+				fds[num++] = rctx->listeners[j].fd;
+		}
+	}
+
+	return num;
+}
+
+// our own command line, as an argv array pointing into buf
+static char** read_cmdline(char* buf, size_t size) {
+	FILE* f = fopen("/proc/self/cmdline", "r");
+	if (f == NULL)
+		return NULL;
+
+	size_t len = fread(buf, 1, size - 1, f);
+	fclose(f);
+	if (len == 0 || len == size - 1)
+		return NULL;
+	buf[len] = '\0';
+
+	int argc = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (buf[i] == '\0')
+			argc++;
+	}
+
+	char** argv = malloc((argc + 1) * sizeof(*argv));
+	if (argv == NULL)
+		return NULL;
+
+	for (int i = 0, pos = 0; i < argc; i++) {
+		argv[i] = buf + pos;
+		pos += strlen(buf + pos) + 1;
+	}
+	argv[argc] = NULL;
+
+	return argv;
+}
+
+// whether var ("NAME=value") sets the environment variable name
+static int sets_var(const char* var, const char* name) {
+	size_t len = strlen(name);
+	return !strncmp(var, name, len) && var[len] == '=';
+}
+
+// environ with H2OW_LISTEN_FDS and H2OW_READY_FD set to fds_var and ready_var
+static char** make_env(char* fds_var, char* ready_var) {
+	int num = 0;
+	while (environ[num] != NULL) {
+		num++;
+	}
+
+	char** env = malloc((num + 3) * sizeof(*env));
+	if (env == NULL)
+		return NULL;
+
+	int j = 0;
+	for (int i = 0; i < num; i++) {
+		if (!sets_var(environ[i], H2OW_LISTEN_FDS_ENV)
+		    && !sets_var(environ[i], H2OW_READY_FD_ENV))
+			env[j++] = environ[i];
+	}
+	env[j++] = fds_var;
+	env[j++] = ready_var;
+	env[j] = NULL;
+
+	return env;
+}
+
+// start the new instance; returns its pid and sets *ready_fd to the read end of the
+// pipe it writes to once it's ready, or returns -1 on error
+static pid_t spawn_new_instance(h2ow_context* wctx, int* ready_fd) {
+	const h2ow_settings* settings = &wctx->settings;
+	int fds[wctx->num_listen_addrs * wctx->settings.thread_count];
+	int num_fds = listener_fds(wctx, fds);
+	int pipe_fds[2];
+
+	if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+		H2OW_ERR("couldn't create a pipe for the new instance\n");
+		return -1;
+	}
+
+	// everything is prepared before forking, since only async-signal-safe functions
+	// may be used in the child of a multithreaded process
+	char fds_var[sizeof(H2OW_LISTEN_FDS_ENV) + 12 * num_fds + 1];
+	int len = sprintf(fds_var, "%s=", H2OW_LISTEN_FDS_ENV);
+	for (int i = 0; i < num_fds; i++) {
+		len += sprintf(fds_var + len, i == 0 ? "%d" : ",%d", fds[i]);
+	}
+
+	char ready_var[sizeof(H2OW_READY_FD_ENV) + 12];
+	sprintf(ready_var, "%s=%d", H2OW_READY_FD_ENV, pipe_fds[1]);
+
+	char cmdline[65536];
+	char** argv = read_cmdline(cmdline, sizeof(cmdline));
+	char** env = make_env(fds_var, ready_var);
+	if (argv == NULL || env == NULL) {
+		H2OW_ERR("couldn't read the command line or the environment\n");
+		free(argv);
+		free(env);
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		// listening sockets we created ourselves might be close-on-exec, like the
+		// write end of the pipe. the read end is closed by exec
+		for (int i = 0; i < num_fds; i++) {
+			fcntl(fds[i], F_SETFD, 0);
+		}
+		fcntl(pipe_fds[1], F_SETFD, 0);
+
+		execve(wctx->exe_path, argv, env);
+		_exit(127);
+	}
+
+	free(argv);
+	free(env);
+	close(pipe_fds[1]);
+
+	if (pid < 0) {
+		H2OW_ERR("couldn't fork to start the new binary\n");
+		close(pipe_fds[0]);
+		return -1;
+	}
+
+	*ready_fd = pipe_fds[0];
+	return pid;
+}
+
+// stop waiting for the new instance
+static void stop_waiting(h2ow_run_context* rctx) {
+	uv_close((uv_handle_t*)&rctx->upgrade_poll, NULL);
+	rctx->upgrade_poll.data = NULL;
+	close(rctx->upgrade_fd);
+	rctx->upgrade_fd = -1;
+}
+
+static void on_new_instance(uv_poll_t* self, int status, int events) {
+	h2ow_run_context* rctx = self->data;
+	const h2ow_settings* settings = &rctx->wctx->settings;
+	int pid = rctx->upgrade_pid;
+	char c;
+	(void)status, (void)events;
+
+	ssize_t n = read(rctx->upgrade_fd, &c, 1);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	stop_waiting(rctx);
+
+	if (n == 1) {
+		H2OW_NOTE("new instance with pid %d is ready, shutting down\n", pid);
+
+		// the new process takes over from here
+		uv_close((uv_handle_t*)&rctx->upgrade_handler, NULL);
+		rctx->upgrade_handler.data = NULL;
+
+		// every thread shuts down and drains its connections like on SIGTERM
+		kill(getpid(), SIGTERM);
+		return;
+	}
+
+	// it closed the pipe without writing, because it exited or h2ow_run failed
+	int wstatus;
+	if (waitpid(pid, &wstatus, WNOHANG) == pid && WIFEXITED(wstatus)) {
+		H2OW_ERR("new instance with pid %d exited with status %d before it was "
+		         "ready, continuing\n",
+		         pid, WEXITSTATUS(wstatus));
+	}
+	else {
+		H2OW_ERR("new instance with pid %d failed to start, continuing\n", pid);
+	}
+}
+
+static void on_upgrade_signal(uv_signal_t* self, int signum) {
+	h2ow_run_context* rctx = self->data;
+	const h2ow_settings* settings = &rctx->wctx->settings;
+	int ready_fd;
+	(void)signum;
+
+	if (!rctx->wctx->is_running)
+		return;
+
+	if (rctx->upgrade_poll.data != NULL) {
+		H2OW_WARN("already waiting for new instance with pid %d, ignoring signal\n",
+		          (int)rctx->upgrade_pid);
+		return;
+	}
+
+	pid_t pid = spawn_new_instance(rctx->wctx, &ready_fd);
+	if (pid < 0)
+		return;
+
+	if (uv_poll_init(&rctx->loop, &rctx->upgrade_poll, ready_fd) < 0) {
+		H2OW_ERR("couldn't wait for new instance with pid %d\n", (int)pid);
+		close(ready_fd);
+		return;
+	}
+
+	rctx->upgrade_poll.data = rctx;
+	rctx->upgrade_fd = ready_fd;
+	rctx->upgrade_pid = pid;
+
+	// the pipe also becomes readable when the new process closes it
+	if (uv_poll_start(&rctx->upgrade_poll, UV_READABLE, on_new_instance) < 0) {
+		H2OW_ERR("couldn't wait for new instance with pid %d\n", (int)pid);
+		stop_waiting(rctx);
+		return;
+	}
+
+	H2OW_NOTE("started new instance with pid %d, waiting for it to be ready\n",
+	          (int)pid);
+}
+
+int h2ow__create_upgrade_handler(h2ow_run_context* rctx) {
+	int signum = rctx->wctx->settings.upgrade_signal;
+
+	rctx->upgrade_poll.data = NULL;
+	rctx->upgrade_fd = -1;
+
+	if (find_exe_path(rctx->wctx) < 0)
+		return -1;
+
+	if (uv_signal_init(&rctx->loop, &rctx->upgrade_handler) < 0)
+		return -1;
+
+	if (uv_signal_start(&rctx->upgrade_handler, on_upgrade_signal, signum) < 0) {
+		uv_close((uv_handle_t*)&rctx->upgrade_handler, NULL);
+		return -1;
+	}
+
+	rctx->upgrade_handler.data = rctx;
+	return 0;
+}
+
+void h2ow__close_upgrade_handler(h2ow_run_context* rctx) {
+	if (rctx->upgrade_handler.data != NULL) {
+		uv_close((uv_handle_t*)&rctx->upgrade_handler, NULL);
+		rctx->upgrade_handler.data = NULL;
+	}
+
+	if (rctx->upgrade_poll.data != NULL)
+		stop_waiting(rctx);
+}
@@ -1,6 +1,13 @@
-#include <h2ow/uthash.h>
-
+#define _GNU_SOURCE
 #include <h2ow/utils.h>
+#include <h2ow/multipart.h>
+
+#include <string.h>
+#include <strings.h>
+
+#if defined(__SSE2__)
+#	include <immintrin.h>
+#endif
 
 char hex_to_num[256]
         = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -18,11 +25,194 @@ char hex_to_num[256]
 	        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 	        -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 
-// kinda hacky, but should work
-#undef uthash_malloc
-#define uthash_malloc(n) h2o_mem_alloc_shared(&req->pool, n, NULL)
-#undef uthash_free
-#define uthash_free(p, n) ((void)0)
+/* the parsers below decode the body in place, which means copying every byte that
+ * isn't part of an escape to where the decoded output ends. most bytes of a form
+ * need no decoding, so instead of going through the switch for each of them, we
+ * look for the next byte that needs attention ('&', '+', '%', and '=' in names)
+ * 16 or 32 bytes at a time and copy everything before it at once.
+ */
+// whether each byte ends a run of bytes that can just be copied, in names and values
+static const char special_in_name[256] = { ['&'] = 1, ['+'] = 1, ['%'] = 1, ['='] = 1 };
+static const char special_in_val[256] = { ['&'] = 1, ['+'] = 1, ['%'] = 1 };
+
+// number of bytes from p up to the next special byte or end
+static inline size_t clean_run(const char* p, const char* end, int in_name) {
+	const char* start = p;
+
+	// in values, '=' isn't special, so the simd loops compare against '&' twice
+#if defined(__AVX2__)
+	const __m256i amp32 = _mm256_set1_epi8('&'), plus32 = _mm256_set1_epi8('+');
+	const __m256i pct32 = _mm256_set1_epi8('%');
+	const __m256i eq32 = _mm256_set1_epi8(in_name ? '=' : '&');
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		__m256i hits = _mm256_cmpeq_epi8(v, amp32);
+		hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, plus32));
+		hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, pct32));
+		hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, eq32));
+		unsigned int mask = _mm256_movemask_epi8(hits);
+
+		if (mask != 0)
+			return p - start + __builtin_ctz(mask);
+		p += 32;
+	}
+#endif
+
+#if defined(__SSE2__)
+	const __m128i amp = _mm_set1_epi8('&'), plus = _mm_set1_epi8('+');
+	const __m128i pct = _mm_set1_epi8('%'), eq16 = _mm_set1_epi8(in_name ? '=' : '&');
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i hits = _mm_cmpeq_epi8(v, amp);
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, plus));
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, pct));
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, eq16));
+		unsigned int mask = _mm_movemask_epi8(hits);
+
+		if (mask != 0)
+			return p - start + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+
+	// the rest, or everything if we don't have simd instructions
+	const char* special = in_name ? special_in_name : special_in_val;
+	while (p < end && !special[(unsigned char)*p])
+		p++;
+
+	return p - start;
+}
+
+// copy a run that clean_run found from the read head to the write head
+static inline void copy_run(char** wh, char** rh, size_t run) {
+	if (*wh != *rh)
+		memmove(*wh, *rh, run);
+	*wh += run;
+	*rh += run;
+}
+
+/* parsed fields are stored in one array per form, in the order they appear, and
+ * found through an open-addressing index over that array, like a swisstable. the
+ * index has a control byte for each slot, which is either CTRL_EMPTY or the top 7
+ * bits of the hash of the key in the slot. slots are probed in groups of 16, whose
+ * control bytes are compared to those bits at once (with sse2 where we have it), so
+ * only slots whose byte matches need their key compared. fields are never removed,
+ * so a group with an empty slot ends the probe.
+ *
+ * the index is built after parsing, when we know how many fields there are, and
+ * kept at most 7/8 full. for keys that appear more than once, the last field wins.
+ */
+#define GROUP_SIZE 16
+#define CTRL_EMPTY 0x80
+
+// returns the key of field i of an array of fields
+typedef h2o_iovec_t (*key_of_fn)(const void* fields, int32_t i);
+
+static inline uint64_t hash_key(const char* key, size_t len) {
+	// fnv-1a, with the bits mixed at the end since we use both the low and high ones
+	uint64_t h = 0xcbf29ce484222325;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)key[i];
+		h *= 0x100000001b3;
+	}
+
+	h ^= h >> 32;
+	h *= 0xd6e8feb86659fd93;
+	h ^= h >> 32;
+	return h;
+}
+
+// bit i is set if control byte i of the group is byte
+static inline unsigned int group_match(const uint8_t* ctrl, uint8_t byte) {
+#if defined(__SSE2__)
+	__m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+	unsigned int mask = 0;
+	for (int i = 0; i < GROUP_SIZE; i++) {
+		mask |= (unsigned int)(ctrl[i] == byte) << i;
+	}
+	return mask;
+#endif
+}
+
+// find the slot of key, or the empty slot where it would go
+static inline size_t index_probe(const h2ow_post_index* index, const void* fields,
+                                 key_of_fn key_of, const char* key, size_t len,
+                                 uint64_t hash) {
+	uint8_t h2 = hash >> 57;
+	size_t group = hash & index->group_mask;
+
+	for (;;) {
+		const uint8_t* ctrl = index->ctrl + group * GROUP_SIZE;
+
+		for (unsigned int m = group_match(ctrl, h2); m != 0; m &= m - 1) {
+			size_t slot = group * GROUP_SIZE + __builtin_ctz(m);
+			h2o_iovec_t other = key_of(fields, index->slots[slot]);
+
+			if (other.len == len && memcmp(other.base, key, len) == 0)
+				return slot;
+		}
+
+		unsigned int empty = group_match(ctrl, CTRL_EMPTY);
+		if (empty != 0)
+			return group * GROUP_SIZE + __builtin_ctz(empty);
+
+		group = (group + 1) & index->group_mask;
+	}
+}
+
+static void build_index(h2o_req_t* req, h2ow_post_index* index, const void* fields,
+                        int num_fields, key_of_fn key_of) {
+	size_t num_groups = 1;
+	while (num_groups * GROUP_SIZE * 7 / 8 < (size_t)num_fields) {
+		num_groups *= 2;
+	}
+
+	size_t num_slots = num_groups * GROUP_SIZE;
+	index->ctrl = h2o_mem_alloc_shared(&req->pool, num_slots, NULL);
+	index->slots = h2o_mem_alloc_shared(&req->pool, num_slots * sizeof(int32_t), NULL);
+	index->group_mask = num_groups - 1;
+	memset(index->ctrl, CTRL_EMPTY, num_slots);
+
+	for (int32_t i = 0; i < num_fields; i++) {
+		h2o_iovec_t key = key_of(fields, i);
+		uint64_t hash = hash_key(key.base, key.len);
+		size_t slot = index_probe(index, fields, key_of, key.base, key.len, hash);
+
+		index->ctrl[slot] = hash >> 57;
+		index->slots[slot] = i;
+	}
+}
+
+// returns the index of the field with key, or -1
+static inline int32_t index_find(const h2ow_post_index* index, const void* fields,
+                                 key_of_fn key_of, const char* key, size_t len) {
+	// forms that couldn't be parsed don't have an index
+	if (index->ctrl == NULL)
+		return -1;
+
+	uint64_t hash = hash_key(key, len);
+	size_t slot = index_probe(index, fields, key_of, key, len, hash);
+
+	return index->ctrl[slot] == CTRL_EMPTY ? -1 : index->slots[slot];
+}
+
+// upper bound for the number of fields in an urlencoded body
+static int count_fields(h2o_iovec_t body) {
+	const char* p = body.base;
+	const char* end = p + body.len;
+	int count = 1;
+
+	while (p < end && (p = memchr(p, '&', end - p)) != NULL) {
+		count++;
+		p++;
+	}
+
+	return count;
+}
 
 static int parse_urlencoded_form_data(h2o_req_t* req, h2ow_post_data* data) {
 	// read head, write head
@@ -41,6 +231,13 @@ static int parse_urlencoded_form_data(h2o_req_t* req, h2ow_post_data* data) {
 
 		// loop until the end of the field name
 		while (*rh != '=') {
+			// the last byte is left to the check below
+			size_t run = clean_run(rh, end - 1, 1);
+			if (run > 0) {
+				copy_run(&wh, &rh, run);
+				continue;
+			}
+
 			// check if we're at the end of the string
 			if (rh == end - 1) {
 				name_len = wh - name + 1;
@@ -103,6 +300,12 @@ static int parse_urlencoded_form_data(h2o_req_t* req, h2ow_post_data* data) {
 		val = wh;
 		// loop until the end of the value
 		while (*rh != '&') {
+			size_t run = clean_run(rh, end - 1, 0);
+			if (run > 0) {
+				copy_run(&wh, &rh, run);
+				continue;
+			}
+
 			// check if we're at the end of the string
 			if (rh == end - 1) {
 				int val_len = wh - val + 1;
@@ -152,15 +355,11 @@ static int parse_urlencoded_form_data(h2o_req_t* req, h2ow_post_data* data) {
 		// handle someone putting "&=" or "&&" into their post data
 		if (name_len <= 0)
 			return -1;
-		// allocate a new h2ow_post_field
-		h2ow_post_field* new_field
-		        = h2o_mem_alloc_shared(&req->pool, sizeof(*new_field), NULL);
+		// save the new key/value pair; it's added to the index once we're done
+		h2ow_post_field* new_field = &data->fields[data->num_fields++];
 		new_field->key = name;
 		new_field->val = val;
 
-		// save the new key/value pair
-		HASH_ADD_KEYPTR(hh, data->fields, name, name_len, new_field);
-
 		// point to the next key for the next iteration
 		wh++, rh++;
 	}
@@ -170,16 +369,29 @@ static int parse_urlencoded_form_data(h2o_req_t* req, h2ow_post_data* data) {
 
 // convenience function for parsing post data (currently only www-form-urlencoded)
 // that doesn't contain any null bytes
+static h2o_iovec_t field_key(const void* fields, int32_t i) {
+	const char* key = ((const h2ow_post_field*)fields)[i].key;
+	return h2o_iovec_init(key, strlen(key));
+}
+
 int h2ow_post_parse(h2o_req_t* req, h2ow_post_data* data) {
-	data->fields = NULL;
+	int max_fields = count_fields(req->entity);
+
+	data->fields = h2o_mem_alloc_shared(&req->pool, max_fields * sizeof(*data->fields),
+	                                    NULL);
+	data->num_fields = 0;
+	data->index.ctrl = NULL;
 
-	return parse_urlencoded_form_data(req, data);
+	if (parse_urlencoded_form_data(req, data) < 0)
+		return -1;
+
+	build_index(req, &data->index, data->fields, data->num_fields, field_key);
+	return 0;
 }
 
 h2ow_post_field* h2ow_post_get(h2ow_post_data* data, const char* key) {
-	h2ow_post_field* ret = NULL;
-	HASH_FIND_STR(data->fields, key, ret);
-	return ret;
+	int32_t i = index_find(&data->index, data->fields, field_key, key, strlen(key));
+	return i >= 0 ? &data->fields[i] : NULL;
 }
 
 static int parse_urlencoded_form_vecs(h2o_req_t* req, h2ow_post_vecs* data) {
@@ -200,6 +412,12 @@ static int parse_urlencoded_form_vecs(h2o_req_t* req, h2ow_post_vecs* data) {
 
 		// loop until the end of the field name
 		while (*rh != '=' && rh < end) {
+			size_t run = clean_run(rh, end, 1);
+			if (run > 0) {
+				copy_run(&wh, &rh, run);
+				continue;
+			}
+
 			switch (*rh) {
 			// check if this is a key without a value
 			case '&':
@@ -243,6 +461,12 @@ static int parse_urlencoded_form_vecs(h2o_req_t* req, h2ow_post_vecs* data) {
 		val = wh;
 		// loop until the end of the value
 		while (*rh != '&' && rh < end) {
+			size_t run = clean_run(rh, end, 0);
+			if (run > 0) {
+				copy_run(&wh, &rh, run);
+				continue;
+			}
+
 			// parse urlencoded stuff
 			switch (*rh) {
 			case '+':
@@ -282,17 +506,13 @@ static int parse_urlencoded_form_vecs(h2o_req_t* req, h2ow_post_vecs* data) {
 			continue;
 		}
 
-		// allocate a new h2ow_post_vec
-		h2ow_post_vec* new_field
-		        = h2o_mem_alloc_shared(&req->pool, sizeof(*new_field), NULL);
+		// save the new key/value pair; it's added to the index once we're done
+		h2ow_post_vec* new_field = &data->fields[data->num_fields++];
 		new_field->key.base = name;
 		new_field->key.len = name_len;
 		new_field->val.base = val;
 		new_field->val.len = val_len;
 
-		// save the new key/value pair
-		HASH_ADD_KEYPTR(hh, data->fields, name, name_len, new_field);
-
 		// point to the next key for the next iteration
 		wh++, rh++;
 	}
@@ -300,16 +520,253 @@ static int parse_urlencoded_form_vecs(h2o_req_t* req, h2ow_post_vecs* data) {
 	return 0;
 }
 
+// state for parsing a multipart/form-data body into a h2ow_post_vecs; since the
+// body is parsed in one chunk, the slices we get stay valid as long as the request
+typedef struct multipart_vecs_s {
+	h2o_req_t* req;
+	h2ow_post_vecs* data;
+	int max_fields;
+	int in_field; // whether the current part is the last field; parts need a name
+} multipart_vecs;
+
+static void on_vec_part(h2ow_multipart* mp, h2ow_multipart_part* part) {
+	multipart_vecs* state = mp->data;
+	h2ow_post_vecs* data = state->data;
+
+	state->in_field = 0;
+	if (part->name.base == NULL || part->name.len == 0)
+		return;
+
+	// we don't know how many parts there are, so the array grows as needed
+	if (data->num_fields == state->max_fields) {
+		int max_fields = state->max_fields > 0 ? state->max_fields * 2 : 8;
+		h2ow_post_vec* fields = h2o_mem_alloc_shared(
+		        &state->req->pool, max_fields * sizeof(*fields), NULL);
+
+		if (data->num_fields > 0)
+			memcpy(fields, data->fields, data->num_fields * sizeof(*fields));
+		data->fields = fields;
+		state->max_fields = max_fields;
+	}
+
+	h2ow_post_vec* field = &data->fields[data->num_fields++];
+	field->key = part->name;
+	field->val = h2o_iovec_init("", 0);
+	state->in_field = 1;
+}
+
+static void on_vec_data(h2ow_multipart* mp, h2o_iovec_t chunk) {
+	multipart_vecs* state = mp->data;
+
+	if (!state->in_field)
+		return;
+
+	// the pieces of one part are next to each other in req->entity
+	h2ow_post_vec* field = &state->data->fields[state->data->num_fields - 1];
+	if (field->val.len == 0)
+		field->val.base = chunk.base;
+	field->val.len = chunk.base + chunk.len - field->val.base;
+}
+
+static const h2ow_multipart_callbacks vec_callbacks = { on_vec_part, on_vec_data, NULL };
+
+static int parse_multipart_form_vecs(h2o_req_t* req, h2ow_post_vecs* data,
+                                     h2o_iovec_t content_type) {
+	multipart_vecs state = { req, data, 0, 0 };
+	h2ow_multipart* mp = h2o_mem_alloc_shared(&req->pool, sizeof(*mp), NULL);
+
+	if (h2ow_multipart_init(mp, content_type, &vec_callbacks, &state) < 0)
+		return -1;
+
+	if (h2ow_multipart_feed(mp, req->entity) < 0)
+		return -1;
+
+	return h2ow_multipart_finish(mp);
+}
+
+static h2o_iovec_t vec_key(const void* fields, int32_t i) {
+	return ((const h2ow_post_vec*)fields)[i].key;
+}
+
 int h2ow_post_parse_vecs(h2o_req_t* req, h2ow_post_vecs* data) {
+	int ret;
+
 	data->fields = NULL;
+	data->num_fields = 0;
+	data->index.ctrl = NULL;
 
-	// TODO support multipart/form-data
-	return parse_urlencoded_form_vecs(req, data);
+	ssize_t idx = h2o_find_header(&req->headers, H2O_TOKEN_CONTENT_TYPE, -1);
+	h2o_iovec_t content_type
+	        = idx != -1 ? req->headers.entries[idx].value : h2o_iovec_init(NULL, 0);
+
+	if (content_type.len >= 19
+	    && strncasecmp(content_type.base, "multipart/form-data", 19) == 0)
+	{
+		ret = parse_multipart_form_vecs(req, data, content_type);
+	}
+	else {
+		int max_fields = count_fields(req->entity);
+		data->fields = h2o_mem_alloc_shared(
+		        &req->pool, max_fields * sizeof(*data->fields), NULL);
+
+		ret = parse_urlencoded_form_vecs(req, data);
+	}
+
+	if (ret < 0)
+		return -1;
+
+	build_index(req, &data->index, data->fields, data->num_fields, vec_key);
+	return 0;
 }
 
 h2ow_post_vec* h2ow_post_get_vec(h2ow_post_vecs* data, const char* key,
                                  unsigned int key_len) {
-	h2ow_post_vec* ret = NULL;
-	HASH_FIND(hh, data->fields, key, key_len, ret);
+	int32_t i = index_find(&data->index, data->fields, vec_key, key, key_len);
+	return i >= 0 ? &data->fields[i] : NULL;
+}
+
+/* lazy lookups scan the body backwards, one field at a time, so that the first match
+ * is also the last field with that key (like h2ow_post_get). names are compared by
+ * decoding them on the fly, which usually stops at their first byte, and only the
+ * value of the field we find gets decoded. a small memo of recent lookups means
+ * that asking for the same key twice doesn't scan the body again.
+ */
+void h2ow_post_lazy_init(h2o_req_t* req, h2ow_post_lazy* lazy) {
+	lazy->req = req;
+	lazy->body = req->entity;
+	lazy->num_memo = 0;
+	lazy->next_memo = 0;
+}
+
+// if the field at raw (which ends before end) has the name key, returns where its
+// encoded name ends, otherwise NULL
+static const char* match_name(const char* raw, const char* end, const char* key,
+                              size_t key_len) {
+	size_t j = 0;
+	while (raw < end && *raw != '=') {
+		if (j == key_len)
+			return NULL;
+
+		char c = *raw;
+		if (c == '+') {
+			c = ' ';
+			raw++;
+		}
+		else if (c == '%') {
+			if (end - raw < 3)
+				return NULL;
+			char hi = hex_to_num[(unsigned char)raw[1]];
+			char lo = hex_to_num[(unsigned char)raw[2]];
+			if (hi < 0 || lo < 0)
+				return NULL;
+			c = hi << 4 | lo;
+			raw += 3;
+		}
+		else {
+			raw++;
+		}
+
+		if (c != key[j++])
+			return NULL;
+	}
+
+	return j == key_len ? raw : NULL;
+}
+
+// decode the value raw into the pool; values without escapes are used as they are
+static int decode_lazy_val(h2o_req_t* req, const char* raw, size_t len,
+                           h2o_iovec_t* val) {
+	if (clean_run(raw, raw + len, 0) == len) {
+		*val = h2o_iovec_init(raw, len);
+		return 0;
+	}
+
+	char* out = h2ow_req_pool_alloc(req, len);
+	size_t i = 0, n = 0;
+	while (i < len) {
+		if (raw[i] == '+') {
+			out[n++] = ' ';
+			i++;
+		}
+		else if (raw[i] == '%') {
+			if (i + 2 >= len)
+				return -1;
+			char hi = hex_to_num[(unsigned char)raw[i + 1]];
+			char lo = hex_to_num[(unsigned char)raw[i + 2]];
+			if (hi < 0 || lo < 0)
+				return -1;
+			out[n++] = hi << 4 | lo;
+			i += 3;
+		}
+		else {
+			out[n++] = raw[i++];
+		}
+	}
+
+	*val = h2o_iovec_init(out, n);
+	return 0;
+}
+
+static int lazy_scan(h2ow_post_lazy* lazy, const char* key, size_t key_len,
+                     h2o_iovec_t* val) {
+	const char* base = lazy->body.base;
+	const char* end = base + lazy->body.len;
+
+	while (end > base) {
+		const char* amp = memrchr(base, '&', end - base);
+		const char* field = amp != NULL ? amp + 1 : base;
+		const char* name_end = match_name(field, end, key, key_len);
+
+		if (name_end != NULL) {
+			if (name_end == end) {
+				*val = h2o_iovec_init(end, 0);
+				return 1;
+			}
+			const char* raw = name_end + 1;
+			return decode_lazy_val(lazy->req, raw, end - raw, val) < 0 ? -1 : 1;
+		}
+
+		if (amp == NULL)
+			break;
+		end = amp;
+	}
+
+	return 0;
+}
+
+int h2ow_post_lazy_get(h2ow_post_lazy* lazy, const char* key, unsigned int key_len,
+                       h2o_iovec_t* val) {
+	// empty names are never stored as fields
+	if (key_len == 0)
+		return 0;
+
+	for (int i = 0; i < lazy->num_memo; i++) {
+		h2ow_post_lazy_memo* m = &lazy->memo[i];
+		if (m->key_len == key_len && memcmp(m->key, key, key_len) == 0) {
+			if (m->found)
+				*val = m->val;
+			return m->found;
+		}
+	}
+
+	int ret = lazy_scan(lazy, key, key_len, val);
+	// don't remember errors, and keys that don't fit
+	if (ret < 0 || key_len > H2OW_POST_LAZY_MEMO_KEY)
+		return ret;
+
+	h2ow_post_lazy_memo* m;
+	if (lazy->num_memo < H2OW_POST_LAZY_MEMO) {
+		m = &lazy->memo[lazy->num_memo++];
+	}
+	else {
+		m = &lazy->memo[lazy->next_memo];
+		lazy->next_memo = (lazy->next_memo + 1) % H2OW_POST_LAZY_MEMO;
+	}
+
+	memcpy(m->key, key, key_len);
+	m->key_len = key_len;
+	m->found = ret;
+	if (ret)
+		m->val = *val;
 	return ret;
 }
@@ -0,0 +1,200 @@
+/* feeds bodies through h2ow_stream_body the way h2o does: one chunk at a time, the
+ * next one only after the last one was acknowledged with proceed_req, and each in
+ * the same buffer, which is overwritten once the chunk is acknowledged. the handler
+ * pauses and resumes at random, both in on_chunk and from outside, and has to get
+ * the whole body in order, with the end once. when it pauses in on_chunk, it keeps
+ * the chunk it got, which has to be unchanged when it resumes.
+ */
+
+#include "h2ow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BODY 2000
+#define MAX_CHUNK 100
+
+static int failures = 0;
+
+// what h2o does
+static char body[MAX_BODY];
+static size_t body_len, sent;
+static char chunk_buf[MAX_CHUNK];
+static size_t chunk_len;
+static int chunk_end, outstanding, finished;
+
+// what the handler does
+static char received[MAX_BODY];
+static size_t received_len;
+static int got_end;
+// the chunk it kept when it paused in on_chunk, and where it is in the body
+static h2o_iovec_t kept;
+static size_t kept_at;
+
+static void fail(int seed, const char* what) {
+	if (failures++ < 10)
+		printf("seed %d: %s\n", seed, what);
+}
+
+static int seed;
+
+static void proceed_req(h2o_req_t* req, size_t written, int is_end) {
+	(void)req;
+
+	if (!outstanding || written != chunk_len || is_end != chunk_end) {
+		fail(seed, "acknowledged a chunk that wasn't sent");
+		return;
+	}
+
+	// h2o reuses the buffer for the next chunk
+	memset(chunk_buf, '#', sizeof(chunk_buf));
+	outstanding = 0;
+	finished = is_end;
+}
+
+static void on_chunk(h2ow_body_stream* stream, h2o_iovec_t chunk, int is_end) {
+	// the end can come in an empty chunk without a buffer
+	if (got_end || received_len + chunk.len > body_len
+	    || (chunk.len > 0 && memcmp(chunk.base, body + received_len, chunk.len) != 0))
+	{
+		fail(seed, "got a chunk that isn't the next part of the body");
+		return;
+	}
+
+	size_t at = received_len;
+	if (chunk.len > 0)
+		memcpy(received + received_len, chunk.base, chunk.len);
+	received_len += chunk.len;
+
+	if (is_end) {
+		got_end = 1;
+		if (received_len != body_len)
+			fail(seed, "got the end before the whole body");
+	}
+
+	switch (rand() % 8) {
+	case 0:
+	case 1:
+	case 2:
+		// e.g. waiting for a write of the chunk to finish
+		h2ow_body_pause(stream);
+		kept = chunk.len > 0 ? chunk : h2o_iovec_init(NULL, 0);
+		kept_at = at;
+		break;
+
+	case 3:
+		h2ow_body_pause(stream);
+		h2ow_body_resume(stream);
+		break;
+	}
+}
+
+// hand the next chunk to the stream, or the part that arrived with the headers
+static h2o_iovec_t next_chunk(void) {
+	size_t len = rand() % MAX_CHUNK;
+	if (len > body_len - sent)
+		len = body_len - sent;
+
+	memcpy(chunk_buf, body + sent, len);
+	sent += len;
+	chunk_len = len;
+	// sometimes, the end comes in an empty chunk of its own
+	chunk_end = sent == body_len && (len == 0 || rand() % 2);
+	outstanding = 1;
+
+	return h2o_iovec_init(chunk_buf, len);
+}
+
+static void run(h2ow_run_context* rctx) {
+	h2o_req_t req;
+
+	body_len = rand() % MAX_BODY;
+	for (size_t i = 0; i < body_len; i++)
+		body[i] = 'a' + rand() % 26;
+
+	sent = received_len = 0;
+	outstanding = finished = got_end = 0;
+	kept = h2o_iovec_init(NULL, 0);
+
+	memset(&req, 0, sizeof(req));
+	h2o_mem_init_pool(&req.pool);
+	req.proceed_req = proceed_req;
+	req.entity = next_chunk();
+	// the end never arrives with the headers if proceed_req is set
+	chunk_end = 0;
+
+	h2ow_body_stream* stream = h2ow_stream_body(&req, rctx, on_chunk, NULL);
+
+	for (int steps = 0; !(finished && got_end) && failures == 0; steps++) {
+		if (steps > 100000) {
+			fail(seed, "the body never ended");
+			break;
+		}
+
+		if (!outstanding && !finished) {
+			h2o_iovec_t chunk = next_chunk();
+			req.write_req.cb(req.write_req.ctx, chunk, chunk_end);
+		}
+		else if (stream->paused) {
+			if (kept.base != NULL && memcmp(kept.base, body + kept_at, kept.len) != 0)
+				fail(seed, "a chunk changed while the handler was paused");
+			kept = h2o_iovec_init(NULL, 0);
+			h2ow_body_resume(stream);
+		}
+		else if (outstanding) {
+			fail(seed, "a chunk wasn't acknowledged while the stream is running");
+		}
+
+		// and pause from outside sometimes
+		if (!stream->paused && rand() % 6 == 0)
+			h2ow_body_pause(stream);
+	}
+
+	if (failures == 0 && memcmp(received, body, body_len) != 0)
+		fail(seed, "got a different body");
+
+	h2o_mem_clear_pool(&req.pool);
+}
+
+static void run_complete_body(h2ow_run_context* rctx) {
+	h2o_req_t req;
+
+	memset(&req, 0, sizeof(req));
+	h2o_mem_init_pool(&req.pool);
+	body_len = 3;
+	memcpy(body, "abc", 3);
+	received_len = got_end = 0;
+	req.entity = h2o_iovec_init(body, body_len);
+
+	h2ow_stream_body(&req, rctx, on_chunk, NULL);
+	if (!got_end || received_len != body_len)
+		fail(-1, "a body that arrived with the headers wasn't handed out at once");
+
+	h2o_mem_clear_pool(&req.pool);
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+	static h2ow_context wctx;
+	static h2ow_run_context rctx;
+
+	h2ow_set_defaults(&wctx);
+	h2ow_setopt(&wctx, H2OW_DEBUG_LEVEL, H2OW_DEBUG_NONE);
+	rctx.wctx = &wctx;
+
+	run_complete_body(&rctx);
+
+	for (seed = 0; seed < iterations && failures == 0; seed++) {
+		srand(seed);
+		// small windows, so chunks often don't fit
+		h2ow_setopt(&wctx, H2OW_BODY_WINDOW, 1 + rand() % 300);
+		run(&rctx);
+	}
+
+	if (failures > 0) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
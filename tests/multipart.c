@@ -0,0 +1,387 @@
+/* checks the multipart parser against itself: every body is parsed in one chunk, and
+ * then split into two chunks at every offset, into three at every pair of offsets (for
+ * the short ones), and into chunks of one byte. every way of splitting it has to give
+ * the same callbacks with the same data, and the same result. each chunk is copied
+ * into its own buffer, which is freed right after feeding it, so slices that point
+ * into an old chunk are caught by the sanitizers. the result of parsing a body in one
+ * chunk is compared to what we expect, parts with a filename are written to a file
+ * with h2ow_multipart_set_fd, and malformed and cut off bodies have to fail.
+ */
+
+#include "h2ow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#define CONTENT_TYPE "multipart/form-data; boundary=XyZ"
+#define MAX_TRACE 65536
+
+static int failures = 0;
+
+// everything the callbacks saw, with consecutive pieces of data joined, so it
+// doesn't depend on how the body was split
+typedef struct trace_s {
+	char buf[MAX_TRACE];
+	size_t len;
+	int in_data;
+	FILE* file;
+} trace;
+
+static void add(trace* t, const char* s, size_t len) {
+	if (t->len + len > sizeof(t->buf)) {
+		printf("trace too long\n");
+		exit(1);
+	}
+	memcpy(t->buf + t->len, s, len);
+	t->len += len;
+}
+
+static void add_str(trace* t, const char* s) {
+	add(t, s, strlen(s));
+}
+
+static void add_slice(trace* t, const char* what, h2o_iovec_t slice) {
+	add_str(t, what);
+	if (slice.base == NULL) {
+		add_str(t, "(none)");
+	}
+	else {
+		add_str(t, "\"");
+		add(t, slice.base, slice.len);
+		add_str(t, "\"");
+	}
+}
+
+static void end_data(trace* t) {
+	if (t->in_data)
+		add_str(t, "]");
+	t->in_data = 0;
+}
+
+static void on_part(h2ow_multipart* mp, h2ow_multipart_part* part) {
+	trace* t = mp->data;
+
+	end_data(t);
+	add_slice(t, "part name=", part->name);
+	add_slice(t, " filename=", part->filename);
+	add_slice(t, " type=", part->content_type);
+	add_slice(t, " headers=", part->headers);
+	add_str(t, "\n");
+
+	// files go to a file instead of on_data
+	if (part->filename.base != NULL) {
+		t->file = tmpfile();
+		if (t->file == NULL) {
+			printf("couldn't create a temporary file\n");
+			exit(1);
+		}
+		h2ow_multipart_set_fd(mp, fileno(t->file));
+	}
+}
+
+static void on_data(h2ow_multipart* mp, h2o_iovec_t data) {
+	trace* t = mp->data;
+
+	if (!t->in_data)
+		add_str(t, "data [");
+	t->in_data = 1;
+	add(t, data.base, data.len);
+}
+
+static void on_part_end(h2ow_multipart* mp) {
+	trace* t = mp->data;
+
+	end_data(t);
+
+	if (t->file != NULL) {
+		char buf[4096];
+		size_t len;
+
+		rewind(t->file);
+		add_str(t, "file [");
+		while ((len = fread(buf, 1, sizeof(buf), t->file)) > 0)
+			add(t, buf, len);
+		add_str(t, "]");
+
+		fclose(t->file);
+		t->file = NULL;
+	}
+
+	add_str(t, "end\n");
+}
+
+static const h2ow_multipart_callbacks callbacks = { on_part, on_data, on_part_end };
+
+// parse body, split at the given offsets; returns the result of feeding and finishing
+static int parse(trace* t, const char* body, size_t len, const size_t* splits,
+                 int num_splits) {
+	h2ow_multipart mp;
+
+	memset(t, 0, sizeof(*t));
+	if (h2ow_multipart_init(&mp, h2o_iovec_init(CONTENT_TYPE, strlen(CONTENT_TYPE)),
+	                        &callbacks, t)
+	    != 0)
+	{
+		printf("init failed\n");
+		exit(1);
+	}
+
+	int ret = 0;
+	size_t pos = 0;
+	for (int i = 0; i <= num_splits && ret == 0; i++) {
+		size_t next = i < num_splits ? splits[i] : len;
+		size_t chunk_len = next - pos;
+
+		// malloc(0) might return NULL, which isn't a valid chunk base
+		char* chunk = malloc(chunk_len + 1);
+		memcpy(chunk, body + pos, chunk_len);
+		ret = h2ow_multipart_feed(&mp, h2o_iovec_init(chunk, chunk_len));
+		free(chunk);
+
+		pos = next;
+	}
+
+	if (ret == 0)
+		ret = h2ow_multipart_finish(&mp);
+
+	end_data(t);
+	if (t->file != NULL) {
+		fclose(t->file);
+		t->file = NULL;
+	}
+
+	return ret;
+}
+
+static void check_splits(const char* name, const char* body, size_t len, int ret,
+                         const trace* whole) {
+	trace t;
+	size_t splits[2];
+
+	// compares a split parse to the one in one chunk
+#define CHECK_SPLIT(n, ...)                                                           \
+	do {                                                                              \
+		int split_ret = parse(&t, body, len, splits, n);                              \
+		if (split_ret != ret || (ret == 0 && (t.len != whole->len                     \
+		                                      || memcmp(t.buf, whole->buf, t.len)))) \
+		{                                                                             \
+			if (failures++ < 10) {                                                    \
+				printf("%s: split at ", name);                                        \
+				printf(__VA_ARGS__);                                                  \
+				printf(" gives %d instead of %d:\n%.*s\n", split_ret, ret,            \
+				       (int)t.len, t.buf);                                            \
+			}                                                                         \
+		}                                                                             \
+	} while (0)
+
+	for (size_t i = 0; i <= len; i++) {
+		splits[0] = i;
+		CHECK_SPLIT(1, "%zu", i);
+	}
+
+	if (len <= 300) {
+		for (size_t i = 0; i <= len; i++) {
+			for (size_t j = i; j <= len; j++) {
+				splits[0] = i;
+				splits[1] = j;
+				CHECK_SPLIT(2, "%zu and %zu", i, j);
+			}
+		}
+	}
+
+	// one byte at a time
+	h2ow_multipart mp;
+	memset(&t, 0, sizeof(t));
+	h2ow_multipart_init(&mp, h2o_iovec_init(CONTENT_TYPE, strlen(CONTENT_TYPE)),
+	                    &callbacks, &t);
+	int byte_ret = 0;
+	for (size_t i = 0; i < len && byte_ret == 0; i++) {
+		char c = body[i];
+		byte_ret = h2ow_multipart_feed(&mp, h2o_iovec_init(&c, 1));
+	}
+	if (byte_ret == 0)
+		byte_ret = h2ow_multipart_finish(&mp);
+	end_data(&t);
+	if (t.file != NULL)
+		fclose(t.file);
+
+	if (byte_ret != ret
+	    || (ret == 0 && (t.len != whole->len || memcmp(t.buf, whole->buf, t.len))))
+	{
+		if (failures++ < 10)
+			printf("%s: feeding one byte at a time gives %d instead of %d\n", name,
+			       byte_ret, ret);
+	}
+#undef CHECK_SPLIT
+}
+
+typedef struct body_s {
+	const char* name;
+	const char* body;
+	int ret;
+	// what parsing it in one chunk gives, and the close delimiter, if it's valid
+	const char* expected;
+	const char* close;
+} body;
+
+static const body bodies[] = {
+	{ "two parts",
+	  "preamble with \r\n--Xy in it\r\n"
+	  "--XyZ\r\n"
+	  "Content-Disposition: form-data; name=\"a\"\r\n"
+	  "\r\n"
+	  "value \r\n--Xy\r\r\n-- a\r\n"
+	  "--XyZ\r\n"
+	  "Content-Disposition: form-data; name=\"f\"; filename=\"f.txt\"\r\n"
+	  "Content-Type: text/plain\r\n"
+	  "\r\n"
+	  "file\r\n--X\r\r\n"
+	  "--XyZ--\r\n"
+	  "epilogue\r\n--XyZ\r\n",
+	  0,
+	  "part name=\"a\" filename=(none) type=(none) "
+	  "headers=\"Content-Disposition: form-data; name=\"a\"\r\n\"\n"
+	  "data [value \r\n--Xy\r\r\n-- a]end\n"
+	  "part name=\"f\" filename=\"f.txt\" type=\"text/plain\" "
+	  "headers=\"Content-Disposition: form-data; name=\"f\"; filename=\"f.txt\"\r\n"
+	  "Content-Type: text/plain\r\n\"\n"
+	  "file [file\r\n--X\r]end\n",
+	  "--XyZ--" },
+	{ "no headers, no preamble",
+	  "--XyZ\r\n"
+	  "\r\n"
+	  "no headers\r\n"
+	  "--XyZ\r\n"
+	  "\r\n"
+	  "\r\n"
+	  "--XyZ--",
+	  0,
+	  "part name=(none) filename=(none) type=(none) headers=\"\"\n"
+	  "data [no headers]end\n"
+	  "part name=(none) filename=(none) type=(none) headers=\"\"\n"
+	  "end\n",
+	  "--XyZ--" },
+	{ "transport padding",
+	  "--XyZ \t \r\n"
+	  "content-disposition:form-data;name=b  \r\n"
+	  "\r\n"
+	  "\r\r\n\r\n-\r\n"
+	  "--XyZ\t--",
+	  0,
+	  "part name=\"b\" filename=(none) type=(none) "
+	  "headers=\"content-disposition:form-data;name=b  \r\n\"\n"
+	  "data [\r\r\n\r\n-]end\n",
+	  "--XyZ\t--" },
+	{ "empty file",
+	  "--XyZ\r\n"
+	  "Content-Disposition: form-data; name=\"f\"; filename=\"\"\r\n"
+	  "\r\n"
+	  "\r\n"
+	  "--XyZ--",
+	  0,
+	  "part name=\"f\" filename=\"\" type=(none) "
+	  "headers=\"Content-Disposition: form-data; name=\"f\"; filename=\"\"\r\n\"\n"
+	  "file []end\n",
+	  "--XyZ--" },
+	{ "garbage after a delimiter", "--XyZx\r\n\r\n\r\n--XyZ--", -1, NULL, NULL },
+	{ "broken close delimiter", "--XyZ\r\n\r\na\r\n--XyZ-x", -1, NULL, NULL },
+	{ "no line feed after a delimiter", "--XyZ\rX\r\n\r\n--XyZ--", -1, NULL, NULL },
+	{ "no delimiter", "just some text", -1, NULL, NULL },
+	{ "empty body", "", -1, NULL, NULL },
+	{ "headers never end", "--XyZ\r\nContent-Disposition: form-data\r\n", -1, NULL,
+	  NULL },
+	{ "no close delimiter", "--XyZ\r\n\r\nbody\r\n--XyZ\r\n\r\nmore", -1, NULL, NULL },
+};
+#define NUM_BODIES (int)(sizeof(bodies) / sizeof(*bodies))
+
+static void check_body(const body* b) {
+	size_t len = strlen(b->body);
+	trace whole;
+
+	int ret = parse(&whole, b->body, len, NULL, 0);
+	if (ret != b->ret) {
+		failures++;
+		printf("%s: got %d instead of %d\n", b->name, ret, b->ret);
+		return;
+	}
+
+	if (b->expected != NULL
+	    && (whole.len != strlen(b->expected)
+	        || memcmp(whole.buf, b->expected, whole.len) != 0))
+	{
+		failures++;
+		printf("%s: got\n%.*s\ninstead of\n%s\n", b->name, (int)whole.len, whole.buf,
+		       b->expected);
+		return;
+	}
+
+	check_splits(b->name, b->body, len, ret, &whole);
+
+	// a valid body that is cut off before the end of its close delimiter has to fail
+	if (ret == 0) {
+		size_t close_end = strstr(b->body, b->close) - b->body + strlen(b->close);
+
+		for (size_t cut = 0; cut < close_end; cut++) {
+			trace t;
+			if (parse(&t, b->body, cut, NULL, 0) != -1 && failures++ < 10)
+				printf("%s: cut off after %zu bytes, but didn't fail\n", b->name, cut);
+		}
+	}
+}
+
+// headers that are split have to be collected, and there's a limit to that
+static void check_long_headers(void) {
+	char body[2 * H2OW_MULTIPART_MAX_HEADERS];
+	size_t len = sprintf(body, "--XyZ\r\nX-Long: ");
+
+	memset(body + len, 'a', H2OW_MULTIPART_MAX_HEADERS);
+	len += H2OW_MULTIPART_MAX_HEADERS;
+	len += sprintf(body + len, "\r\n\r\n\r\n--XyZ--");
+
+	trace t;
+	size_t split = 20;
+	if (parse(&t, body, len, &split, 1) != -1) {
+		failures++;
+		printf("headers longer than H2OW_MULTIPART_MAX_HEADERS were accepted\n");
+	}
+}
+
+static void check_init(void) {
+	static const char* bad[] = {
+		"text/plain; boundary=XyZ",
+		"multipart/form-data",
+		"multipart/form-data; boundary=",
+		"multipart/form-data; boundary=\"a\rb\"",
+		"multipart/form-data; boundary="
+		"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+	};
+	h2ow_multipart mp;
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+		if (h2ow_multipart_init(&mp, h2o_iovec_init(bad[i], strlen(bad[i])), &callbacks,
+		                        NULL)
+		    != -1)
+		{
+			failures++;
+			printf("accepted content type \"%s\"\n", bad[i]);
+		}
+	}
+}
+
+int main(void) {
+	check_init();
+
+	for (int i = 0; i < NUM_BODIES; i++)
+		check_body(&bodies[i]);
+
+	check_long_headers();
+
+	if (failures > 0) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
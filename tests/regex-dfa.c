@@ -0,0 +1,260 @@
+/* checks the router against the linear lookup for REGEX_PATH handlers: the same
+ * patterns are registered in two contexts, one of which is frozen (so it matches them
+ * with the DFA from regex-dfa.c, see router.c) while the other one calls regexec for
+ * each of them, and every path of the corpus has to find the same handler and the
+ * same allowed methods in both. besides hand-written patterns and random ones, the
+ * corpus has patterns that have to be split into several DFAs and patterns that are
+ * left to regexec.
+ */
+
+#include "h2ow.h"
+
+#include <regex.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* patterns[] = {
+	// plain stuff
+	"^/$",
+	"^/api/v[0-9]+/users/[0-9]+$",
+	"^/res[0-9]*/[a-z]+/(edit|view)$",
+	"/static/.*\\.(css|js)$",
+	"^/u/[^/]+/posts/[0-9]{1,8}$",
+	"^/(a|b|)c?$",
+	"x{2,}",
+	"^/[]a-]+$",
+	"^/[[:digit:][:upper:]]{2}",
+	"(^/q|/r$)",
+	"^(/ab)*$",
+	"\\.php",
+	"()^/e$",
+	// unanchored patterns with a '.' after something whose position matters need a
+	// state for every combination of recent bytes, so these don't fit into one DFA
+	"a.{9}$",
+	"b.{9}$",
+	"c.{9}$",
+	"d.{9}$",
+	// and these don't fit into one on their own
+	"e.{13}$",
+	"f.{14}z",
+	// things the DFA doesn't handle at all
+	"^/\\w+$",
+	"(a)\\1",
+	"[[:alpha:]]\\b",
+	"^/[[.-.]]$",
+	"^/[[=e=]]x$",
+	"(^/a){2}",
+	"^/n{1,100}$",
+};
+#define NUM_PATTERNS (int)(sizeof(patterns) / sizeof(*patterns))
+
+static const char* paths[] = {
+	"/",
+	"",
+	"/api/v1/users/12",
+	"/api/v/users/12",
+	"/api/v12/users/12/",
+	"/res/abc/edit",
+	"/res12/abc/view",
+	"/res12/abc/vie",
+	"/static/a/b.css",
+	"/static/.js",
+	"/static/a.cssx",
+	"/u/me/posts/12345678",
+	"/u/me/posts/123456789",
+	"/u//posts/1",
+	"/ac",
+	"/c",
+	"/",
+	"/bcc",
+	"/xx",
+	"/x",
+	"/a-]",
+	"/1A",
+	"/1a",
+	"/q",
+	"/x/r",
+	"/ab/ab",
+	"/ab/a",
+	"/index.php",
+	"/e",
+	"/aaaaaaaaaa",
+	"/a123456789",
+	"/xa123456789",
+	"/a12345678",
+	"/bcdabcdabcd",
+	"/e1234567890123",
+	"/e123456789012",
+	"/f12345678901234z",
+	"/f1234567890123z",
+	"/word",
+	"/wo-rd",
+	"/aa",
+	"/xaa",
+	"/-",
+	"/ex",
+	"/a/a",
+	"/n",
+	"/nnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnnn",
+	"/with\xff" "high\x80" "bytes",
+};
+#define NUM_PATHS (int)(sizeof(paths) / sizeof(*paths))
+
+static const int methods[] = { H2OW_METHOD_ANY, H2OW_METHOD_GET, H2OW_METHOD_POST,
+	                           H2OW_METHOD_GET | H2OW_METHOD_HEAD };
+static const int request_methods[]
+        = { H2OW_METHOD_GET, H2OW_METHOD_POST, H2OW_METHOD_HEAD, H2OW_METHOD_PUT };
+
+// building blocks for random patterns and paths
+static const char* atoms[]
+        = { "a",  "b",     "/",        ".",     "[ab]",  "[^a]", "[a-c]", "[[:digit:]]",
+	        "1",  "(a|b)", "(ab)*",    "^",     "$",     "\\.",  "x{2}",  "a{1,3}",
+	        "(b|)", "[]a]", "[a-]",    "()",    "\\w",   "(a|^b)", "b+",  "c?",
+	        "(/|$)" };
+static const char* ops[] = { "", "", "", "*", "+", "?", "{0,2}", "{2,}" };
+static const char path_chars[] = "ab/1cx.]-";
+
+static void handler(h2o_req_t* req, h2ow_run_context* rctx) {
+	(void)req;
+	(void)rctx;
+}
+
+static int failures = 0;
+
+static void compare(h2ow_context* frozen, h2ow_context* linear, const char* path,
+                    size_t path_len) {
+	for (int i = 0; i < (int)(sizeof(request_methods) / sizeof(*request_methods)); i++) {
+		int method = request_methods[i];
+		h2ow_route_match fm, lm;
+		h2ow_request_handler* f = h2ow__find_matching_handler(
+		        &frozen->handlers, path, path_len, method, NULL, &fm);
+		h2ow_request_handler* l = h2ow__find_matching_handler(
+		        &linear->handlers, path, path_len, method, NULL, &lm);
+
+		int fi = f != NULL ? f - frozen->handlers.handlers_lists[H2OW_REGEX_PATH] : -1;
+		int li = l != NULL ? l - linear->handlers.handlers_lists[H2OW_REGEX_PATH] : -1;
+
+		if (fi != li || fm.allowed_methods != lm.allowed_methods) {
+			if (failures++ < 20) {
+				printf("mismatch for \"%.*s\" (method %d): router found %s (allowed "
+				       "%d), regexec found %s (allowed %d)\n",
+				       (int)path_len, path, method,
+				       f != NULL ? f->path : "nothing", fm.allowed_methods,
+				       l != NULL ? l->path : "nothing", lm.allowed_methods);
+			}
+		}
+	}
+}
+
+static void init_contexts(h2ow_context* frozen, h2ow_context* linear) {
+	h2ow_set_defaults(frozen);
+	h2ow_set_defaults(linear);
+	h2ow_setopt(frozen, H2OW_DEBUG_LEVEL, H2OW_DEBUG_NONE);
+	h2ow_setopt(linear, H2OW_DEBUG_LEVEL, H2OW_DEBUG_NONE);
+}
+
+// register path in both contexts; returns 0 if regcomp didn't like it (in which case
+// all handlers registered before are gone too)
+static int add_pattern(h2ow_context* frozen, h2ow_context* linear, const char* path,
+                       int methods) {
+	if (!h2ow_register_handler(frozen, methods, path, H2OW_REGEX_PATH, handler))
+		return 0;
+	if (!h2ow_register_handler(linear, methods, path, H2OW_REGEX_PATH, handler)) {
+		printf("\"%s\" could only be registered once\n", path);
+		exit(1);
+	}
+	return 1;
+}
+
+static void freeze(h2ow_context* frozen) {
+	if (h2ow__freeze_handler_lists(&frozen->handlers) != 0) {
+		printf("couldn't freeze the handler lists\n");
+		exit(1);
+	}
+}
+
+static void check_corpus(void) {
+	h2ow_context frozen, linear;
+	init_contexts(&frozen, &linear);
+
+	for (int i = 0; i < NUM_PATTERNS; i++) {
+		if (!add_pattern(&frozen, &linear, patterns[i], methods[i % 4])) {
+			printf("regcomp rejected \"%s\"\n", patterns[i]);
+			exit(1);
+		}
+	}
+	freeze(&frozen);
+
+	// make sure the corpus still covers what it's supposed to
+	const h2ow_regex_dfa* dfa = &frozen.handlers.regex_dfa;
+	if (dfa->num_groups < 2 || dfa->num_fallbacks < 8) {
+		printf("expected several DFAs and at least 8 fallbacks, got %d and %d\n",
+		       dfa->num_groups, dfa->num_fallbacks);
+		failures++;
+	}
+
+	for (int i = 0; i < NUM_PATHS; i++)
+		compare(&frozen, &linear, paths[i], strlen(paths[i]));
+
+	// paths with null bytes end there for regexec
+	compare(&frozen, &linear, "/ac\0/bcc", 8);
+
+	h2ow__free_handler_lists(&frozen.handlers);
+	h2ow__free_handler_lists(&linear.handlers);
+}
+
+static void check_random(int iterations) {
+	srand(1);
+	for (int it = 0; it < iterations; it++) {
+		h2ow_context frozen, linear;
+		init_contexts(&frozen, &linear);
+
+		// handlers keep pointers to their paths, so every pattern needs its own
+		int num_patterns = 1 + rand() % 70;
+		char* pats[num_patterns];
+		for (int i = 0; i < num_patterns; i++) {
+			char pattern[128] = "";
+			for (int j = 1 + rand() % 5; j > 0; j--) {
+				strcat(pattern, atoms[rand() % (sizeof(atoms) / sizeof(*atoms))]);
+				strcat(pattern, ops[rand() % (sizeof(ops) / sizeof(*ops))]);
+				if (rand() % 8 == 0)
+					strcat(pattern, "|");
+			}
+			pats[i] = strdup(pattern);
+
+			// a failed registration throws away all handlers, so check first
+			regex_t re;
+			if (regcomp(&re, pattern, REG_EXTENDED) != 0)
+				continue;
+			regfree(&re);
+			add_pattern(&frozen, &linear, pats[i], methods[rand() % 4]);
+		}
+		freeze(&frozen);
+
+		for (int k = 0; k < 100; k++) {
+			char path[16];
+			int len = rand() % 12;
+			for (int j = 0; j < len; j++)
+				path[j] = path_chars[rand() % (sizeof(path_chars) - 1)];
+			compare(&frozen, &linear, path, len);
+		}
+
+		h2ow__free_handler_lists(&frozen.handlers);
+		h2ow__free_handler_lists(&linear.handlers);
+		for (int i = 0; i < num_patterns; i++)
+			free(pats[i]);
+	}
+}
+
+int main(int argc, char** argv) {
+	check_corpus();
+	check_random(argc > 1 ? atoi(argv[1]) : 300);
+
+	if (failures > 0) {
+		printf("%d mismatches\n", failures);
+		return 1;
+	}
+	return 0;
+}
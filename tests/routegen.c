@@ -0,0 +1,278 @@
+/* checks the output of h2ow-routegen against the runtime lists: the routes of
+ * routes.spec (which cmake turns into test_routes) are also registered one by one
+ * from the spec, and every corpus path has to find the same handler, allowed methods
+ * and captures with both, for every method. the corpus is made of the paths in the
+ * spec and paths that differ from the fixed ones by a single byte, or are a bit
+ * longer or shorter.
+ */
+
+#include "h2ow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern const h2ow_static_routes test_routes;
+
+// the handlers in routes.spec; they are only compared, never called
+void root(h2o_req_t* req, h2ow_run_context* rctx) {
+	(void)req;
+	(void)rctx;
+}
+
+void h_a(h2o_req_t* req, h2ow_run_context* rctx) {
+	(void)req;
+	(void)rctx;
+}
+
+void h_b(h2o_req_t* req, h2ow_run_context* rctx) {
+	(void)req;
+	(void)rctx;
+}
+
+void h_c(h2o_req_t* req, h2ow_run_context* rctx) {
+	(void)req;
+	(void)rctx;
+}
+
+void user(h2o_req_t* req, h2ow_run_context* rctx, h2o_iovec_t* captures,
+          int num_captures) {
+	(void)req;
+	(void)rctx;
+	(void)captures;
+	(void)num_captures;
+}
+
+void captured(h2o_req_t* req, h2ow_run_context* rctx, h2o_iovec_t* captures,
+              int num_captures) {
+	(void)req;
+	(void)rctx;
+	(void)captures;
+	(void)num_captures;
+}
+
+static const struct {
+	const char* name;
+	void (*handler)(h2o_req_t*, h2ow_run_context*);
+	void (*capture_handler)(h2o_req_t*, h2ow_run_context*, h2o_iovec_t*, int);
+} handlers[] = { { "root", root, NULL }, { "h_a", h_a, NULL },     { "h_b", h_b, NULL },
+	             { "h_c", h_c, NULL },   { "user", NULL, user }, { "captured", NULL, captured } };
+#define NUM_HANDLERS (int)(sizeof(handlers) / sizeof(*handlers))
+
+static const char* method_names[H2OW_NUM_METHODS]
+        = { "GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "CONNECT", "PATCH", "TRACE" };
+static const char* type_names[H2OW_NUM_PATH_TYPES]
+        = { "fixed", "wildcard", "regex", "param" };
+
+// paths that aren't derived from fixed routes
+static const char* extra_paths[]
+        = { "",           "/users/",         "/users/12",        "/users/12/posts/3",
+	        "/users/me/posts/", "/usersx",   "/abd/1",           "/abd/",
+	        "/static/x.css", "/static/",     "/api/v3/status",   "/api/v1/x/status",
+	        "/api/v9/abc", "/api/v9/ab1",    "/bacac",           "/bab",
+	        "/regex/12/ab", "/regex//",      "/regex/1/A",       "/hello/" };
+
+static char* paths[4096];
+static int num_paths;
+
+// paths of the registered routes, which the handler lists point to
+static char* route_paths[256];
+static int num_route_paths;
+
+static int failures = 0;
+
+static void add_path(const char* path, size_t len) {
+	if (num_paths == (int)(sizeof(paths) / sizeof(*paths))) {
+		printf("too many paths\n");
+		exit(1);
+	}
+	paths[num_paths] = malloc(len + 1);
+	memcpy(paths[num_paths], path, len);
+	paths[num_paths++][len] = '\0';
+}
+
+// register the routes of the spec like a program without generated routes would,
+// and collect the corpus
+static void read_spec(h2ow_context* wctx, const char* filename) {
+	FILE* f = fopen(filename, "r");
+	if (f == NULL) {
+		printf("couldn't open %s\n", filename);
+		exit(1);
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char* fields[5];
+		int num_fields = 0;
+		for (char* tok = strtok(line, " \t\r\n"); tok != NULL && num_fields < 5;
+		     tok = strtok(NULL, " \t\r\n"))
+		{
+			fields[num_fields++] = tok;
+		}
+		if (num_fields == 0 || fields[0][0] == '#')
+			continue;
+
+		int methods = 0;
+		if (strcmp(fields[0], "ANY") == 0) {
+			methods = H2OW_METHOD_ANY;
+		}
+		else {
+			for (char* m = strtok(fields[0], "|"); m != NULL; m = strtok(NULL, "|")) {
+				for (int i = 0; i < H2OW_NUM_METHODS; i++) {
+					if (strcmp(m, method_names[i]) == 0)
+						methods |= 1 << i;
+				}
+			}
+		}
+
+		int type = 0, h = 0;
+		while (type < H2OW_NUM_PATH_TYPES && strcmp(fields[1], type_names[type]) != 0) {
+			type++;
+		}
+		while (h < NUM_HANDLERS && strcmp(fields[3], handlers[h].name) != 0) {
+			h++;
+		}
+		if (type == H2OW_NUM_PATH_TYPES || h == NUM_HANDLERS) {
+			printf("unknown type or handler in route for %s\n", fields[2]);
+			exit(1);
+		}
+
+		// the lists keep the pointer to the path
+		if (num_route_paths == (int)(sizeof(route_paths) / sizeof(*route_paths))) {
+			printf("too many routes\n");
+			exit(1);
+		}
+		const char* path = route_paths[num_route_paths++] = strdup(fields[2]);
+		int ok = handlers[h].capture_handler != NULL
+		                 ? h2ow_register_capture_handler(wctx, methods, path, type,
+		                                                 handlers[h].capture_handler)
+		                 : h2ow_register_handler(wctx, methods, path, type,
+		                                         handlers[h].handler);
+		if (!ok) {
+			printf("couldn't register %s\n", path);
+			exit(1);
+		}
+
+		add_path(path, strlen(path));
+		if (type != H2OW_FIXED_PATH)
+			continue;
+
+		// everything at most one byte away from the path, and all of its prefixes
+		size_t len = strlen(path);
+		char buf[len + 2];
+		for (size_t i = 0; i < len; i++) {
+			add_path(path, i);
+
+			memcpy(buf, path, len);
+			buf[i] = buf[i] == 'z' ? 'y' : 'z';
+			add_path(buf, len);
+			buf[i] = '/';
+			add_path(buf, len);
+		}
+		memcpy(buf, path, len);
+		buf[len] = 'x';
+		add_path(buf, len + 1);
+		buf[len] = '/';
+		add_path(buf, len + 1);
+	}
+
+	fclose(f);
+}
+
+static const char* handler_name(const h2ow_request_handler* handler) {
+	if (handler == NULL)
+		return "nothing";
+
+	for (int h = 0; h < NUM_HANDLERS; h++) {
+		if (handler->handler == handlers[h].handler
+		    && handler->capture_handler == handlers[h].capture_handler)
+			return handlers[h].name;
+	}
+	return "an unknown handler";
+}
+
+static int same_handler(const h2ow_request_handler* a, const h2ow_request_handler* b) {
+	if (a == NULL || b == NULL)
+		return a == b;
+
+	return a->handler == b->handler && a->capture_handler == b->capture_handler
+	       && a->methods == b->methods && a->call_type == b->call_type
+	       && strcmp(a->path, b->path) == 0;
+}
+
+static int same_captures(const h2ow_route_match* a, const h2ow_route_match* b) {
+	if (a->num_captures != b->num_captures)
+		return 0;
+
+	for (int i = 0; i < a->num_captures; i++) {
+		if (a->captures[i].base != b->captures[i].base
+		    || a->captures[i].len != b->captures[i].len)
+			return 0;
+	}
+	return 1;
+}
+
+static void compare(h2ow_context* generated, h2ow_context* registered, const char* path,
+                    h2o_mem_pool_t* pool) {
+	size_t len = strlen(path);
+
+	for (int m = 0; m < H2OW_NUM_METHODS; m++) {
+		h2ow_route_match gm, rm;
+		h2ow_request_handler* g = h2ow__find_matching_handler(
+		        &generated->handlers, path, len, 1 << m, pool, &gm);
+		h2ow_request_handler* r = h2ow__find_matching_handler(
+		        &registered->handlers, path, len, 1 << m, pool, &rm);
+
+		if (!same_handler(g, r) || gm.allowed_methods != rm.allowed_methods
+		    || !same_captures(&gm, &rm))
+		{
+			if (failures++ < 20) {
+				printf("mismatch for \"%s\" (%s): generated routes found %s (allowed "
+				       "%d, %d captures), registered ones %s (allowed %d, %d "
+				       "captures)\n",
+				       path, method_names[m], handler_name(g), gm.allowed_methods,
+				       gm.num_captures, handler_name(r), rm.allowed_methods,
+				       rm.num_captures);
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	h2ow_context generated, registered;
+	h2ow_set_defaults(&generated);
+	h2ow_set_defaults(&registered);
+
+	read_spec(&registered, argc > 1 ? argv[1] : H2OW_TEST_SPEC);
+	for (int i = 0; i < (int)(sizeof(extra_paths) / sizeof(*extra_paths)); i++) {
+		add_path(extra_paths[i], strlen(extra_paths[i]));
+	}
+
+	// the generated routes are only used once frozen, like when the server starts
+	if (!h2ow_use_static_routes(&generated, &test_routes)
+	    || h2ow__freeze_handler_lists(&generated.handlers) != 0)
+	{
+		printf("couldn't use the generated routes\n");
+		return 1;
+	}
+
+	h2o_mem_pool_t pool;
+	h2o_mem_init_pool(&pool);
+	for (int i = 0; i < num_paths; i++) {
+		compare(&generated, &registered, paths[i], &pool);
+		free(paths[i]);
+	}
+	h2o_mem_clear_pool(&pool);
+
+	h2ow__free_handler_lists(&generated.handlers);
+	h2ow__free_handler_lists(&registered.handlers);
+	for (int i = 0; i < num_route_paths; i++) {
+		free(route_paths[i]);
+	}
+
+	if (failures > 0) {
+		printf("%d mismatches\n", failures);
+		return 1;
+	}
+	return 0;
+}
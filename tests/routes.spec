@@ -0,0 +1,35 @@
+# routes for tests/routegen.c; see tools/h2ow-routegen.c for the format. fixed paths
+# share lengths and prefixes so that the matcher has to switch on several bytes
+# methods		type		path				handler		[captures]
+GET|HEAD		fixed		/				root
+GET			fixed		/a				h_a
+POST			fixed		/b				h_b
+GET			fixed		/ab				h_a
+GET			fixed		/ba				h_b
+ANY			fixed		/abc				h_c
+GET			fixed		/abd				h_a
+POST			fixed		/abd				h_b
+PUT|DELETE		fixed		/abd				h_c
+GET			fixed		/abd				h_c
+GET			fixed		/users				h_a
+POST			fixed		/users				h_b
+GET			fixed		/users/me			h_a
+GET			fixed		/users/us			h_b
+GET			fixed		/usera/me			h_c
+PATCH|OPTIONS		fixed		/hello/world			h_a
+TRACE|CONNECT		fixed		/hello/worle			h_b
+GET			fixed		/hello/worlds			h_c
+GET			fixed		/q?x=1				h_a
+GET			fixed		/quote"and\back			h_b
+GET			fixed		/api/v1/status			h_a
+GET			fixed		/api/v2/status			h_b
+GET			fixed		/api/v1/statuz			h_c
+GET			param		/users/:id			user		captures
+POST			param		/users/:id/posts/:post		user		captures
+GET			param		/abd/:x				h_a
+ANY			wildcard	/static/*			h_b
+GET			wildcard	/users/*			h_c
+GET			wildcard	/api/*/status			h_a
+POST			regex		^/api/v[0-9]+/[a-z]+$		h_b
+ANY			regex		^/b(a|c)+$			h_c
+GET			regex		^/regex/([0-9]+)/([a-z]*)$	captured	captures
@@ -0,0 +1,226 @@
+#include "urlencoded-ref.h"
+
+#include <string.h>
+
+static int hex_val(unsigned char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// decode the escape at *rh to *wh; returns -1 if it isn't one
+static int decode_escape(char** wh, char** rh, char* end) {
+	if (*rh >= end - 3)
+		return -1;
+
+	unsigned char* urh = (unsigned char*)*rh;
+	int a = hex_val(urh[1]), b = hex_val(urh[2]);
+	if (a == -1 || b == -1)
+		return -1;
+
+	**wh = (a << 4) | b;
+	*wh += 1, *rh += 3;
+	return 0;
+}
+
+int ref_post_parse(h2o_req_t* req, ref_field* fields, int* num_fields) {
+	// read head, write head
+	char *rh = req->entity.base, *wh = rh;
+	char* end = rh + req->entity.len;
+
+	*num_fields = 0;
+	if (rh == end)
+		return -1;
+
+	while (rh < end) {
+		char* name = wh;
+		int name_len;
+		char* val = NULL;
+		int val_len = 0;
+
+		// loop until the end of the field name
+		while (*rh != '=') {
+			// the last byte of the body ends the name, and it's copied into the pool
+			if (rh == end - 1) {
+				name_len = wh - name + 1;
+				char* tmp = h2o_mem_alloc_shared(&req->pool, name_len + 1, NULL);
+				memcpy(tmp, name, name_len);
+				tmp[name_len] = '\0';
+				name = tmp;
+
+				rh = end;
+				goto insert_val;
+			}
+
+			switch (*rh) {
+			// a key without a value
+			case '&':
+				name_len = wh - name;
+				goto after_val;
+
+			case '+':
+				*wh = ' ';
+				wh++, rh++;
+				break;
+
+			case '%':
+				if (decode_escape(&wh, &rh, end) < 0)
+					return -1;
+				break;
+
+			default:
+				*wh = *rh;
+				wh++, rh++;
+				break;
+			}
+		}
+
+		name_len = wh - name;
+		*wh = '\0';
+		wh++, rh++;
+
+		// an '=' at the end of the body; val points to the null byte we just made
+		if (rh == end) {
+			val = wh - 1;
+			goto insert_val;
+		}
+
+		val = wh;
+		// loop until the end of the value
+		while (*rh != '&') {
+			if (rh == end - 1) {
+				val_len = wh - val + 1;
+				char* tmp = h2o_mem_alloc_shared(&req->pool, val_len + 1, NULL);
+				memcpy(tmp, val, val_len);
+				tmp[val_len] = '\0';
+				val = tmp;
+
+				rh = end;
+				goto insert_val;
+			}
+
+			switch (*rh) {
+			case '+':
+				*wh = ' ';
+				wh++, rh++;
+				break;
+
+			case '%':
+				if (decode_escape(&wh, &rh, end) < 0)
+					return -1;
+				break;
+
+			default:
+				*wh = *rh;
+				wh++, rh++;
+				break;
+			}
+		}
+
+	after_val:
+		*wh = '\0';
+
+	insert_val:
+		// "&=" or "&&"
+		if (name_len <= 0)
+			return -1;
+
+		fields[*num_fields].key = name;
+		fields[*num_fields].key_len = name_len;
+		fields[*num_fields].val = val;
+		fields[*num_fields].val_len = val != NULL ? strlen(val) : 0;
+		(*num_fields)++;
+
+		wh++, rh++;
+	}
+
+	return 0;
+}
+
+int ref_post_parse_vecs(h2o_req_t* req, ref_field* fields, int* num_fields) {
+	char *rh = req->entity.base, *wh = rh;
+	char* end = rh + req->entity.len;
+
+	*num_fields = 0;
+	if (rh == end)
+		return -1;
+
+	while (rh < end) {
+		char* name = wh;
+		int name_len;
+		char* val = NULL;
+		int val_len;
+
+		// the old parser read *rh before checking rh < end, which only worked because
+		// h2o leaves room after the body; the order doesn't matter otherwise
+		while (rh < end && *rh != '=') {
+			switch (*rh) {
+			case '&':
+				name_len = wh - name;
+				val_len = 0;
+				goto insert_val;
+
+			case '+':
+				*wh = ' ';
+				wh++, rh++;
+				break;
+
+			case '%':
+				if (decode_escape(&wh, &rh, end) < 0)
+					return -1;
+				break;
+
+			default:
+				*wh = *rh;
+				wh++, rh++;
+				break;
+			}
+		}
+
+		name_len = wh - name;
+		wh++, rh++;
+
+		val = wh;
+		while (rh < end && *rh != '&') {
+			switch (*rh) {
+			case '+':
+				*wh = ' ';
+				wh++, rh++;
+				break;
+
+			case '%':
+				if (decode_escape(&wh, &rh, end) < 0)
+					return -1;
+				break;
+
+			default:
+				*wh = *rh;
+				wh++, rh++;
+				break;
+			}
+		}
+
+		val_len = wh - val;
+
+	insert_val:
+		// "&=" or "&&" are skipped here
+		if (name_len <= 0) {
+			wh++, rh++;
+			continue;
+		}
+
+		fields[*num_fields].key = name;
+		fields[*num_fields].key_len = name_len;
+		fields[*num_fields].val = val;
+		fields[*num_fields].val_len = val_len;
+		(*num_fields)++;
+
+		wh++, rh++;
+	}
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef _H2OW_TESTS_URLENCODED_REF_INCLUDED
+#define _H2OW_TESTS_URLENCODED_REF_INCLUDED
+
+#include "h2ow.h"
+
+/* the x-www-form-urlencoded parsers from before utils.c decoded runs with simd, which
+ * go through the body one byte at a time. they decode it in place the same way, but
+ * only collect the fields in order instead of indexing them, so the test and the
+ * benchmark can compare them to h2ow_post_parse and h2ow_post_parse_vecs.
+ */
+typedef struct ref_field_s {
+	char* key;
+	size_t key_len;
+	// NULL for keys without a value in ref_post_parse
+	char* val;
+	size_t val_len;
+} ref_field;
+
+// fields needs room for req->entity.len + 1 fields; both return 0 or -1, like the
+// parsers in utils.c
+int ref_post_parse(h2o_req_t* req, ref_field* fields, int* num_fields);
+int ref_post_parse_vecs(h2o_req_t* req, ref_field* fields, int* num_fields);
+
+#endif
@@ -0,0 +1,332 @@
+/* checks h2ow_post_parse and h2ow_post_parse_vecs against the byte-at-a-time parsers
+ * in urlencoded-ref.c: random bodies are decoded by both, and they have to agree on
+ * whether the body is valid, leave the same bytes in it, and find the same fields.
+ * the bodies are made of few different bytes, so they have lots of escapes (broken
+ * ones too) and separators, or of long runs of letters that end anywhere relative to
+ * the 16 and 32 byte blocks clean_run looks at.
+ *
+ * every parsed form is also looked up with h2ow_post_get and h2ow_post_get_vec, by
+ * all of its keys and some that aren't in it, which has to find the same field as
+ * going through the fields (the last one, for keys that appear more than once).
+ * forms with lots of fields and repeated keys make the index span several groups.
+ * h2ow_post_lazy_get has to agree with h2ow_post_get_vec on the same keys, on a copy
+ * of the body from before parsing; each key is looked up twice, with one lazy lookup
+ * for the whole form, so its memo gets hits, misses and evictions.
+ */
+
+#include "h2ow.h"
+#include "urlencoded-ref.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BODY 4096
+#define MAX_RANDOM_BODY 600
+#define MAX_FORM_FIELDS 300
+
+static int failures = 0;
+
+static void gen_body(char* body, size_t len, int mode) {
+	static const char* alphabets[] = { "ab%+&=", "abcdefghij0123456789ABCDEF%+&=" };
+
+	for (size_t i = 0; i < len; i++) {
+		if (mode == 2 && rand() % 24 != 0) {
+			body[i] = 'a' + rand() % 26;
+			continue;
+		}
+
+		const char* alphabet = alphabets[mode == 0 ? 0 : 1];
+		body[i] = alphabet[rand() % strlen(alphabet)];
+	}
+}
+
+static void report(const char* what, const char* body, size_t len) {
+	if (failures++ < 10)
+		printf("%s mismatch on \"%.*s\"\n", what, (int)len, body);
+}
+
+static int same_str(const char* a, const char* b) {
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static int same_vec(const char* a, size_t a_len, h2o_iovec_t b) {
+	return a_len == b.len && (a_len == 0 || memcmp(a, b.base, a_len) == 0);
+}
+
+// the last field with key, found by going through all of them
+static int find_cstr(const h2ow_post_data* data, const char* key) {
+	for (int i = data->num_fields - 1; i >= 0; i--) {
+		if (strcmp(data->fields[i].key, key) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int find_vec(const h2ow_post_vecs* data, const char* key, size_t len) {
+	for (int i = data->num_fields - 1; i >= 0; i--) {
+		if (same_vec(key, len, data->fields[i].key))
+			return i;
+	}
+	return -1;
+}
+
+// keys to look up for a key of the form: the key itself, and ones that are a byte
+// longer or shorter, which usually aren't in the form. returns how many there are
+static int probe_keys(char probes[3][MAX_BODY + 2], size_t lens[3], const char* key,
+                      size_t len) {
+	memcpy(probes[0], key, len);
+	lens[0] = len;
+	memcpy(probes[1], key, len);
+	probes[1][len] = '!';
+	lens[1] = len + 1;
+	if (len == 0)
+		return 2;
+
+	memcpy(probes[2], key, len - 1);
+	lens[2] = len - 1;
+	return 3;
+}
+
+static const char* absent_keys[] = { "", "zz", "missing", "a b c d e f g h" };
+#define NUM_ABSENT_KEYS (int)(sizeof(absent_keys) / sizeof(*absent_keys))
+
+// returns 1 if a lookup found the wrong field
+static int check_lookups_cstr(h2ow_post_data* data) {
+	static char probes[3][MAX_BODY + 2];
+	size_t lens[3];
+
+	for (int i = 0; i < data->num_fields + NUM_ABSENT_KEYS; i++) {
+		const char* key = i < data->num_fields ? data->fields[i].key
+		                                       : absent_keys[i - data->num_fields];
+		int num = probe_keys(probes, lens, key, strlen(key));
+
+		for (int j = 0; j < num; j++) {
+			probes[j][lens[j]] = '\0';
+			int expected = find_cstr(data, probes[j]);
+			h2ow_post_field* got = h2ow_post_get(data, probes[j]);
+
+			if (got != (expected >= 0 ? &data->fields[expected] : NULL))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static int check_lookups_vecs(h2ow_post_vecs* data) {
+	static char probes[3][MAX_BODY + 2];
+	size_t lens[3];
+
+	for (int i = 0; i < data->num_fields + NUM_ABSENT_KEYS; i++) {
+		h2o_iovec_t key;
+		if (i < data->num_fields) {
+			key = data->fields[i].key;
+		}
+		else {
+			const char* absent = absent_keys[i - data->num_fields];
+			key = h2o_iovec_init(absent, strlen(absent));
+		}
+		int num = probe_keys(probes, lens, key.base, key.len);
+
+		for (int j = 0; j < num; j++) {
+			int expected = find_vec(data, probes[j], lens[j]);
+			h2ow_post_vec* got = h2ow_post_get_vec(data, probes[j], lens[j]);
+
+			if (got != (expected >= 0 ? &data->fields[expected] : NULL))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static int check_lazy_key(h2ow_post_lazy* lazy, h2ow_post_vecs* data, const char* key,
+                          size_t len) {
+	h2ow_post_vec* expected = h2ow_post_get_vec(data, key, len);
+	h2o_iovec_t val;
+	int ret = h2ow_post_lazy_get(lazy, key, len, &val);
+
+	if (expected == NULL)
+		return ret != 0;
+	return ret != 1 || !same_vec(val.base, val.len, expected->val);
+}
+
+// body is the form before data was parsed from it; returns 1 on a mismatch
+static int check_lazy(h2ow_post_vecs* data, char* body, size_t len) {
+	static char probes[3][MAX_BODY + 2];
+	size_t lens[3];
+	h2o_req_t req;
+	h2ow_post_lazy lazy;
+	int mismatch = 0;
+
+	memset(&req, 0, sizeof(req));
+	h2o_mem_init_pool(&req.pool);
+	req.entity = h2o_iovec_init(body, len);
+	h2ow_post_lazy_init(&req, &lazy);
+
+	// forwards and then backwards, so the second lookup of a key comes from the
+	// memo for forms with few keys, and scans the body again after it was evicted
+	// for ones with many
+	int total = data->num_fields + NUM_ABSENT_KEYS;
+	for (int n = 0; n < 2 * total && !mismatch; n++) {
+		int i = n < total ? n : 2 * total - 1 - n;
+		h2o_iovec_t key;
+		if (i < data->num_fields) {
+			key = data->fields[i].key;
+		}
+		else {
+			const char* absent = absent_keys[i - data->num_fields];
+			key = h2o_iovec_init(absent, strlen(absent));
+		}
+		int num = probe_keys(probes, lens, key.base, key.len);
+
+		for (int j = 0; j < num && !mismatch; j++)
+			mismatch = check_lazy_key(&lazy, data, probes[j], lens[j]);
+	}
+
+	h2o_mem_clear_pool(&req.pool);
+	return mismatch;
+}
+
+// run one of the parsers on a copy of body each; the copies are followed by some
+// bytes that aren't part of the entity, like in h2o's buffers
+static void compare(const char* body, size_t len, int vecs) {
+	char ref_buf[MAX_BODY + 2], buf[MAX_BODY + 2], lazy_buf[MAX_BODY + 2];
+	ref_field ref_fields[MAX_BODY + 1];
+	int ref_num;
+	int ref_ret, ret;
+	int mismatch = 0;
+
+	memcpy(ref_buf, body, len);
+	memcpy(buf, body, len);
+	memcpy(lazy_buf, body, len);
+	memset(ref_buf + len, 'x', 2);
+	memset(buf + len, 'x', 2);
+
+	h2o_req_t ref_req, req;
+	memset(&ref_req, 0, sizeof(ref_req));
+	memset(&req, 0, sizeof(req));
+	h2o_mem_init_pool(&ref_req.pool);
+	h2o_mem_init_pool(&req.pool);
+	ref_req.entity = h2o_iovec_init(ref_buf, len);
+	req.entity = h2o_iovec_init(buf, len);
+
+	if (vecs) {
+		h2ow_post_vecs data;
+		ref_ret = ref_post_parse_vecs(&ref_req, ref_fields, &ref_num);
+		ret = h2ow_post_parse_vecs(&req, &data);
+
+		if (ret == 0 && ref_ret == 0) {
+			mismatch = data.num_fields != ref_num;
+			for (int i = 0; !mismatch && i < ref_num; i++) {
+				ref_field* f = &ref_fields[i];
+				mismatch = !same_vec(f->key, f->key_len, data.fields[i].key)
+				           || !same_vec(f->val, f->val_len, data.fields[i].val);
+			}
+		}
+		if (ret == 0 && check_lookups_vecs(&data))
+			report("vecs lookup", body, len);
+		if (ret == 0 && check_lazy(&data, lazy_buf, len))
+			report("lazy lookup", body, len);
+	}
+	else {
+		h2ow_post_data data;
+		ref_ret = ref_post_parse(&ref_req, ref_fields, &ref_num);
+		ret = h2ow_post_parse(&req, &data);
+
+		if (ret == 0 && ref_ret == 0) {
+			mismatch = data.num_fields != ref_num;
+			for (int i = 0; !mismatch && i < ref_num; i++) {
+				mismatch = !same_str(ref_fields[i].key, data.fields[i].key)
+				           || !same_str(ref_fields[i].val, data.fields[i].val);
+			}
+		}
+		if (ret == 0 && check_lookups_cstr(&data))
+			report("cstr lookup", body, len);
+	}
+
+	if (ret != ref_ret || mismatch || memcmp(ref_buf, buf, len + 2) != 0)
+		report(vecs ? "vecs" : "cstr", body, len);
+
+	h2o_mem_clear_pool(&ref_req.pool);
+	h2o_mem_clear_pool(&req.pool);
+}
+
+static const char* bodies[] = {
+	"a=b",
+	"a=b&c=d",
+	"a&b=c",
+	"a=",
+	"=b",
+	"a=b&",
+	"a=b&&c=d",
+	"a=b&=c",
+	"a+b=c+d",
+	"%61=%62",
+	"a=%2",
+	"a=%zz",
+	"a=b%20",
+	"a%20=b",
+	"a%3D=b%26c",
+	"a=b=c",
+	"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa=bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb",
+	"a=bbbbbbbbbbbbbbb+&c=ddddddddddddddddddddddddddddddd%41eeeeeeeeeeeeeeeeeeeeeeeeeeee",
+};
+#define NUM_BODIES (int)(sizeof(bodies) / sizeof(*bodies))
+
+// a form of num_fields fields with num_keys different keys. the first digit of a key
+// is escaped sometimes, so the same key is encoded in different ways
+static size_t gen_form(char* body, int num_fields, int num_keys) {
+	size_t len = 0;
+
+	for (int i = 0; i < num_fields; i++) {
+		char key[16];
+		sprintf(key, "%d", rand() % num_keys);
+
+		if (rand() % 4 == 0)
+			len += sprintf(body + len, "k%%%02X%s=v%d&", key[0], key + 1, i);
+		else
+			len += sprintf(body + len, "k%s=v%d&", key, i);
+	}
+
+	// no trailing '&'
+	return len - 1;
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+	for (int i = 0; i < NUM_BODIES; i++) {
+		compare(bodies[i], strlen(bodies[i]), 0);
+		compare(bodies[i], strlen(bodies[i]), 1);
+	}
+	compare("", 0, 0);
+	compare("", 0, 1);
+
+	srand(1);
+	for (int it = 0; it < iterations; it++) {
+		char body[MAX_BODY];
+		int mode = it % 3;
+		size_t len = 1 + rand() % (mode == 2 ? MAX_RANDOM_BODY : 40);
+
+		gen_body(body, len, mode);
+		compare(body, len, it & 1);
+	}
+
+	// forms with more fields than fit into one group of the index (14)
+	for (int it = 0; it < 2000; it++) {
+		char body[MAX_BODY];
+		int num_fields = 1 + rand() % MAX_FORM_FIELDS;
+		int num_keys = 1 + rand() % num_fields;
+
+		size_t len = gen_form(body, num_fields, num_keys);
+		compare(body, len, it & 1);
+	}
+
+	if (failures > 0) {
+		printf("%d mismatches\n", failures);
+		return 1;
+	}
+	return 0;
+}
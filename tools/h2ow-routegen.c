@@ -0,0 +1,427 @@
+/* h2ow-routegen: turns a route spec into a C file with static handler lists, which
+ * can be passed to h2ow_use_static_routes instead of registering handlers one by
+ * one at startup. FIXED_PATH handlers are additionally compiled into a matcher that
+ * switches on the length and then on single bytes of the path, so finding one
+ * costs a few jumps and a single memcmp.
+ *
+ * usage: h2ow-routegen <spec> <output.c> <name>
+ *
+ * every non-empty line of the spec that doesn't start with '#' is a route:
+ *
+ *   <methods> <type> <path> <handler> [captures]
+ *
+ * methods are method names separated by '|' (or ANY), type is one of fixed, param,
+ * wildcard or regex, and handler is the name of the handler function. routes marked
+ * with "captures" are registered like with h2ow_register_capture_handler. routes
+ * are matched in the order they appear in, just like registered handlers.
+ *
+ * the generated file defines a const h2ow_static_routes called <name>.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE 4096
+
+// same order as the bits of the H2OW_METHOD_* defines
+#define NUM_METHODS 9
+static const char* method_names[NUM_METHODS]
+        = { "GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "CONNECT", "PATCH", "TRACE" };
+
+// same order as the H2OW_*_PATH defines
+#define NUM_TYPES 4
+static const char* type_names[NUM_TYPES] = { "fixed", "wildcard", "regex", "param" };
+static const char* type_defines[NUM_TYPES]
+        = { "H2OW_FIXED_PATH", "H2OW_WILDCARD_PATH", "H2OW_REGEX_PATH", "H2OW_PARAM_PATH" };
+
+typedef struct route_s {
+	int methods; // -1 for ANY
+	int type;
+	char* path;
+	char* handler;
+	int captures;
+} route;
+
+// all FIXED_PATH routes with the same path, and which of them handles each method
+typedef struct fixed_path_s {
+	const char* path;
+	size_t len;
+	int methods;
+	int handlers[NUM_METHODS];
+} fixed_path;
+
+static route* routes;
+static int num_routes;
+
+static void* xrealloc(void* ptr, size_t size) {
+	ptr = realloc(ptr, size);
+	if (ptr == NULL) {
+		fprintf(stderr, "h2ow-routegen: out of memory\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+static char* xstrdup(const char* str) {
+	char* copy = xrealloc(NULL, strlen(str) + 1);
+	strcpy(copy, str);
+	return copy;
+}
+
+static int parse_methods(const char* str) {
+	if (strcmp(str, "ANY") == 0)
+		return -1;
+
+	int methods = 0;
+	while (*str != '\0') {
+		size_t len = strcspn(str, "|");
+		int i = 0;
+
+		while (i < NUM_METHODS
+		       && (strlen(method_names[i]) != len || strncmp(method_names[i], str, len)))
+		{
+			i++;
+		}
+		if (i == NUM_METHODS)
+			return 0;
+
+		methods |= 1 << i;
+		str += len;
+		if (*str == '|')
+			str++;
+	}
+
+	return methods;
+}
+
+static int parse_spec(const char* filename) {
+	FILE* f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "h2ow-routegen: couldn't open %s\n", filename);
+		return -1;
+	}
+
+	char line[MAX_LINE];
+	for (int line_num = 1; fgets(line, sizeof(line), f) != NULL; line_num++) {
+		char* fields[5];
+		int num_fields = 0;
+
+		for (char* tok = strtok(line, " \t\r\n"); tok != NULL && num_fields < 6;
+		     tok = strtok(NULL, " \t\r\n"))
+		{
+			if (num_fields == 5) {
+				num_fields++;
+				break;
+			}
+			fields[num_fields++] = tok;
+		}
+
+		if (num_fields == 0 || fields[0][0] == '#')
+			continue;
+
+		route r;
+		r.type = -1;
+		for (int i = 0; i < NUM_TYPES && num_fields >= 2; i++) {
+			if (strcmp(fields[1], type_names[i]) == 0)
+				r.type = i;
+		}
+
+		if (num_fields < 4 || num_fields > 5 || r.type < 0
+		    || (r.methods = parse_methods(fields[0])) == 0
+		    || (num_fields == 5 && strcmp(fields[4], "captures") != 0))
+		{
+			fprintf(stderr, "h2ow-routegen: %s:%d: invalid route\n", filename, line_num);
+			fclose(f);
+			return -1;
+		}
+
+		r.path = xstrdup(fields[2]);
+		r.handler = xstrdup(fields[3]);
+		r.captures = num_fields == 5;
+
+		routes = xrealloc(routes, (num_routes + 1) * sizeof(*routes));
+		routes[num_routes++] = r;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void emit_string(FILE* out, const char* str, size_t len) {
+	fputc('"', out);
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = str[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (isprint(c) && c != '?') // '?' so we don't accidentally make trigraphs
+			fputc(c, out);
+		else
+			fprintf(out, "\\%03o", c);
+	}
+	fputc('"', out);
+}
+
+static void emit_indent(FILE* out, int depth) {
+	for (int i = 0; i < depth; i++) {
+		fputc('\t', out);
+	}
+}
+
+static const fixed_path* sort_paths;
+static int sort_pos;
+static int compare_at_pos(const void* a, const void* b) {
+	unsigned char ca = sort_paths[*(const int*)a].path[sort_pos];
+	unsigned char cb = sort_paths[*(const int*)b].path[sort_pos];
+	return ca != cb ? ca - cb : *(const int*)a - *(const int*)b;
+}
+
+// emit code that finds which of the given (distinct) paths of length len the path
+// is. always ends with a return statement
+static void emit_matcher(FILE* out, const fixed_path* paths, int* idx, int num,
+                         size_t len, int depth) {
+	if (num == 1) {
+		const fixed_path* p = &paths[idx[0]];
+
+		emit_indent(out, depth);
+		fprintf(out, "return memcmp(path, ");
+		emit_string(out, p->path, len);
+		fprintf(out, ", %zu) == 0 ? %d : -1;\n", len, idx[0]);
+		return;
+	}
+
+	// switch on the first byte that not all of the paths have in common
+	size_t pos = 0;
+	for (;; pos++) {
+		int i = 1;
+		while (i < num && paths[idx[i]].path[pos] == paths[idx[0]].path[pos]) {
+			i++;
+		}
+		if (i < num)
+			break;
+	}
+
+	sort_paths = paths;
+	sort_pos = pos;
+	qsort(idx, num, sizeof(*idx), compare_at_pos);
+
+	emit_indent(out, depth);
+	fprintf(out, "switch ((unsigned char)path[%zu]) {\n", pos);
+
+	for (int start = 0, end; start < num; start = end) {
+		unsigned char c = paths[idx[start]].path[pos];
+
+		end = start + 1;
+		while (end < num && (unsigned char)paths[idx[end]].path[pos] == c) {
+			end++;
+		}
+
+		emit_indent(out, depth);
+		if (isalnum(c) || c == '/' || c == '.' || c == '-' || c == '_')
+			fprintf(out, "case '%c':\n", c);
+		else
+			fprintf(out, "case 0x%02x:\n", c);
+
+		emit_matcher(out, paths, idx + start, end - start, len, depth + 1);
+	}
+
+	emit_indent(out, depth);
+	fprintf(out, "}\n");
+	emit_indent(out, depth);
+	fprintf(out, "return -1;\n");
+}
+
+static int compare_len(const void* a, const void* b) {
+	size_t la = sort_paths[*(const int*)a].len, lb = sort_paths[*(const int*)b].len;
+	return la != lb ? (la < lb ? -1 : 1) : *(const int*)a - *(const int*)b;
+}
+
+static void emit_fixed_matcher(FILE* out) {
+	fixed_path* paths = NULL;
+	int num_paths = 0, num_fixed = 0;
+
+	// group fixed routes by path, remembering the first one for each method
+	for (int i = 0; i < num_routes; i++) {
+		if (routes[i].type != 0)
+			continue;
+
+		int p = 0;
+		while (p < num_paths && strcmp(paths[p].path, routes[i].path) != 0) {
+			p++;
+		}
+
+		if (p == num_paths) {
+			paths = xrealloc(paths, (num_paths + 1) * sizeof(*paths));
+			paths[p].path = routes[i].path;
+			paths[p].len = strlen(routes[i].path);
+			paths[p].methods = 0;
+			for (int m = 0; m < NUM_METHODS; m++) {
+				paths[p].handlers[m] = -1;
+			}
+			num_paths++;
+		}
+
+		for (int m = 0; m < NUM_METHODS; m++) {
+			if ((routes[i].methods & (1 << m)) && paths[p].handlers[m] < 0)
+				paths[p].handlers[m] = num_fixed;
+		}
+		paths[p].methods |= routes[i].methods & ((1 << NUM_METHODS) - 1);
+		num_fixed++;
+	}
+
+	if (num_paths == 0)
+		return;
+
+	fprintf(out, "// methods accepted by each fixed path, and the handler for each method\n");
+	fprintf(out, "static const struct {\n\tint methods;\n\tint handlers[H2OW_NUM_METHODS];\n"
+	             "} fixed_paths[] = {\n");
+	for (int p = 0; p < num_paths; p++) {
+		fprintf(out, "\t{ 0x%03x, {", paths[p].methods);
+		for (int m = 0; m < NUM_METHODS; m++) {
+			fprintf(out, " %d%s", paths[p].handlers[m], m + 1 < NUM_METHODS ? "," : " ");
+		}
+		fprintf(out, "} }, // ");
+		emit_string(out, paths[p].path, paths[p].len);
+		fprintf(out, "\n");
+	}
+	fprintf(out, "};\n\n");
+
+	// switch on the length first, then on bytes
+	int idx[num_paths];
+	for (int p = 0; p < num_paths; p++) {
+		idx[p] = p;
+	}
+	sort_paths = paths;
+	qsort(idx, num_paths, sizeof(*idx), compare_len);
+
+	fprintf(out, "static int find_fixed_path(const char* path, size_t path_len) {\n");
+	fprintf(out, "\tswitch (path_len) {\n");
+
+	for (int start = 0, end; start < num_paths; start = end) {
+		size_t len = paths[idx[start]].len;
+
+		end = start + 1;
+		while (end < num_paths && paths[idx[end]].len == len) {
+			end++;
+		}
+
+		fprintf(out, "\tcase %zu:\n", len);
+		emit_matcher(out, paths, idx + start, end - start, len, 2);
+	}
+
+	fprintf(out, "\t}\n\treturn -1;\n}\n\n");
+
+	fprintf(out, "static int find_fixed(const char* path, size_t path_len, int m,\n"
+	             "                      int* allowed_methods) {\n"
+	             "\tint p = find_fixed_path(path, path_len);\n"
+	             "\tif (p < 0)\n"
+	             "\t\treturn -1;\n\n"
+	             "\t*allowed_methods = fixed_paths[p].methods;\n"
+	             "\treturn fixed_paths[p].handlers[m];\n"
+	             "}\n\n");
+
+	free(paths);
+}
+
+static void emit_methods(FILE* out, int methods) {
+	if (methods == -1) {
+		fprintf(out, "H2OW_METHOD_ANY");
+		return;
+	}
+
+	int first = 1;
+	for (int m = 0; m < NUM_METHODS; m++) {
+		if (methods & (1 << m)) {
+			fprintf(out, "%sH2OW_METHOD_%s", first ? "" : " | ", method_names[m]);
+			first = 0;
+		}
+	}
+}
+
+static int emit(FILE* out, const char* spec, const char* name) {
+	fprintf(out, "// generated by h2ow-routegen from %s, don't edit\n\n", spec);
+	fprintf(out, "#include <string.h>\n\n#include \"h2ow.h\"\n\n");
+
+	// declare every handler once
+	for (int i = 0; i < num_routes; i++) {
+		int j = 0;
+		while (j < i && strcmp(routes[j].handler, routes[i].handler) != 0) {
+			j++;
+		}
+		if (j < i)
+			continue;
+
+		if (routes[i].captures)
+			fprintf(out, "void %s(h2o_req_t*, h2ow_run_context*, h2o_iovec_t*, int);\n",
+			        routes[i].handler);
+		else
+			fprintf(out, "void %s(h2o_req_t*, h2ow_run_context*);\n", routes[i].handler);
+	}
+	fprintf(out, "\n");
+
+	int counts[NUM_TYPES] = { 0 };
+	for (int t = 0; t < NUM_TYPES; t++) {
+		for (int i = 0; i < num_routes; i++) {
+			if (routes[i].type != t)
+				continue;
+
+			if (counts[t]++ == 0)
+				fprintf(out, "static h2ow_request_handler %s_handlers[] = {\n",
+				        type_names[t]);
+
+			fprintf(out, "\t{ .%s = %s,\n\t  .path = ",
+			        routes[i].captures ? "capture_handler" : "handler", routes[i].handler);
+			emit_string(out, routes[i].path, strlen(routes[i].path));
+			fprintf(out, ",\n\t  .methods = ");
+			emit_methods(out, routes[i].methods);
+			fprintf(out, ",\n\t  .call_type = %s },\n",
+			        routes[i].captures ? "H2OW_HANDLER_CAPTURES" : "H2OW_HANDLER_NORMAL");
+		}
+
+		if (counts[t] > 0)
+			fprintf(out, "};\n\n");
+	}
+
+	emit_fixed_matcher(out);
+
+	fprintf(out, "const h2ow_static_routes %s = {\n", name);
+	fprintf(out, "\t.handlers_lists = {");
+	for (int t = 0; t < NUM_TYPES; t++) {
+		if (counts[t] > 0)
+			fprintf(out, "\n\t\t[%s] = %s_handlers,", type_defines[t], type_names[t]);
+	}
+	fprintf(out, "\n\t},\n\t.num_handlers = {");
+	for (int t = 0; t < NUM_TYPES; t++) {
+		fprintf(out, "\n\t\t[%s] = %d,", type_defines[t], counts[t]);
+	}
+	fprintf(out, "\n\t},\n\t.find_fixed = %s,\n};\n", counts[0] > 0 ? "find_fixed" : "NULL");
+
+	return ferror(out) ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s <spec> <output.c> <name>\n", argv[0]);
+		return 1;
+	}
+
+	if (parse_spec(argv[1]) < 0)
+		return 1;
+
+	FILE* out = fopen(argv[2], "w");
+	if (out == NULL) {
+		fprintf(stderr, "h2ow-routegen: couldn't open %s\n", argv[2]);
+		return 1;
+	}
+
+	int ret = emit(out, argv[1], argv[3]);
+	if (fclose(out) != 0 || ret < 0) {
+		fprintf(stderr, "h2ow-routegen: couldn't write %s\n", argv[2]);
+		remove(argv[2]);
+		return 1;
+	}
+
+	return 0;
+}